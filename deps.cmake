@@ -36,6 +36,22 @@ if (NOT TARGET Bitsery::bitsery)
   FetchContent_MakeAvailable(bitsery)
 endif()
 
+if (NOT TARGET libzstd_static)
+  set(ZSTD_BUILD_PROGRAMS OFF CACHE BOOL "" FORCE)
+  set(ZSTD_BUILD_SHARED   OFF CACHE BOOL "" FORCE)
+  set(ZSTD_BUILD_STATIC   ON  CACHE BOOL "" FORCE)
+  set(ZSTD_BUILD_TESTS    OFF CACHE BOOL "" FORCE)
+  set(ZSTD_LEGACY_SUPPORT OFF CACHE BOOL "" FORCE)
+  FetchContent_Declare(zstd
+    GIT_REPOSITORY "https://github.com/facebook/zstd.git"
+    GIT_TAG        "v1.5.6"
+    GIT_SHALLOW    ON
+    SOURCE_SUBDIR  build/cmake)
+  FetchContent_MakeAvailable(zstd)
+  target_include_directories(libzstd_static INTERFACE
+    $<BUILD_INTERFACE:${zstd_SOURCE_DIR}/lib>)
+endif()
+
 if (NOT TARGET httplib::httplib)
   FetchContent_Declare(cpp-httplib
     GIT_REPOSITORY "https://github.com/yhirose/cpp-httplib.git"
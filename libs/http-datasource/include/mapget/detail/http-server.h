@@ -1,5 +1,6 @@
 #pragma once
 
+#include <chrono>
 #include <memory>
 #include <string>
 
@@ -55,6 +56,32 @@ public:
      */
     void waitForSignal();
 
+    /** Default for the number of streaming threads, see setThreadPool(). */
+    static constexpr size_t DefaultMaxStreamingThreads = 32;
+
+    /**
+     * Configure the threads which serve connections. Must be called before go().
+     * @param threads Number of threads for connections. 0 selects
+     *  cpp-httplib's default, which depends on the number of CPU cores.
+     * @param maxStreamingThreads Number of additional threads, which are started
+     *  while connections are busy with long streaming responses (see beginStreaming()),
+     *  so that these cannot block short requests.
+     * @param maxQueuedConnections Number of accepted connections which may wait
+     *  for a free thread. Further connections are closed. 0 for unlimited.
+     */
+    void setThreadPool(size_t threads, size_t maxStreamingThreads, size_t maxQueuedConnections);
+
+    /**
+     * Configure connection handling. Must be called before go().
+     * @param keepAliveMaxCount Number of requests which may be sent over one connection.
+     * @param keepAliveTimeout Time that an idle connection is kept open.
+     * @param readWriteTimeout Timeout for reading a request and writing a response chunk.
+     */
+    void setConnectionLimits(
+        size_t keepAliveMaxCount,
+        std::chrono::seconds keepAliveTimeout,
+        std::chrono::seconds readWriteTimeout);
+
     /**
      * Add a filesystem mount point in the format `<url-path-prefix>:<filesystem-path>`.
      * Returns true if successful, false otherwise.
@@ -84,6 +111,14 @@ protected:
      */
     void printPortToStdOut(bool enabled);
 
+    /**
+     * Mark the calling server thread as busy with a long streaming
+     * response until the returned handle is released, e.g. in the
+     * response's content provider release callback. Returns null if
+     * not called on a server thread.
+     */
+    [[nodiscard]] static std::shared_ptr<void> beginStreaming();
+
 private:
     struct Impl;
     std::unique_ptr<Impl> impl_;
@@ -115,14 +115,12 @@ void DataSourceServer::setup(httplib::Server& server)
 
             // Serialize TileLayer using TileLayerStream.
             if (responseType == "binary") {
-                std::stringstream content;
+                std::string content;
                 TileLayerStream::StringPoolOffsetMap stringPoolOffsets{
                     {impl_->info_.nodeId_, stringPoolOffsetParam}};
-                TileLayerStream::Writer layerWriter{
-                    [&](auto&& msg, auto&& msgType) { content << msg; },
-                    stringPoolOffsets};
+                TileLayerStream::Writer layerWriter{content, stringPoolOffsets};
                 layerWriter.write(tileLayer);
-                res.set_content(content.str(), "application/binary");
+                res.set_content(std::move(content), "application/binary");
             }
             else {
                 res.set_content(nlohmann::to_string(tileLayer->toJson()), "application/json");
@@ -1,5 +1,6 @@
 #include "mapget/detail/http-server.h"
 #include "mapget/log.h"
+#include "server-thread-pool.h"
 
 #include "httplib.h"
 #include <csignal>
@@ -22,6 +23,10 @@ struct HttpServer::Impl
     bool setupWasCalled_ = false;
     bool printPortToStdout_ = false;
 
+    size_t threads_ = CPPHTTPLIB_THREAD_POOL_COUNT;
+    size_t maxStreamingThreads_ = DefaultMaxStreamingThreads;
+    size_t maxQueuedConnections_ = 0;
+
     static void handleSignal(int)
     {
         // Temporarily holds the current active HttpServer
@@ -55,6 +60,10 @@ void HttpServer::go(
         impl_->setupWasCalled_ = true;
     }
 
+    impl_->server_.new_task_queue = [this] {
+        return new ServerThreadPool(impl_->threads_, impl_->maxStreamingThreads_, impl_->maxQueuedConnections_);
+    };
+
     if (impl_->server_.is_running() || impl_->serverThread_.joinable())
         raise("HttpServer is already running");
 
@@ -113,6 +122,33 @@ void HttpServer::waitForSignal() {
     activeHttpServer = nullptr;
 }
 
+void HttpServer::setThreadPool(size_t threads, size_t maxStreamingThreads, size_t maxQueuedConnections)
+{
+    if (isRunning())
+        raise("The thread pool must be configured before the HttpServer is started.");
+    impl_->threads_ = threads ? threads : CPPHTTPLIB_THREAD_POOL_COUNT;
+    impl_->maxStreamingThreads_ = maxStreamingThreads;
+    impl_->maxQueuedConnections_ = maxQueuedConnections;
+}
+
+void HttpServer::setConnectionLimits(
+    size_t keepAliveMaxCount,
+    std::chrono::seconds keepAliveTimeout,
+    std::chrono::seconds readWriteTimeout)
+{
+    if (isRunning())
+        raise("Connection limits must be configured before the HttpServer is started.");
+    impl_->server_.set_keep_alive_max_count(keepAliveMaxCount);
+    impl_->server_.set_keep_alive_timeout(keepAliveTimeout.count());
+    impl_->server_.set_read_timeout(readWriteTimeout);
+    impl_->server_.set_write_timeout(readWriteTimeout);
+}
+
+std::shared_ptr<void> HttpServer::beginStreaming()
+{
+    return ServerThreadPool::beginStreaming();
+}
+
 bool HttpServer::mountFileSystem(const std::string& pathFromTo)
 {
     using namespace std::ranges;
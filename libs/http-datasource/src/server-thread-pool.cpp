@@ -0,0 +1,148 @@
+#include "server-thread-pool.h"
+#include "mapget/log.h"
+
+#include <algorithm>
+
+namespace mapget
+{
+
+namespace
+{
+
+// Pool of the calling thread, if it is one of the pool's workers.
+thread_local ServerThreadPool* currentPool = nullptr;
+
+}  // namespace
+
+ServerThreadPool::ServerThreadPool(size_t threads, size_t maxStreamingThreads, size_t maxQueuedConnections)
+    : threads_(std::max<size_t>(threads, 1)),
+      maxStreamingThreads_(maxStreamingThreads),
+      maxQueuedConnections_(maxQueuedConnections),
+      threadsMetric_(Metrics::get().gauge(
+          "mapget_http_server_threads",
+          "Threads which serve HTTP connections.")),
+      busyThreadsMetric_(Metrics::get().gauge(
+          "mapget_http_server_busy_threads",
+          "Threads which currently serve an HTTP connection.")),
+      streamingThreadsMetric_(Metrics::get().gauge(
+          "mapget_http_server_streaming_threads",
+          "Threads which currently serve a streaming response, e.g. for /tiles.")),
+      queuedConnectionsMetric_(Metrics::get().gauge(
+          "mapget_http_server_queued_connections",
+          "HTTP connections which wait for a free thread.")),
+      rejectedConnectionsMetric_(Metrics::get().counter(
+          "mapget_http_server_rejected_connections_total",
+          "HTTP connections which were closed because too many connections were queued."))
+{
+    std::unique_lock lock(mutex_);
+    for (size_t i = 0; i < threads_; ++i)
+        startThread();
+}
+
+ServerThreadPool::~ServerThreadPool()
+{
+    shutdown();
+}
+
+bool ServerThreadPool::enqueue(std::function<void()> fn)
+{
+    {
+        std::unique_lock lock(mutex_);
+        if (shutdown_)
+            return false;
+        if (maxQueuedConnections_ && jobs_.size() >= maxQueuedConnections_) {
+            rejectedConnectionsMetric_.add();
+            return false;
+        }
+        jobs_.push_back(std::move(fn));
+        queuedConnectionsMetric_.add(1);
+    }
+    jobsAvailable_.notify_one();
+    return true;
+}
+
+void ServerThreadPool::shutdown()
+{
+    std::vector<std::thread> workers;
+    {
+        std::unique_lock lock(mutex_);
+        if (shutdown_)
+            return;
+        shutdown_ = true;
+        workers.swap(workers_);
+    }
+    jobsAvailable_.notify_all();
+    for (auto& worker : workers)
+        worker.join();
+    threadsMetric_.sub(static_cast<int64_t>(workers.size()));
+}
+
+std::shared_ptr<void> ServerThreadPool::beginStreaming()
+{
+    auto pool = currentPool;
+    if (!pool)
+        return nullptr;
+
+    {
+        std::unique_lock lock(pool->mutex_);
+        ++pool->streaming_;
+        pool->streamingThreadsMetric_.add(1);
+        // Keep threads_ threads available for other connections,
+        // as long as there are streaming threads to spare.
+        if (!pool->shutdown_ && pool->workers_.size() - pool->streaming_ < pool->threads_ &&
+            pool->workers_.size() < pool->threads_ + pool->maxStreamingThreads_) {
+            log().debug("Starting HTTP server thread #{} for streaming responses.", pool->workers_.size() + 1);
+            pool->startThread();
+        }
+    }
+
+    // The handle is released before the connection's task ends,
+    // and therefore before the pool is shut down.
+    return {pool, [](ServerThreadPool* pool) { pool->endStreaming(); }};
+}
+
+void ServerThreadPool::endStreaming()
+{
+    std::unique_lock lock(mutex_);
+    --streaming_;
+    streamingThreadsMetric_.sub(1);
+}
+
+void ServerThreadPool::startThread()
+{
+    // Must be called with the mutex held. Threads which were started
+    // for streaming responses are kept, and serve other connections
+    // while there are fewer streaming responses.
+    workers_.emplace_back([this] { work(); });
+    threadsMetric_.add(1);
+}
+
+void ServerThreadPool::work()
+{
+    currentPool = this;
+    while (true) {
+        std::function<void()> job;
+        {
+            std::unique_lock lock(mutex_);
+            jobsAvailable_.wait(lock, [this] { return shutdown_ || !jobs_.empty(); });
+            // Like httplib's ThreadPool, queued connections are still served on shutdown.
+            if (jobs_.empty())
+                break;
+            job = std::move(jobs_.front());
+            jobs_.pop_front();
+            queuedConnectionsMetric_.sub(1);
+        }
+
+        busyThreadsMetric_.add(1);
+        try {
+            job();
+        }
+        catch (std::exception const& e) {
+            log().error("Uncaught exception in HTTP server thread: {}", e.what());
+        }
+        busyThreadsMetric_.sub(1);
+    }
+    currentPool = nullptr;
+}
+
+}  // namespace mapget
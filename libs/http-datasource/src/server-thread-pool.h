@@ -0,0 +1,65 @@
+#pragma once
+
+#include "httplib.h"
+#include "mapget/service/metrics.h"
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace mapget
+{
+
+/**
+ * Task queue for the connections of an httplib::Server. Like httplib's
+ * ThreadPool, it runs each connection on one of a fixed number of threads,
+ * and may bound the number of connections which wait for a thread.
+ *
+ * Additionally, a thread which serves a long streaming response, e.g. for
+ * /tiles, can be marked via beginStreaming(). For each marked thread, a
+ * replacement thread is started, up to maxStreamingThreads, so streaming
+ * responses cannot exhaust the threads for short requests like /sources.
+ */
+class ServerThreadPool final : public httplib::TaskQueue
+{
+public:
+    ServerThreadPool(size_t threads, size_t maxStreamingThreads, size_t maxQueuedConnections);
+    ~ServerThreadPool() override;
+
+    bool enqueue(std::function<void()> fn) override;
+    void shutdown() override;
+
+    /**
+     * Mark the calling thread as busy with a streaming response until
+     * the returned handle is destroyed. Returns null if the calling
+     * thread does not belong to a ServerThreadPool.
+     */
+    [[nodiscard]] static std::shared_ptr<void> beginStreaming();
+
+private:
+    void work();
+    void startThread();
+    void endStreaming();
+
+    size_t const threads_;
+    size_t const maxStreamingThreads_;
+    size_t const maxQueuedConnections_;
+
+    std::mutex mutex_;
+    std::condition_variable jobsAvailable_;
+    std::deque<std::function<void()>> jobs_;
+    std::vector<std::thread> workers_;
+    size_t streaming_ = 0;
+    bool shutdown_ = false;
+
+    Metrics::Gauge& threadsMetric_;
+    Metrics::Gauge& busyThreadsMetric_;
+    Metrics::Gauge& streamingThreadsMetric_;
+    Metrics::Gauge& queuedConnectionsMetric_;
+    Metrics::Counter& rejectedConnectionsMetric_;
+};
+
+}  // namespace mapget
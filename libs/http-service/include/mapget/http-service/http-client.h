@@ -9,6 +9,8 @@ namespace mapget {
 
 /**
  * Client class, which implements asynchronous fetching from a mapget HTTP service.
+ * Connections are kept alive and reused. Each /tiles call runs in the background
+ * on its own connection, and the tile stream is parsed while it arrives.
  */
 class HttpClient
 {
@@ -16,8 +18,18 @@ public:
     /**
      * Connect to a running mapget HTTP service. Immediately calls the /sources
      * endpoint, and caches the result for the lifetime of this object.
+     * If compressMessages is set, the service is asked to send
+     * zstd-compressed tile stream messages. If decodingThreads is
+     * non-zero, received tiles are deserialized in parallel on that
+     * many threads. The request callbacks are then invoked from these
+     * threads, but still one at a time and in stream order.
      */
-    explicit HttpClient(std::string const& host, uint16_t port, httplib::Headers headers = {});
+    explicit HttpClient(
+        std::string const& host,
+        uint16_t port,
+        httplib::Headers headers = {},
+        bool compressMessages = false,
+        uint32_t decodingThreads = 0);
     ~HttpClient();
 
     /**
@@ -27,10 +39,22 @@ public:
 
     /**
      * Post a Request for a number of tiles from a particular map layer.
+     * Returns immediately. Results are passed to the request as soon as they
+     * are received, from a background thread. Use request->wait() to wait
+     * for the request to be done.
      */
     LayerTilesRequest::Ptr request(LayerTilesRequest::Ptr const& request);
 
+    /**
+     * Post several Requests with a single /tiles call. To fetch requests over
+     * parallel connections instead, call request() for each of them.
+     */
+    void request(std::vector<LayerTilesRequest::Ptr> const& requests);
+
 private:
+    // Run a /tiles call and distribute the received tiles to the requests.
+    void fetchTiles(std::vector<LayerTilesRequest::Ptr> const& requests);
+
     struct Impl;
     std::unique_ptr<Impl> impl_;
 };
@@ -14,9 +14,60 @@ namespace mapget {
 class HttpService : public HttpServer, public Service
 {
 public:
+    /** Default for setMaxResponseBuffer(). */
+    static constexpr size_t DefaultMaxResponseBufferBytes = 16 * 1024 * 1024;
+
     explicit HttpService(Cache::Ptr cache = std::make_shared<MemCache>(), bool watchConfig = false);
     ~HttpService() override;
 
+    /**
+     * Set the compression level for /tiles responses. Responses are compressed
+     * if the client sends a matching Accept-Encoding header (zstd, or gzip
+     * if built with zlib). The level is clamped to the range of the negotiated
+     * encoding. Zero (the default) selects the encoding's default level.
+     */
+    void setResponseCompressionLevel(int level);
+
+    /**
+     * Set the fraction of /tiles requests in [0, 1] which are traced.
+     * Clients may also request a trace by passing `"trace": true`.
+     * The most recent traces are served by GET /traces in Chrome's
+     * trace event format. Zero (the default) disables sampling.
+     */
+    void setTraceSampleRate(double rate);
+
+    /**
+     * Limit the open tile requests (/tiles, /search, GET /tile and viewport
+     * subscriptions) and their tiles per client. Clients are identified by
+     * their Authorization header, otherwise by their address. Requests beyond
+     * the limits are answered with 429 Too Many Requests and a Retry-After
+     * header. A request which replaces the client's previous request with the
+     * same clientId is admitted in its place.
+     * Zero (the default) means unlimited.
+     */
+    void setClientLimits(size_t maxRequests, size_t maxTiles);
+
+    /**
+     * Set a request header which carries the address of the client, e.g.
+     * X-Forwarded-For or X-Real-IP, for a service behind a reverse proxy.
+     * Without it, all anonymous clients of the proxy share its address, and
+     * thus its limits and fair share. The last address of the header is used,
+     * which is the one the proxy appended. Only set it if every request passes
+     * a proxy which sets the header, as clients could pick their address otherwise.
+     * Empty (the default) uses the address of the connection.
+     */
+    void setClientAddressHeader(std::string header);
+
+    /**
+     * Set the number of bytes which a /tiles response may buffer for a client
+     * which reads slower than the tiles are produced. Once the buffer is full,
+     * the response's remaining tiles are paused in the service until the client
+     * has caught up, so memory per response stays bounded. Tiles which are
+     * already in progress are still added, so the bound is soft. A viewport
+     * subscription is closed instead once its buffer is full. Zero means unlimited.
+     */
+    void setMaxResponseBuffer(size_t bytes);
+
 protected:
     void setup(httplib::Server& server) override;
 
@@ -10,6 +10,8 @@
 #include "mapget/service/config.h"
 
 #include <CLI/CLI.hpp>
+#include <mutex>
+#include <optional>
 #include <string>
 #include <vector>
 #include <yaml-cpp/yaml.h>
@@ -175,6 +177,18 @@ struct ServeCommand
     int64_t cacheMaxTiles_ = 1024;
     bool clearCache_ = false;
     std::string webapp_;
+    int compressionLevel_ = 0;
+    double traceSampleRate_ = 0.;
+    size_t maxClientRequests_ = 0;
+    size_t maxClientTiles_ = 0;
+    std::string clientAddressHeader_;
+    size_t responseBufferMb_ = HttpService::DefaultMaxResponseBufferBytes / (1024 * 1024);
+    size_t httpThreads_ = 0;
+    size_t httpStreamingThreads_ = HttpServer::DefaultMaxStreamingThreads;
+    size_t httpMaxQueuedConnections_ = 0;
+    size_t keepAliveMaxCount_ = 5;
+    int64_t keepAliveTimeout_ = 5;
+    int64_t httpTimeout_ = 5;
     CLI::App& app_;
 
     explicit ServeCommand(CLI::App& app) : app_(app)
@@ -216,6 +230,70 @@ struct ServeCommand
             "-w,--webapp",
             webapp_,
             "Serve a static web application, in the format [<url-scope>:]<filesystem-path>.");
+        serveCmd->add_option(
+            "--compression-level",
+            compressionLevel_,
+            "Compression level for /tiles responses to clients which send a matching "
+            "Accept-Encoding header. 0 for the encoding's default level.")
+            ->default_val(0);
+        serveCmd->add_option(
+            "--max-client-requests",
+            maxClientRequests_,
+            "Maximum number of open tile requests per client. 0 for unlimited.")
+            ->default_val(0);
+        serveCmd->add_option(
+            "--max-client-tiles",
+            maxClientTiles_,
+            "Maximum number of tiles in open tile requests per client. 0 for unlimited.")
+            ->default_val(0);
+        serveCmd->add_option(
+            "--client-address-header",
+            clientAddressHeader_,
+            "Header which a trusted reverse proxy sets to the client's address, e.g. X-Forwarded-For. "
+            "Anonymous clients are then told apart by it instead of the proxy's address.");
+        serveCmd->add_option(
+            "--response-buffer-mb",
+            responseBufferMb_,
+            "Megabytes which a /tiles response may buffer for a slow client, before its "
+            "remaining tiles are paused. 0 for unlimited.")
+            ->default_val(responseBufferMb_);
+        serveCmd->add_option(
+            "--http-threads",
+            httpThreads_,
+            "Number of threads which serve HTTP connections. 0 for a default based on the CPU cores.")
+            ->default_val(0);
+        serveCmd->add_option(
+            "--http-streaming-threads",
+            httpStreamingThreads_,
+            "Number of additional threads which are started while connections stream /tiles, "
+            "/search or /subscribe responses, so these cannot block other requests.")
+            ->default_val(httpStreamingThreads_);
+        serveCmd->add_option(
+            "--http-max-queued-connections",
+            httpMaxQueuedConnections_,
+            "Number of connections which may wait for a free thread. 0 for unlimited.")
+            ->default_val(0);
+        serveCmd->add_option(
+            "--keep-alive-max-count",
+            keepAliveMaxCount_,
+            "Number of requests which a client may send over one kept-alive connection.")
+            ->default_val(keepAliveMaxCount_);
+        serveCmd->add_option(
+            "--keep-alive-timeout",
+            keepAliveTimeout_,
+            "Seconds that an idle kept-alive connection stays open.")
+            ->default_val(keepAliveTimeout_);
+        serveCmd->add_option(
+            "--http-timeout",
+            httpTimeout_,
+            "Seconds to wait for reading a request or writing a response chunk.")
+            ->default_val(httpTimeout_);
+        serveCmd->add_option(
+            "--trace-sample-rate",
+            traceSampleRate_,
+            "Fraction of /tiles requests in [0, 1] for which a trace is recorded. "
+            "The most recent traces are served by GET /traces.")
+            ->default_val(0.);
         serveCmd->add_flag(
             "--allow-post-config",
             isPostConfigEndpointEnabled_,
@@ -260,6 +338,16 @@ struct ServeCommand
 
         // HttpService will subscribe to DataSourceConfigService.
         HttpService srv(cache, watchConfig);
+        srv.setResponseCompressionLevel(compressionLevel_);
+        srv.setTraceSampleRate(traceSampleRate_);
+        srv.setClientLimits(maxClientRequests_, maxClientTiles_);
+        srv.setClientAddressHeader(clientAddressHeader_);
+        srv.setMaxResponseBuffer(responseBufferMb_ * 1024 * 1024);
+        srv.setThreadPool(httpThreads_, httpStreamingThreads_, httpMaxQueuedConnections_);
+        srv.setConnectionLimits(
+            keepAliveMaxCount_,
+            std::chrono::seconds(keepAliveTimeout_),
+            std::chrono::seconds(httpTimeout_));
 
         if (config)
         {
@@ -352,18 +440,27 @@ struct FetchCommand
             map_,
             layer_,
             std::vector<TileId>{tiles_.begin(), tiles_.end()});
-        auto fn = [this](auto const& tile)
+        // Tiles may be decoded on several of the client's threads, so the
+        // first tile error is kept and raised once the request is done.
+        std::mutex tileErrorMutex;
+        std::optional<std::string> tileError;
+        auto fn = [this, &tileErrorMutex, &tileError](auto const& tile)
         {
-            if (!mute_)
-                std::cout << tile->toJson().dump() << std::endl;
-            if (tile->error())
-                raise(fmt::format("Tile {}: {}",
-                                  tile->id().toString(), *tile->error()));
+            std::unique_lock lock(tileErrorMutex);
+            if (!mute_) {
+                std::string json;
+                tile->writeJson(json);
+                std::cout << json << std::endl;
+            }
+            if (tile->error() && !tileError)
+                tileError = fmt::format("Tile {}: {}", tile->id().toString(), *tile->error());
         };
         request->onFeatureLayer(fn);
         request->onSourceDataLayer(fn);
         cli.request(request)->wait();
 
+        if (tileError)
+            raise(*tileError);
         if (request->getStatus() == RequestStatus::NoDataSource)
             raise("Failed to fetch sources: no matching data source.");
         if (request->getStatus() == RequestStatus::Aborted)
@@ -2,29 +2,50 @@
 #include "httplib.h"
 #include "mapget/log.h"
 
+#include <algorithm>
+#include <future>
+#include <mutex>
+
 namespace mapget
 {
 
 struct HttpClient::Impl {
-    httplib::Client client_;
+    std::string host_;
+    uint16_t port_;
     std::unordered_map<std::string, DataSourceInfo> sources_;
     std::shared_ptr<TileLayerStream::StringPoolCache> stringPoolProvider_;
     httplib::Headers headers_;
+    bool compressMessages_ = false;
+    uint32_t decodingThreads_ = 0;
+
+    // Idle kept-alive connections. A connection is taken from here for
+    // each /tiles call, so parallel calls use parallel connections.
+    static constexpr size_t maxIdleConnections = 8;
+    std::mutex connectionsMutex_;
+    std::vector<std::unique_ptr<httplib::Client>> idleConnections_;
+
+    // Running /tiles calls. Destroying the futures waits for the calls.
+    std::mutex pendingCallsMutex_;
+    std::vector<std::future<void>> pendingCalls_;
 
-    Impl(std::string const& host, uint16_t port, httplib::Headers headers) :
-        client_(host, port),
-        headers_(std::move(headers))
+    Impl(std::string const& host, uint16_t port, httplib::Headers headers, bool compressMessages, uint32_t decodingThreads) :
+        host_(host),
+        port_(port),
+        headers_(std::move(headers)),
+        compressMessages_(compressMessages),
+        decodingThreads_(decodingThreads)
     {
         stringPoolProvider_ = std::make_shared<TileLayerStream::StringPoolCache>();
-        client_.set_keep_alive(false);
-        auto sourcesJson = client_.Get("/sources", headers_);
+        auto connection = acquireConnection();
+        auto sourcesJson = connection->Get("/sources", headers_);
         if (!sourcesJson || sourcesJson->status != 200)
             raise(
-                fmt::format("Failed to fetch sources: [{}]", sourcesJson->status));
+                fmt::format("Failed to fetch sources: [{}]", sourcesJson ? sourcesJson->status : -1));
         for (auto const& info : nlohmann::json::parse(sourcesJson->body)) {
             auto parsedInfo = DataSourceInfo::fromJson(info);
             sources_.emplace(parsedInfo.mapId_, parsedInfo);
         }
+        releaseConnection(std::move(connection));
     }
 
     [[nodiscard]] std::shared_ptr<LayerInfo>
@@ -35,12 +56,50 @@ struct HttpClient::Impl {
             raise("Could not find map data source info");
         return mapIt->second.getLayer(std::string(layer));
     }
+
+    std::unique_ptr<httplib::Client> acquireConnection()
+    {
+        {
+            std::unique_lock lock(connectionsMutex_);
+            if (!idleConnections_.empty()) {
+                auto connection = std::move(idleConnections_.back());
+                idleConnections_.pop_back();
+                return connection;
+            }
+        }
+        auto connection = std::make_unique<httplib::Client>(host_, port_);
+        connection->set_keep_alive(true);
+        return connection;
+    }
+
+    void releaseConnection(std::unique_ptr<httplib::Client> connection)
+    {
+        std::unique_lock lock(connectionsMutex_);
+        if (idleConnections_.size() < maxIdleConnections)
+            idleConnections_.push_back(std::move(connection));
+    }
+
+    /** Run a callable in the background, and forget about finished calls. */
+    template <class Fun>
+    void runInBackground(Fun&& fun)
+    {
+        std::unique_lock lock(pendingCallsMutex_);
+        std::erase_if(pendingCalls_, [](auto const& call) {
+            return call.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+        });
+        pendingCalls_.push_back(std::async(std::launch::async, std::forward<Fun>(fun)));
+    }
 };
 
-HttpClient::HttpClient(const std::string& host, uint16_t port, httplib::Headers headers) : impl_(
-    std::make_unique<Impl>(host, port, std::move(headers))) {}
+HttpClient::HttpClient(const std::string& host, uint16_t port, httplib::Headers headers, bool compressMessages, uint32_t decodingThreads) : impl_(
+    std::make_unique<Impl>(host, port, std::move(headers), compressMessages, decodingThreads)) {}
 
-HttpClient::~HttpClient() = default;
+HttpClient::~HttpClient()
+{
+    // Wait for running /tiles calls, which still use the connection pool.
+    std::unique_lock lock(impl_->pendingCallsMutex_);
+    impl_->pendingCalls_.clear();
+}
 
 std::vector<DataSourceInfo> HttpClient::sources() const
 {
@@ -51,48 +110,161 @@ std::vector<DataSourceInfo> HttpClient::sources() const
 }
 
 LayerTilesRequest::Ptr HttpClient::request(const LayerTilesRequest::Ptr& request)
+{
+    this->request(std::vector{request});
+    return request;
+}
+
+void HttpClient::request(std::vector<LayerTilesRequest::Ptr> const& requests)
 {
     // Finalize requests that did not contain any tiles.
-    if (request->isDone()) {
-        request->notifyStatus();
-        return request;
+    std::vector<LayerTilesRequest::Ptr> openRequests;
+    for (auto const& request : requests) {
+        if (request->isDone())
+            request->notifyStatus();
+        else
+            openRequests.push_back(request);
     }
+    if (openRequests.empty())
+        return;
+
+    impl_->runInBackground([this, requests = std::move(openRequests)] { fetchTiles(requests); });
+}
+
+void HttpClient::fetchTiles(std::vector<LayerTilesRequest::Ptr> const& requests)
+{
+    // Results are passed to the first open request for their map layer
+    // which contains their tile id.
+    auto dispatchResult = [&requests](TileLayer::Ptr const& result)
+    {
+        for (auto const& request : requests) {
+            if (request->isDone() || request->mapId_ != result->mapId() ||
+                request->layerId_ != result->layerInfo()->layerId_)
+                continue;
+            if (std::find(request->tiles_.begin(), request->tiles_.end(), result->tileId()) != request->tiles_.end()) {
+                request->notifyResult(result);
+                return;
+            }
+        }
+        log().warn("Received unexpected tile {}", MapTileKey(*result).toString());
+    };
 
     auto reader = std::make_unique<TileLayerStream::Reader>(
         [this](auto&& mapId, auto&& layerId){return impl_->resolve(mapId, layerId);},
-        [request](auto&& result) { request->notifyResult(result); },
+        dispatchResult,
         impl_->stringPoolProvider_);
+    if (impl_->decodingThreads_ > 0)
+        reader->enableParallelDecoding(impl_->decodingThreads_);
 
     using namespace nlohmann;
 
-    // TODO: Currently, cpp-httplib client-POST does not support async responses.
-    //  Those are only supported by GET. So, currently, this HttpClient
-    //  does not profit from the streaming response. However, erdblick is
-    //  is fully able to process async responses as it uses the browser fetch()-API.
-    auto tileResponse = impl_->client_.Post(
-        "/tiles",
-        impl_->headers_,
-        json::object({
-            {"requests", json::array({request->toJson()})},
-            {"stringPoolOffsets", reader->stringPoolCache()->stringPoolOffsets()}
-        }).dump(),
-        "application/json");
-
-    if (tileResponse) {
-        if (tileResponse->status == 200) {
-            reader->read(tileResponse->body);
+    auto requestsJson = json::array();
+    for (auto const& request : requests)
+        requestsJson.push_back(request->toJson());
+    auto requestJson = json::object({
+        {"requests", requestsJson},
+        {"stringPoolOffsets", reader->stringPoolCache()->stringPoolOffsets()}
+    });
+    if (impl_->compressMessages_)
+        requestJson["messageCompression"] = "zstd";
+
+    // Parse the tile stream incrementally, so that each tile is passed
+    // to its request as soon as it has arrived. Error responses are
+    // collected to read the request statuses from them.
+    httplib::Request tilesRequest;
+    tilesRequest.method = "POST";
+    tilesRequest.path = "/tiles";
+    tilesRequest.headers = impl_->headers_;
+    tilesRequest.set_header("Accept", "application/binary");
+    tilesRequest.set_header("Content-Type", "application/json");
+    tilesRequest.body = requestJson.dump();
+
+    int status = 0;
+    std::string errorBody;
+    std::optional<std::string> readError;
+    tilesRequest.response_handler = [&status](httplib::Response const& response)
+    {
+        status = response.status;
+        return true;
+    };
+    tilesRequest.content_receiver = [&](const char* data, size_t size, uint64_t, uint64_t)
+    {
+        if (status != 200) {
+            errorBody.append(data, size);
+            return true;
         }
-        else if (tileResponse->status == 400) {
-            request->setStatus(RequestStatus::NoDataSource);
+        try {
+            reader->read(std::string_view(data, size));
         }
-        else if (tileResponse->status == 403) {
-            request->setStatus(RequestStatus::Unauthorized);
+        catch (std::exception const& e) {
+            readError = e.what();
+            return false;
         }
-        // TODO if multiple LayerTileRequests are ever sent by this client,
-        //  additionally handle RequestStatus::Aborted.
+        return true;
+    };
+
+    auto connection = impl_->acquireConnection();
+    httplib::Response tilesResponse;
+    httplib::Error error = httplib::Error::Success;
+    auto sent = connection->send(tilesRequest, tilesResponse, error);
+    if (sent)
+        impl_->releaseConnection(std::move(connection));
+
+    // Layers which are decoded in parallel may still fail, e.g.
+    // in a result callback. Their error is reported like a read error.
+    try {
+        reader->waitForPendingLayers();
+    }
+    catch (std::exception const& e) {
+        if (!readError)
+            readError = e.what();
     }
 
-    return request;
+    auto finish = [&requests](RequestStatus status)
+    {
+        for (auto const& request : requests) {
+            if (!request->isDone())
+                request->setStatus(status);
+        }
+    };
+
+    if (readError) {
+        log().error("Failed to read tile stream: {}", *readError);
+        finish(RequestStatus::Aborted);
+    }
+    else if (!sent) {
+        log().error("Tiles request failed: {}", httplib::to_string(error));
+        finish(RequestStatus::Aborted);
+    }
+    else if (status == 200) {
+        // The stream is complete, so tiles which were not
+        // sent (e.g., due to errors) will not arrive anymore.
+        finish(RequestStatus::Success);
+    }
+    else if (status == 400 || status == 403) {
+        // The response lists the status of each request. Requests which are
+        // not listed, or listed as open, get the status of the whole response.
+        // Each request's final status is set once.
+        auto responseStatus = status == 403 ? RequestStatus::Unauthorized : RequestStatus::NoDataSource;
+        auto errorJson = json::parse(errorBody, nullptr, false);
+        auto statuses = json::array();
+        if (!errorJson.is_discarded() && errorJson.contains("requestStatuses"))
+            statuses = errorJson["requestStatuses"];
+        for (size_t i = 0; i < requests.size(); ++i) {
+            auto requestStatus = responseStatus;
+            if (i < statuses.size()) {
+                auto listedStatus = static_cast<RequestStatus>(statuses[i].get<std::underlying_type_t<RequestStatus>>());
+                if (listedStatus != RequestStatus::Open)
+                    requestStatus = listedStatus;
+            }
+            if (!requests[i]->isDone())
+                requests[i]->setStatus(requestStatus);
+        }
+    }
+    else {
+        log().error("Tiles request failed with status {}", status);
+        finish(RequestStatus::Aborted);
+    }
 }
 
 }
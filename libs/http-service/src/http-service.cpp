@@ -1,12 +1,27 @@
 #include "http-service.h"
+#include "message-queue.h"
+#include "response-compression.h"
 #include "mapget/log.h"
 #include "mapget/service/config.h"
-
+#include "mapget/model/simfil-geometry.h"
+#include "mapget/service/metrics.h"
+#include "mapget/trace.h"
+
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <chrono>
 #include <condition_variable>
+#include <deque>
 #include <filesystem>
 #include <fstream>
+#include <functional>
 #include <mutex>
+#include <optional>
+#include <random>
+#include <set>
 #include <sstream>
+#include <thread>
 #include <vector>
 #include "cli.h"
 #include "httplib.h"
@@ -144,6 +159,101 @@ YAML::Node jsonToYaml(const nlohmann::json& json, std::unordered_map<std::string
 
     return node;
 }
+
+/**
+ * Keeps the feature digests of recently sent tile versions, keyed by their
+ * content hash. This allows sending a feature-level delta to a client which
+ * still holds one of these versions. The total number of digest entries is
+ * bounded; the oldest tile versions are evicted first.
+ */
+class FeatureDigestCache
+{
+public:
+    using DigestPtr = std::shared_ptr<const TileFeatureLayer::FeatureDigest>;
+
+    static constexpr size_t maxDigestEntries = 1 << 22;
+
+    DigestPtr get(uint64_t contentHash)
+    {
+        std::lock_guard lock(mutex_);
+        auto it = digests_.find(contentHash);
+        if (it == digests_.end())
+            return nullptr;
+        return it->second;
+    }
+
+    void put(uint64_t contentHash, DigestPtr const& digest)
+    {
+        std::lock_guard lock(mutex_);
+        if (!digests_.emplace(contentHash, digest).second)
+            return;
+        insertionOrder_.push_back(contentHash);
+        numEntries_ += digest->size();
+        while (numEntries_ > maxDigestEntries && insertionOrder_.size() > 1) {
+            auto oldest = digests_.find(insertionOrder_.front());
+            numEntries_ -= oldest->second->size();
+            digests_.erase(oldest);
+            insertionOrder_.pop_front();
+        }
+    }
+
+private:
+    std::mutex mutex_;
+    std::unordered_map<uint64_t, DigestPtr> digests_;
+    std::deque<uint64_t> insertionOrder_;
+    size_t numEntries_ = 0;
+};
+
+/**
+ * Keeps the content hashes of recently served tile versions, keyed by the
+ * tile, its data source node and its timestamp, so that revalidations of
+ * an unchanged tile via GET /tile do not hash its features again. The
+ * number of entries is bounded; the oldest tile versions are evicted first.
+ */
+class ContentHashCache
+{
+public:
+    static constexpr size_t maxEntries = 1 << 16;
+
+    uint64_t get(TileFeatureLayer const& layer)
+    {
+        auto key = fmt::format(
+            "{}:{}@{}",
+            MapTileKey(layer).toString(),
+            layer.nodeId(),
+            std::chrono::duration_cast<std::chrono::microseconds>(layer.timestamp().time_since_epoch()).count());
+        {
+            std::lock_guard lock(mutex_);
+            auto it = hashes_.find(key);
+            if (it != hashes_.end())
+                return it->second;
+        }
+
+        auto contentHash = layer.contentHash();
+        std::lock_guard lock(mutex_);
+        if (hashes_.emplace(key, contentHash).second) {
+            insertionOrder_.push_back(std::move(key));
+            if (insertionOrder_.size() > maxEntries) {
+                hashes_.erase(insertionOrder_.front());
+                insertionOrder_.pop_front();
+            }
+        }
+        return contentHash;
+    }
+
+private:
+    std::mutex mutex_;
+    std::unordered_map<std::string, uint64_t> hashes_;
+    std::deque<std::string> insertionOrder_;
+};
+
+/** Append the lowest numBytes bytes of value to out, in little endian order. */
+void appendLittleEndian(std::string& out, uint64_t value, size_t numBytes)
+{
+    for (size_t i = 0; i < numBytes; ++i)
+        out += static_cast<char>((value >> (8 * i)) & 0xff);
+}
+
 }  // namespace
 
 struct HttpService::Impl
@@ -152,81 +262,942 @@ struct HttpService::Impl
 
     explicit Impl(HttpService& self) : self_(self) {}
 
-    // Use a shared buffer for the responses and a mutex for thread safety.
+    // Digests of sent tile versions, shared by all tile requests.
+    std::shared_ptr<FeatureDigestCache> featureDigests_ = std::make_shared<FeatureDigestCache>();
+
+    // Content hashes of tiles served by GET /tile, for their ETags.
+    std::shared_ptr<ContentHashCache> contentHashes_ = std::make_shared<ContentHashCache>();
+
+    // Level for compressed /tiles responses, zero means codec default.
+    int responseCompressionLevel_ = 0;
+
+    // Totals of /tiles response bytes before and after compression.
+    mutable std::atomic_uint64_t responseBytesUncompressed_{0};
+    mutable std::atomic_uint64_t responseBytesSent_{0};
+
+    // Process-wide counterparts of the above for the /metrics endpoint,
+    // which are updated with every streamed chunk.
+    Metrics::Counter& streamedBytesUncompressed_ = Metrics::get().counter(
+        "mapget_http_response_uncompressed_bytes_total",
+        "Bytes of /tiles responses before compression.");
+    Metrics::Counter& streamedBytesSent_ = Metrics::get().counter(
+        "mapget_http_response_bytes_total",
+        "Bytes of /tiles responses which were sent to clients.");
+
+    // Fraction of /tiles requests which are traced.
+    std::atomic<double> traceSampleRate_{0.};
+
+    // Most recent traces, which are served by GET /traces.
+    static constexpr size_t maxRetainedTraces = 32;
+    mutable std::mutex traceMutex_;
+    mutable std::deque<Trace::Ptr> traces_;
+
+    // Bytes which a /tiles response may buffer before its requests are paused, zero means unlimited.
+    std::atomic_size_t maxResponseBufferBytes_{HttpService::DefaultMaxResponseBufferBytes};
+
+    // Per-client limits for open tile requests and their tiles, zero means unlimited.
+    std::atomic_size_t maxRequestsPerClient_{0};
+    std::atomic_size_t maxTilesPerClient_{0};
+
+    // Seconds after which a client may retry a request which exceeded its limits.
+    static constexpr auto retryAfterSeconds = 1;
+
+    /**
+     * Open tile requests and tiles of one client, i.e. of /tiles, /search,
+     * GET /tile and viewport subscriptions. An admission is held by the
+     * request's state, and released when its response ends.
+     */
+    struct ClientUsage
+    {
+        size_t openRequests_ = 0;
+        size_t openTiles_ = 0;
+    };
+
+    struct Admission
+    {
+        Impl const& impl_;
+        std::string identity_;
+        size_t numTiles_;
+        std::atomic_bool released_{false};
+
+        Admission(Impl const& impl, std::string identity, size_t numTiles)
+            : impl_(impl), identity_(std::move(identity)), numTiles_(numTiles) {}
+        ~Admission() { release(); }
+
+        void release()
+        {
+            if (released_.exchange(true))
+                return;
+            std::unique_lock lock(impl_.clientUsageMutex_);
+            auto it = impl_.clientUsage_.find(identity_);
+            if (it == impl_.clientUsage_.end())
+                return;
+            it->second.openRequests_ -= 1;
+            it->second.openTiles_ -= numTiles_;
+            if (!it->second.openRequests_)
+                impl_.clientUsage_.erase(it);
+        }
+    };
+
+    mutable std::mutex clientUsageMutex_;
+    mutable std::unordered_map<std::string, ClientUsage> clientUsage_;
+
+    // Header which a trusted reverse proxy sets to the client's address,
+    // empty to use the connection's address. Set before the server starts.
+    std::string clientAddressHeader_;
+
+    /**
+     * Identity of the client of a request, for admission limits and the
+     * service's fair share: A hash of its Authorization header, otherwise
+     * its address. Unlike the clientId, which the client picks freely, it
+     * cannot be changed to dodge the limits. Behind a reverse proxy, the
+     * address is taken from clientAddressHeader_ (see setClientAddressHeader()).
+     */
+    std::string clientIdentity(httplib::Request const& req) const
+    {
+        if (auto authorization = req.get_header_value("Authorization"); !authorization.empty())
+            return "auth:" + stringToHash(authorization).substr(0, 16);
+        if (!clientAddressHeader_.empty()) {
+            // The proxy appends the address it saw to a comma-separated list.
+            auto forwarded = req.get_header_value(clientAddressHeader_);
+            auto address = std::string_view(forwarded).substr(forwarded.find_last_of(',') + 1);
+            while (!address.empty() && address.front() == ' ')
+                address.remove_prefix(1);
+            while (!address.empty() && address.back() == ' ')
+                address.remove_suffix(1);
+            if (!address.empty())
+                return "addr:" + std::string(address);
+        }
+        return "addr:" + req.remote_addr;
+    }
+
+    /**
+     * Key under which the requests of a clientId are kept, so the next request
+     * with the same clientId supersedes them. It is scoped to the client's
+     * identity, so a clientId only supersedes requests of the same client.
+     */
+    static std::string clientRequestKey(std::string const& identity, std::string const& clientId)
+    {
+        return identity + "/" + clientId;
+    }
+
+    /**
+     * Admit a request with numTiles tiles for the given client, if it stays
+     * within the client's limits. A previous request which the new one
+     * supersedes (i.e. aborts) is not counted. Returns null if the request
+     * must be rejected.
+     */
+    std::shared_ptr<Admission> admit(std::string const& identity, size_t numTiles, std::shared_ptr<Admission> const& superseded) const
+    {
+        auto maxRequests = maxRequestsPerClient_.load();
+        auto maxTiles = maxTilesPerClient_.load();
+
+        std::unique_lock lock(clientUsageMutex_);
+        auto usage = clientUsage_[identity];
+        if (superseded && superseded->identity_ == identity && !superseded->released_) {
+            usage.openRequests_ -= 1;
+            usage.openTiles_ -= superseded->numTiles_;
+        }
+        if ((maxRequests && usage.openRequests_ + 1 > maxRequests) ||
+            (maxTiles && usage.openTiles_ + numTiles > maxTiles)) {
+            if (!clientUsage_[identity].openRequests_)
+                clientUsage_.erase(identity);
+            return nullptr;
+        }
+        auto& admittedUsage = clientUsage_[identity];
+        admittedUsage.openRequests_ += 1;
+        admittedUsage.openTiles_ += numTiles;
+        return std::make_shared<Admission>(*this, identity, numTiles);
+    }
+
+    /**
+     * Admit a request like admit(), or set the response to the client's
+     * error: 400 if the request alone exceeds the tile limit, otherwise
+     * 429 with a Retry-After header. Returns null in the latter cases.
+     */
+    std::shared_ptr<Admission> admitOrReject(
+        httplib::Response& res,
+        std::string const& identity,
+        size_t numTiles,
+        std::shared_ptr<Admission> const& superseded = nullptr) const
+    {
+        if (auto maxTiles = maxTilesPerClient_.load(); maxTiles && numTiles > maxTiles) {
+            res.status = 400;
+            res.set_content(
+                fmt::format("Request for {} tiles exceeds the limit of {} tiles per client.", numTiles, maxTiles),
+                "text/plain");
+            return nullptr;
+        }
+        auto admission = admit(identity, numTiles, superseded);
+        if (!admission) {
+            log().warn("Rejecting request of client {}: Too many open requests.", identity);
+            res.status = 429;  // Too Many Requests.
+            res.set_header("Retry-After", std::to_string(retryAfterSeconds));
+            res.set_content("Too many open tile requests for this client.", "text/plain");
+        }
+        return admission;
+    }
+
+    // Workers hand their serialized tiles to the streaming thread via a
+    // lock-free queue. Only the binary stream's writer is guarded by a mutex,
+    // as its string pool updates must precede the tiles which refer to them.
     struct HttpTilesRequestState
     {
         static constexpr auto binaryMimeType = "application/binary";
         static constexpr auto jsonlMimeType = "application/jsonl";
+        static constexpr auto mvtMimeType = "application/vnd.mapbox-vector-tile";
+        // A /tiles response holds several tiles, so it is not a valid MVT.
+        // Its MVT encodings are framed in a mapget-specific stream instead.
+        // Like the MVTs of GET /tile, they are tiles of mapget's geographic
+        // grid rather than Web Mercator tiles, see TileFeatureLayer::toMvt().
+        static constexpr auto mvtStreamMimeType = "application/vnd.mapget.mvt-stream";
         static constexpr auto anyMimeType = "*/*";
 
-        std::mutex mutex_;
-        std::condition_variable resultEvent_;
-
         uint64_t requestId_;
-        std::stringstream buffer_;
         std::string responseType_;
-        std::unique_ptr<TileLayerStream::Writer> writer_;
         std::vector<LayerTilesRequest::Ptr> requests_;
+
+        // Serialized messages which wait to be streamed, and the number of
+        // requests which are done. The response is complete once all
+        // requests are done and the queue is drained.
+        MessageQueue messages_;
+        std::atomic_size_t doneRequests_{0};
+
+        // Writer of the binary stream, which serializes into writerOutput_.
+        std::mutex writerMutex_;
+        std::string writerOutput_;
+        std::unique_ptr<TileLayerStream::Writer> writer_;
         TileLayerStream::StringPoolOffsetMap stringOffsets_;
 
+        // Content hashes of the tile versions which the client holds,
+        // per (map, layer) and tile id. Only map layers for which the
+        // client passed knownTileHashes are answered with deltas.
+        std::map<std::pair<std::string, std::string>, std::unordered_map<uint64_t, uint64_t>> knownTileHashes_;
+        std::shared_ptr<FeatureDigestCache> featureDigests_;
+
+        // Cache for derived tile representations, i.e. MVT encodings.
+        Cache::Ptr cache_;
+
+        // Compressor for the response body as negotiated via Accept-Encoding,
+        // and byte counts before/after compression. Only used by the
+        // content provider, i.e. by the streaming thread.
+        std::unique_ptr<ResponseCompressor> compressor_;
+        uint64_t bytesUncompressed_ = 0;
+        uint64_t bytesSent_ = 0;
+
+        // Serialization time histogram for the response type.
+        Metrics::Histogram* serializationTime_ = nullptr;
+
+        // Trace of the request, if it is traced.
+        Trace::Ptr trace_;
+
+        // Admission of the request within its client's limits.
+        std::shared_ptr<Admission> admission_;
+
+        // Backpressure: Once maxBufferedBytes_ are waiting to be streamed, the
+        // requests are paused in the service until the client has caught up.
+        // Tiles which are in progress are still added, so the bound is soft.
+        // The pause mutex is only taken while the requests are paused.
+        Service* service_ = nullptr;
+        size_t maxBufferedBytes_ = 0;
+        std::atomic_size_t bufferedBytes_{0};
+        // Highest value of bufferedBytes_, updated whenever a message is queued.
+        std::atomic_size_t peakBufferedBytes_{0};
+        std::mutex pauseMutex_;
+        std::atomic_bool paused_ = false;
+
+        Metrics::Gauge& bufferedBytesMetric_ = Metrics::get().gauge(
+            "mapget_http_response_buffered_bytes",
+            "Bytes of /tiles responses which wait to be streamed to clients.");
+        Metrics::Gauge& pausedRequestsMetric_ = Metrics::get().gauge(
+            "mapget_http_paused_responses",
+            "/tiles responses whose requests are paused because the client does not keep up.");
+        Metrics::Counter& pausesMetric_ = Metrics::get().counter(
+            "mapget_http_response_pauses_total",
+            "Times that /tiles requests were paused because their response buffer was full.");
+
         HttpTilesRequestState()
         {
             static std::atomic_uint64_t nextRequestId;
-            writer_ = std::make_unique<TileLayerStream::Writer>(
-                [&, this](auto&& msg, auto&& msgType) { buffer_ << msg; },
-                stringOffsets_);
+            writer_ = std::make_unique<TileLayerStream::Writer>(writerOutput_, stringOffsets_);
             requestId_ = nextRequestId++;
         }
 
-        void parseRequestFromJson(nlohmann::json const& requestJson)
+        /**
+         * Parse a request entry. Entries without tileIds describe a viewport,
+         * whose tiles must be passed as viewportTileIds (see viewportTiles()).
+         */
+        void parseRequestFromJson(nlohmann::json const& requestJson, std::vector<TileId> viewportTileIds = {})
         {
             std::string mapId = requestJson["mapId"];
             std::string layerId = requestJson["layerId"];
-            std::vector<TileId> tileIds;
-            tileIds.reserve(requestJson["tileIds"].size());
-            for (auto const& tid : requestJson["tileIds"].get<std::vector<uint64_t>>())
-                tileIds.emplace_back(tid);
-            requests_
-                .push_back(std::make_shared<LayerTilesRequest>(mapId, layerId, std::move(tileIds)));
+            std::vector<TileId> tileIds = std::move(viewportTileIds);
+            if (requestJson.contains("tileIds")) {
+                tileIds.reserve(requestJson["tileIds"].size());
+                for (auto const& tid : requestJson["tileIds"].get<std::vector<uint64_t>>())
+                    tileIds.emplace_back(tid);
+            }
+            if (requestJson.contains("knownTileHashes")) {
+                // Hashes are passed as decimal strings, since JSON
+                // numbers cannot represent all 64-bit values in JS.
+                auto& knownHashes = knownTileHashes_[{mapId, layerId}];
+                for (auto const& [tileId, hash] : requestJson["knownTileHashes"].items()) {
+                    if (hash.is_number_unsigned())
+                        knownHashes[parseDecimal(tileId)] = hash.get<uint64_t>();
+                    else if (hash.is_string())
+                        knownHashes[parseDecimal(tileId)] = parseDecimal(hash.get<std::string>());
+                    else
+                        raiseFmt("Invalid knownTileHashes value for tile {}: {}", tileId, hash.dump());
+                }
+            }
+            auto request = std::make_shared<LayerTilesRequest>(mapId, layerId, std::move(tileIds));
+            if (requestJson.contains("filter"))
+                request->filter_ = requestJson["filter"].get<std::string>();
+            requests_.push_back(std::move(request));
         }
 
         void setResponseType(std::string const& s)
         {
             responseType_ = s;
-            if (responseType_ == HttpTilesRequestState::binaryMimeType)
-                return;
-            if (responseType_ == HttpTilesRequestState::jsonlMimeType)
-                return;
-            if (responseType_ == HttpTilesRequestState::anyMimeType) {
+            if (responseType_ == HttpTilesRequestState::anyMimeType)
                 responseType_ = binaryMimeType;
+            else if (
+                responseType_ != HttpTilesRequestState::binaryMimeType &&
+                responseType_ != HttpTilesRequestState::jsonlMimeType &&
+                responseType_ != HttpTilesRequestState::mvtStreamMimeType)
+                raise(fmt::format(
+                    "Unknown Accept-Header value {}{}",
+                    responseType_,
+                    responseType_ == HttpTilesRequestState::mvtMimeType ?
+                        fmt::format(", use {} or GET /tile", HttpTilesRequestState::mvtStreamMimeType) :
+                        std::string()));
+            serializationTime_ = &Metrics::get().histogram(
+                "mapget_tile_serialization_seconds",
+                "Time to encode a tile layer for a /tiles response.",
+                {{"format", responseType_}});
+        }
+
+        /** Called once per request when it is done. */
+        void requestDone()
+        {
+            ++doneRequests_;
+            messages_.notify();
+        }
+
+        [[nodiscard]] bool allDone() const
+        {
+            return doneRequests_.load() == requests_.size();
+        }
+
+        /**
+         * Queue a serialized message for streaming. If the bound of buffered
+         * bytes is reached, the requests are paused before the message is
+         * queued, so the streaming thread which takes it will resume them.
+         */
+        void enqueue(std::string message)
+        {
+            auto size = message.size();
+            auto buffered = bufferedBytes_ += size;
+            bufferedBytesMetric_.add(static_cast<int64_t>(size));
+            auto peak = peakBufferedBytes_.load();
+            while (buffered > peak && !peakBufferedBytes_.compare_exchange_weak(peak, buffered)) {}
+            if (maxBufferedBytes_ && service_ && buffered >= maxBufferedBytes_ && !paused_) {
+                std::unique_lock lock(pauseMutex_);
+                if (!paused_) {
+                    log().debug("Pausing tiles request {}: {} bytes are buffered.", requestId_, buffered);
+                    paused_ = true;
+                    pausedRequestsMetric_.add(1);
+                    pausesMetric_.add();
+                    for (auto const& request : requests_)
+                        service_->pause(request);
+                }
+            }
+            messages_.push(std::move(message));
+        }
+
+        /**
+         * Move the queued messages into the empty vector out, e.g. to stream
+         * them. Only called by the streaming thread. Returns true if the
+         * requests were paused, in which case the caller must resume them.
+         */
+        bool takeMessages(std::vector<std::string>& out)
+        {
+            messages_.drain(out);
+            size_t size = 0;
+            for (auto const& message : out)
+                size += message.size();
+            bufferedBytes_ -= size;
+            bufferedBytesMetric_.sub(static_cast<int64_t>(size));
+
+            // A message is only queued after the pause, so if the drained
+            // messages caused one, it is visible here.
+            if (!paused_)
+                return false;
+            std::unique_lock lock(pauseMutex_);
+            if (!paused_)
+                return false;
+            paused_ = false;
+            pausedRequestsMetric_.sub(1);
+            return true;
+        }
+
+        void setMessageCompression(std::string const& compression)
+        {
+            if (compression == "none")
                 return;
+            if (compression != "zstd")
+                raise(fmt::format("Unknown messageCompression value {}", compression));
+            // Only the binary stream supports compressed messages. Compression
+            // happens in addResult(), i.e. on the worker thread which produced
+            // the tile, so the HTTP streaming thread only forwards bytes.
+            if (responseType_ == binaryMimeType)
+                writer_->enableCompression();
+        }
+
+        /** Parse a tile id or hash of knownTileHashes, which must be an unsigned decimal number. */
+        static uint64_t parseDecimal(std::string_view text)
+        {
+            uint64_t value = 0;
+            auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), value);
+            if (error != std::errc() || end != text.data() + text.size())
+                raiseFmt("Invalid knownTileHashes entry '{}': Expected an unsigned decimal number.", text);
+            return value;
+        }
+
+        /**
+         * For map layers with knownTileHashes, remember the feature digest of
+         * each sent tile, so that the client's next refresh can be answered with
+         * a delta. If the client holds a version of the tile, return a delta
+         * against it, provided that version is known. If the client's version
+         * is up-to-date, the delta is empty.
+         */
+        [[nodiscard]] TileLayer::Ptr deltaForClient(TileLayer::Ptr const& result) const
+        {
+            auto featureLayer = std::dynamic_pointer_cast<TileFeatureLayer>(result);
+            if (!featureLayer)
+                return result;
+            auto layerIt = knownTileHashes_.find({featureLayer->mapId(), featureLayer->layerInfo()->layerId_});
+            if (layerIt == knownTileHashes_.end())
+                return result;
+
+            auto digest = std::make_shared<const TileFeatureLayer::FeatureDigest>(featureLayer->featureDigest());
+            auto contentHash = TileFeatureLayer::contentHash(*digest);
+            featureDigests_->put(contentHash, digest);
+
+            auto knownIt = layerIt->second.find(featureLayer->tileId().value_);
+            if (knownIt == layerIt->second.end())
+                return result;
+            if (knownIt->second == contentHash)
+                return featureLayer->deltaFrom(*digest, *digest);
+            if (auto baseDigest = featureDigests_->get(knownIt->second))
+                return featureLayer->deltaFrom(*baseDigest, *digest);
+            return result;
+        }
+
+        /**
+         * Get the MVT encoding of a feature layer result. The encoding is cached
+         * next to the tile layer, separately for each filter, with one entry per
+         * tile and filter. The entry starts with the timestamp of the encoded
+         * tile version (8 bytes, little endian), so it is encoded and replaced
+         * again once the tile itself was replaced.
+         * Returns nullopt for other layer types.
+         */
+        [[nodiscard]] std::optional<std::string>
+        mvtForClient(TileLayer::Ptr const& result, std::string const& filter) const
+        {
+            auto featureLayer = std::dynamic_pointer_cast<TileFeatureLayer>(result);
+            if (!featureLayer)
+                return std::nullopt;
+
+            auto key = MapTileKey(*featureLayer).derived(
+                filter.empty() ? std::string("mvt") :
+                                 fmt::format("filter-{}-mvt", picosha2::hash256_hex_string(filter).substr(0, 16)));
+            std::string version;
+            appendLittleEndian(
+                version,
+                static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+                    featureLayer->timestamp().time_since_epoch()).count()),
+                8);
+            if (cache_) {
+                auto cached = cache_->getTileLayerBlob(key);
+                if (cached && cached->starts_with(version))
+                    return cached->substr(version.size());
             }
-            raise(fmt::format("Unknown Accept-Header value {}", responseType_));
+            auto mvt = featureLayer->toMvt();
+            if (cache_)
+                cache_->putTileLayerBlob(key, version + mvt);
+            return mvt;
         }
 
-        void addResult(TileLayer::Ptr const& result)
+        /**
+         * Serialize a result for the client. The result was already filtered
+         * by the service, if its request has a filter, which is only passed
+         * here to separate the cached MVT encodings of filtered tiles.
+         */
+        void addResult(TileLayer::Ptr const& result, std::string const& filter = {})
         {
-            std::unique_lock lock(mutex_);
+            // Deltas, JSON and MVT are computed by the calling worker.
+            auto span = Trace::currentSpan("HttpTilesRequestState::addResult");
+            auto serializationStart = std::chrono::steady_clock::now();
+            auto binaryResult = result;
+            std::string jsonResult;
+            std::optional<std::string> mvtResult;
+            if (responseType_ == binaryMimeType)
+                binaryResult = deltaForClient(result);
+            else if (responseType_ == mvtStreamMimeType) {
+                mvtResult = mvtForClient(result, filter);
+                if (!mvtResult) {
+                    log().debug("No MVT encoding for {}", MapTileKey(*result).toString());
+                    return;
+                }
+            }
+            else
+                result->writeJson(jsonResult);
+            auto serializationTime = std::chrono::steady_clock::now() - serializationStart;
+
             log().debug("Response ready: {}", MapTileKey(*result).toString());
             if (responseType_ == binaryMimeType) {
-                // Binary response
-                writer_->write(result);
+                // Binary response: The message is queued while the writer is
+                // locked, so string pool updates keep their order.
+                std::unique_lock lock(writerMutex_);
+                auto writeStart = std::chrono::steady_clock::now();
+                writer_->write(binaryResult);
+                serializationTime += std::chrono::steady_clock::now() - writeStart;
+                enqueue(std::move(writerOutput_));
+                writerOutput_.clear();
+            }
+            else if (responseType_ == mvtStreamMimeType) {
+                // MVT response: Each tile is framed by its tile id (8 bytes)
+                // and the size of its encoding (4 bytes), both little endian.
+                std::string message;
+                message.reserve(12 + mvtResult->size());
+                appendLittleEndian(message, result->tileId().value_, 8);
+                appendLittleEndian(message, mvtResult->size(), 4);
+                message += *mvtResult;
+                enqueue(std::move(message));
             }
             else {
                 // JSON response
-                buffer_ << nlohmann::to_string(result->toJson()) + "\n";
+                jsonResult += '\n';
+                enqueue(std::move(jsonResult));
             }
+
+            if (serializationTime_)
+                serializationTime_->observe(serializationTime);
+        }
+    };
+
+    // Upper bound for the number of tiles which a /search request may cover.
+    static constexpr size_t maxSearchTiles = 16384;
+
+    // Upper bound for the number of tiles which a /tiles viewport may cover.
+    static constexpr size_t maxViewportTiles = 16384;
+
+    // Time after which a GET /tile request is given up.
+    static constexpr auto tileRequestTimeout = std::chrono::seconds(60);
+
+    /**
+     * Enumerate the tiles of a /tiles request entry which describes a viewport,
+     * i.e. a bbox or polygon, instead of listing tileIds. The zoom level is
+     * snapped to the nearest one which the layer provides, and tiles outside
+     * the layer's coverage are skipped. The remaining tiles are ordered
+     * center-out from the focus point, which defaults to the viewport's center.
+     * Polygons must not cross the antimeridian.
+     */
+    std::vector<TileId> viewportTiles(nlohmann::json const& requestJson, AuthHeaders const& authHeaders) const
+    {
+        auto mapId = requestJson.at("mapId").get<std::string>();
+        auto layerId = requestJson.at("layerId").get<std::string>();
+
+        // Layers of all data sources which provide the map layer. If there
+        // are none, the request is rejected by Service::request().
+        std::vector<std::shared_ptr<LayerInfo>> layers;
+        for (auto const& info : self_.info(authHeaders)) {
+            if (info.mapId_ != mapId || info.isAddOn_)
+                continue;
+            if (auto layer = info.getLayer(layerId, false))
+                layers.push_back(layer);
+        }
+        if (layers.empty())
+            return {};
+
+        auto zoomLevel = requestJson.value<int>("zoom", 13);
+        std::set<int> zoomLevels;
+        for (auto const& layer : layers)
+            zoomLevels.insert(layer->zoomLevels_.begin(), layer->zoomLevels_.end());
+        if (!zoomLevels.empty()) {
+            auto nearest = std::min_element(
+                zoomLevels.begin(),
+                zoomLevels.end(),
+                [zoomLevel](int l, int r) { return std::abs(l - zoomLevel) < std::abs(r - zoomLevel); });
+            zoomLevel = *nearest;
+        }
+        if (zoomLevel < 0)
+            raise("The zoom level must not be negative.");
+
+        Point sw, ne;
+        std::optional<Polygon> polygon;
+        if (requestJson.contains("polygon")) {
+            LineString ring;
+            for (auto const& point : requestJson["polygon"])
+                ring.points.emplace_back(point.at(0).get<double>(), point.at(1).get<double>());
+            if (ring.points.size() < 3)
+                raise("A viewport polygon needs at least three points.");
+            if (!(ring.points.front() == ring.points.back()))
+                ring.points.push_back(ring.points.front());
+            auto bbox = ring.bbox();
+            sw = bbox.p1;
+            ne = bbox.p2;
+            polygon = Polygon{{std::move(ring)}};
+        }
+        else if (requestJson.contains("bbox")) {
+            auto bbox = requestJson["bbox"].get<std::vector<double>>();
+            if (bbox.size() != 4)
+                raise("The bbox must be [minLon, minLat, maxLon, maxLat].");
+            sw = {bbox[0], bbox[1]};
+            ne = {bbox[2], bbox[3]};
+        }
+        else
+            raise("A request needs tileIds, a bbox or a polygon.");
+
+        auto tiles = TileId::tilesInBbox(sw, ne, static_cast<uint16_t>(zoomLevel), maxViewportTiles);
+        std::erase_if(
+            tiles,
+            [&](TileId const& tile)
+            {
+                if (polygon) {
+                    // The tile intersects the polygon if it is inside,
+                    // or if their edges cross or contain each other.
+                    BBox tileBox{tile.sw(), tile.ne()};
+                    if (!polygon->contains(tile.center()) && !tileBox.intersects(polygon->polys[0]))
+                        return true;
+                }
+                return std::none_of(
+                    layers.begin(),
+                    layers.end(),
+                    [&tile](auto const& layer) { return layer->covers(tile); });
+            });
+
+        Point focus;
+        if (requestJson.contains("focus"))
+            focus = {requestJson["focus"].at(0).get<double>(), requestJson["focus"].at(1).get<double>()};
+        else {
+            // The center of a bbox which crosses the antimeridian is on its far side.
+            auto centerLon = (sw.x + ne.x) / 2.;
+            if (sw.x > ne.x)
+                centerLon += centerLon > 0 ? -180. : 180.;
+            focus = {centerLon, (sw.y + ne.y) / 2.};
+        }
+        TileId::sortByDistance(tiles, focus);
+        return tiles;
+    }
+
+    /**
+     * Threads which evaluate search queries on result tiles. The service
+     * passes on results while its jobs are locked, so a /search request only
+     * queues its result tiles here, and they are evaluated in parallel
+     * without blocking the service or the HTTP response threads. The threads
+     * are started with the first search.
+     */
+    struct SearchEvaluationPool
+    {
+        std::mutex mutex_;
+        std::condition_variable tasksAvailable_;
+        std::deque<std::function<void()>> tasks_;
+        std::vector<std::thread> threads_;
+        bool shouldStop_ = false;
+
+        ~SearchEvaluationPool()
+        {
+            {
+                std::unique_lock lock(mutex_);
+                shouldStop_ = true;
+            }
+            tasksAvailable_.notify_all();
+            for (auto& thread : threads_)
+                thread.join();
+        }
+
+        void enqueue(std::function<void()> task)
+        {
+            {
+                std::unique_lock lock(mutex_);
+                if (threads_.empty()) {
+                    auto numThreads = std::clamp(std::thread::hardware_concurrency(), 1u, 8u);
+                    for (auto i = 0u; i < numThreads; ++i)
+                        threads_.emplace_back([this] { work(); });
+                }
+                tasks_.push_back(std::move(task));
+            }
+            tasksAvailable_.notify_one();
+        }
+
+        void work()
+        {
+            for (;;) {
+                std::function<void()> task;
+                {
+                    std::unique_lock lock(mutex_);
+                    tasksAvailable_.wait(lock, [this] { return shouldStop_ || !tasks_.empty(); });
+                    if (shouldStop_)
+                        return;
+                    task = std::move(tasks_.front());
+                    tasks_.pop_front();
+                }
+                task();
+            }
+        }
+    };
+    mutable SearchEvaluationPool searchEvaluationPool_;
+
+    /**
+     * State of a /search request. The result callbacks pass the result tiles
+     * on to the search evaluation pool, and matching features are collected
+     * as JSON lines, which the HTTP response thread streams to the client.
+     */
+    struct HttpSearchRequestState
+    {
+        std::mutex mutex_;
+        std::condition_variable resultEvent_;
+
+        uint64_t requestId_;
+        std::string query_;
+        bool idsOnly_ = false;
+        std::vector<LayerTilesRequest::Ptr> requests_;
+
+        // Matches which wait to be streamed, and the number of result
+        // tiles which are still being evaluated. Guarded by mutex_.
+        std::string lines_;
+        size_t numEvaluating_ = 0;
+
+        // Maximum number of matches, zero for no limit. Each match reserves
+        // its slot in numMatches_ before it is emitted, so tiles which are
+        // evaluated in parallel never exceed the limit. Once the limit is
+        // reached, stopped_ is set and the remaining tiles are skipped.
+        uint64_t limit_ = 0;
+        std::atomic_uint64_t numMatches_{0};
+        std::atomic_bool stopped_{false};
+
+        // Evaluation error, which is sent as the last line of the response.
+        // Guarded by mutex_.
+        std::optional<std::string> error_;
+
+        // Admission of the search within its client's limits.
+        std::shared_ptr<Admission> admission_;
+
+        HttpSearchRequestState()
+        {
+            static std::atomic_uint64_t nextRequestId;
+            requestId_ = nextRequestId++;
+        }
+
+        /** Pass a result tile on to the evaluation pool. Called by the service. */
+        static void addResult(
+            std::shared_ptr<HttpSearchRequestState> const& state,
+            TileFeatureLayer::Ptr const& layer,
+            SearchEvaluationPool& pool)
+        {
+            if (state->stopped_)
+                return;
+            {
+                std::unique_lock lock(state->mutex_);
+                ++state->numEvaluating_;
+            }
+            pool.enqueue([state, layer] { state->evaluate(*layer); });
+        }
+
+        /**
+         * Collect the matches of a tile. Called by the evaluation pool.
+         * On an evaluation error, the search is stopped.
+         */
+        void evaluate(TileFeatureLayer& layer)
+        {
+            std::string lines;
+            std::optional<std::string> error;
+            try {
+                for (auto feature : layer) {
+                    if (stopped_)
+                        break;
+                    if (!layer.matches(query_, *feature))
+                        continue;
+                    auto matchIndex = numMatches_.fetch_add(1);
+                    if (limit_ && matchIndex >= limit_) {
+                        stopped_ = true;
+                        break;
+                    }
+                    auto line = nlohmann::json::object({
+                        {"mapId", layer.mapId()},
+                        {"layerId", layer.layerInfo()->layerId_},
+                        {"tileId", layer.tileId().value_},
+                        {"featureId", feature->id()->toString()}});
+                    if (!idsOnly_)
+                        line["feature"] = feature->toJson();
+                    lines += line.dump();
+                    lines += '\n';
+                    if (limit_ && matchIndex + 1 >= limit_)
+                        stopped_ = true;
+                }
+            }
+            catch (std::exception const& e) {
+                error = e.what();
+                stopped_ = true;
+            }
+
+            std::unique_lock lock(mutex_);
+            lines_ += lines;
+            if (error && !error_)
+                error_ = std::move(error);
+            --numEvaluating_;
             resultEvent_.notify_one();
         }
+
+        /** Number of emitted matches, which numMatches_ may exceed by the rejected reservations. */
+        [[nodiscard]] uint64_t matchCount() const
+        {
+            auto const reserved = numMatches_.load();
+            return limit_ ? std::min(reserved, limit_) : reserved;
+        }
+
+        /**
+         * Check whether all tiles were evaluated. Once the search is stopped,
+         * the tiles which are still being evaluated may add matches up to the
+         * limit, so they are waited for. Requires mutex_.
+         */
+        [[nodiscard]] bool isDone() const
+        {
+            if (numEvaluating_ > 0)
+                return false;
+            if (stopped_)
+                return true;
+            return std::all_of(requests_.begin(), requests_.end(), [](auto const& r) { return r->isDone(); });
+        }
     };
 
+    /**
+     * State of a viewport subscription. The subscription keeps a binary tile
+     * stream open, and the client sends the tiles of its current viewport as
+     * small updates. Tiles are only requested if they have not been sent on
+     * the stream yet, and the string pool offsets are kept for the lifetime
+     * of the stream, so string pools are never sent twice.
+     */
+    struct ViewportSubscription
+    {
+        using LayerKey = std::pair<std::string, std::string>;
+
+        std::mutex mutex_;
+        std::condition_variable resultEvent_;
+
+        // The clientId which the client picked, its identity (see clientIdentity())
+        // and the key of the subscription (see clientRequestKey()).
+        std::string clientId_;
+        std::string identity_;
+        std::string key_;
+
+        std::string buffer_;
+        TileLayerStream::StringPoolOffsetMap stringOffsets_;
+        std::unique_ptr<TileLayerStream::Writer> writer_;
+        bool closed_ = false;
+
+        // Admission of the current viewport within the client's limits.
+        std::shared_ptr<Admission> admission_;
+
+        // Unlike a /tiles response, a subscription is not paused if the client
+        // reads too slowly, as its viewport keeps changing. Once more than
+        // maxBufferedBytes_ wait to be streamed, the buffer is dropped and the
+        // stream is closed instead. Zero means unlimited.
+        size_t maxBufferedBytes_ = 0;
+        bool overflowed_ = false;
+
+        // Tile ids of the current viewport, and those of them which were sent.
+        std::map<LayerKey, std::set<uint64_t>> wanted_;
+        std::map<LayerKey, std::set<uint64_t>> sent_;
+
+        // Requests which may still deliver tiles.
+        std::vector<LayerTilesRequest::Ptr> requests_;
+
+        ViewportSubscription(std::string clientId, std::string identity)
+            : clientId_(std::move(clientId)), identity_(std::move(identity)), key_(clientRequestKey(identity_, clientId_))
+        {
+            writer_ = std::make_unique<TileLayerStream::Writer>(buffer_, stringOffsets_);
+        }
+
+        void addResult(TileLayer::Ptr const& result)
+        {
+            std::unique_lock lock(mutex_);
+            LayerKey layerKey{result->mapId(), result->layerInfo()->layerId_};
+            auto tileId = result->tileId().value_;
+
+            // Drop tiles which left the viewport while they were processed.
+            auto wantedIt = wanted_.find(layerKey);
+            if (closed_ || wantedIt == wanted_.end() || !wantedIt->second.count(tileId))
+                return;
+            if (!sent_[layerKey].insert(tileId).second)
+                return;
+            writer_->write(result);
+            if (maxBufferedBytes_ && buffer_.size() > maxBufferedBytes_) {
+                // The pending requests are aborted once the stream ends.
+                buffer_.clear();
+                overflowed_ = true;
+                closed_ = true;
+            }
+            resultEvent_.notify_one();
+        }
+    };
+
+    mutable std::mutex subscriptionMapMutex_;
+    mutable std::unordered_map<std::string, std::shared_ptr<ViewportSubscription>> subscriptionPerClientId_;
+
+    // Subscriptions by clientRequestKey(), i.e. by the identity and clientId of their client.
+    [[nodiscard]] std::shared_ptr<ViewportSubscription> subscription(std::string const& key) const
+    {
+        std::unique_lock lock(subscriptionMapMutex_);
+        auto it = subscriptionPerClientId_.find(key);
+        return it != subscriptionPerClientId_.end() ? it->second : nullptr;
+    }
+
+    /**
+     * Close the subscription with the given key, if it is still the given
+     * one (or any subscription, if none is given). The stream is then ended,
+     * its admission is released, and requests for tiles which were not sent
+     * yet are aborted.
+     */
+    void closeSubscription(std::string const& key, std::shared_ptr<ViewportSubscription> const& expected = nullptr) const
+    {
+        std::shared_ptr<ViewportSubscription> closed;
+        {
+            std::unique_lock lock(subscriptionMapMutex_);
+            auto it = subscriptionPerClientId_.find(key);
+            if (it == subscriptionPerClientId_.end() || (expected && it->second != expected))
+                return;
+            closed = it->second;
+            subscriptionPerClientId_.erase(it);
+        }
+
+        std::vector<LayerTilesRequest::Ptr> requests;
+        std::shared_ptr<Admission> admission;
+        {
+            std::unique_lock lock(closed->mutex_);
+            closed->closed_ = true;
+            requests.swap(closed->requests_);
+            admission.swap(closed->admission_);
+            closed->resultEvent_.notify_one();
+        }
+        if (admission)
+            admission->release();
+        for (auto const& request : requests) {
+            if (!request->isDone())
+                self_.abort(request);
+        }
+    }
+
     mutable std::mutex clientRequestMapMutex_;
     mutable std::unordered_map<std::string, std::shared_ptr<HttpTilesRequestState>> requestStatePerClientId_;
 
-    void abortRequestsForClientId(std::string clientId, std::shared_ptr<HttpTilesRequestState> newState = nullptr) const
+    // Requests by clientRequestKey(), i.e. by the identity and clientId of their client.
+    void abortRequestsForClientId(std::string const& clientRequestKey, std::shared_ptr<HttpTilesRequestState> newState = nullptr) const
     {
         std::unique_lock clientRequestMapAccess(clientRequestMapMutex_);
-        auto clientRequestIt = requestStatePerClientId_.find(clientId);
+        auto clientRequestIt = requestStatePerClientId_.find(clientRequestKey);
         if (clientRequestIt != requestStatePerClientId_.end()) {
             // Ensure that any previous requests from the same clientId
             // are finished post-haste!
@@ -239,10 +1210,12 @@ struct HttpService::Impl
             }
             if (anySoftAbort)
                 log().warn("Soft-aborting tiles request {}", clientRequestIt->second->requestId_);
+            if (auto const& admission = clientRequestIt->second->admission_)
+                admission->release();
             requestStatePerClientId_.erase(clientRequestIt);
         }
         if (newState) {
-            requestStatePerClientId_.emplace(clientId, newState);
+            requestStatePerClientId_.emplace(clientRequestKey, newState);
         }
     }
 
@@ -256,13 +1229,43 @@ struct HttpService::Impl
         nlohmann::json j = nlohmann::json::parse(req.body);
         auto requestsJson = j["requests"];
 
-        // TODO: Limit number of requests to avoid DoS to other users.
         // Within one HTTP request, all requested tiles from the same map+layer
         // combination should be in a single LayerTilesRequest.
         auto state = std::make_shared<HttpTilesRequestState>();
+        state->featureDigests_ = featureDigests_;
+        state->cache_ = self_.cache();
+        state->service_ = &self_;
+        state->maxBufferedBytes_ = maxResponseBufferBytes_;
         log().info("Processing tiles request {}", state->requestId_);
+        AuthHeaders authHeaders{req.headers.begin(), req.headers.end()};
         for (auto& requestJson : requestsJson) {
-            state->parseRequestFromJson(requestJson);
+            try {
+                if (requestJson.contains("tileIds")) {
+                    state->parseRequestFromJson(requestJson);
+                    continue;
+                }
+                // Viewport request: The tiles are enumerated here.
+                state->parseRequestFromJson(requestJson, viewportTiles(requestJson, authHeaders));
+            }
+            catch (std::exception const& e) {
+                res.status = 400;
+                res.set_content(e.what(), "text/plain");
+                return;
+            }
+        }
+
+        // Compile the filters up front, so a malformed one is reported
+        // to the client instead of failing for each of its tiles.
+        for (auto const& request : state->requests_) {
+            if (request->filter_.empty())
+                continue;
+            if (auto compiled = TileFeatureLayer::compileQuery(request->filter_); !compiled) {
+                res.status = 400;
+                res.set_content(
+                    fmt::format("Invalid filter '{}': {}", request->filter_, compiled.error().message),
+                    "text/plain");
+                return;
+            }
         }
 
         // Parse stringPoolOffsets.
@@ -275,20 +1278,58 @@ struct HttpService::Impl
         // Determine response type.
         state->setResponseType(req.get_header_value("Accept"));
 
+        // Determine per-message compression of the binary stream.
+        if (j.contains("messageCompression")) {
+            state->setMessageCompression(j["messageCompression"].get<std::string>());
+        }
+
+        // Admit the request within its client's limits, so that one client
+        // cannot flood the service's queue at the expense of the others.
+        auto identity = clientIdentity(req);
+        std::optional<std::string> clientRequestKey;
+        if (j.contains("clientId"))
+            clientRequestKey = Impl::clientRequestKey(identity, j["clientId"].get<std::string>());
+        size_t numTiles = 0;
+        for (auto const& request : state->requests_)
+            numTiles += request->tiles_.size();
+        std::shared_ptr<Admission> superseded;
+        if (clientRequestKey) {
+            std::unique_lock clientRequestMapAccess(clientRequestMapMutex_);
+            auto clientRequestIt = requestStatePerClientId_.find(*clientRequestKey);
+            if (clientRequestIt != requestStatePerClientId_.end())
+                superseded = clientRequestIt->second->admission_;
+        }
+        state->admission_ = admitOrReject(res, identity, numTiles, superseded);
+        if (!state->admission_)
+            return;
+        for (auto& request : state->requests_)
+            request->clientId_ = identity;
+
+        // Trace the request on demand, or if it is sampled.
+        if (j.value("trace", false) || sampleTrace()) {
+            state->trace_ = std::make_shared<Trace>(fmt::format("/tiles request {}", state->requestId_));
+            for (auto& request : state->requests_)
+                request->trace_ = state->trace_;
+            retainTrace(state->trace_);
+        }
+
         // Process requests.
         for (auto& request : state->requests_) {
-            request->onFeatureLayer([state](auto&& layer) { state->addResult(layer); });
+            request->onFeatureLayer([state, filter = request->filter_](auto&& layer) { state->addResult(layer, filter); });
             request->onSourceDataLayer([state](auto&& layer) { state->addResult(layer); });
-            request->onDone_ = [state](RequestStatus r)
+            // The done callback may run again if a done request is aborted,
+            // but each request must only be counted once.
+            request->onDone_ = [state, counted = std::make_shared<std::atomic_bool>(false)](RequestStatus r)
             {
-                state->resultEvent_.notify_one();
+                if (!counted->exchange(true))
+                    state->requestDone();
             };
         }
-        auto canProcess = self_.request(
-            state->requests_,
-            AuthHeaders{req.headers.begin(), req.headers.end()});
+        auto canProcess = self_.request(state->requests_, authHeaders);
 
         if (!canProcess) {
+            state->admission_->release();
+
             // Send a status report detailing for each request
             // whether its data source is unavailable or it was aborted.
             res.status = 400;
@@ -305,61 +1346,111 @@ struct HttpService::Impl
             return;
         }
 
-        // Parse/Process clientId.
-        if (j.contains("clientId")) {
-            auto clientId = j["clientId"].get<std::string>();
-            abortRequestsForClientId(clientId, state);
-        }
+        // Supersede the previous request with the same clientId.
+        if (clientRequestKey)
+            abortRequestsForClientId(*clientRequestKey, state);
 
         // For efficiency, set up httplib to stream tile layer responses to client:
         // (1) Lambda continuously supplies response data to httplib's DataSink,
-        //     picking up data from state->buffer_ until all tile requests are done.
+        //     draining state->messages_ until all tile requests are done.
         //     Then, signal sink->done() to close the stream with a 200 status.
         //     See httplib::write_content_without_length(...) too.
         // (2) Lambda acts as a cleanup routine, triggered by httplib upon request wrap-up.
         //     The success flag indicates if wrap-up was due to sink->done() or external factors
         //     like network errors or request aborts in lengthy tile requests (e.g., map-viewer).
+        // (3) If the client accepts a supported Content-Encoding, each chunk
+        //     is compressed and flushed outside of the lock, so tiles can
+        //     still be decoded as soon as they arrive.
+        state->compressor_ = ResponseCompressor::fromAcceptEncoding(
+            req.get_header_value("Accept-Encoding"),
+            responseCompressionLevel_);
+        if (state->compressor_)
+            res.set_header("Content-Encoding", std::string(state->compressor_->encoding()));
+        res.set_header("Vary", "Accept-Encoding");
+
         res.set_content_provider(
             state->responseType_,
-            [state](size_t offset, httplib::DataSink& sink)
+            [state, this](size_t offset, httplib::DataSink& sink)
             {
-                std::unique_lock lock(state->mutex_);
-
-                // Wait until there is data to be read.
-                std::string strBuf;
+                // Wait until there are messages to be streamed. The done count
+                // is read before draining, so that no message of a finished
+                // request is left behind.
+                std::vector<std::string> messages;
                 bool allDone = false;
-                state->resultEvent_.wait(
-                    lock,
-                    [&]
-                    {
-                        allDone = std::all_of(
-                            state->requests_.begin(),
-                            state->requests_.end(),
-                            [](const auto& r) { return r->isDone(); });
-                        if (allDone)
-                            state->writer_->sendEndOfStream();
-                        strBuf = state->buffer_.str();
-                        return !strBuf.empty() || allDone;
-                    });
+                while (true) {
+                    auto seenEvents = state->messages_.events();
+                    allDone = state->allDone();
+                    auto resume = state->takeMessages(messages);
+                    if (resume) {
+                        // The queue is empty now, so paused requests may continue.
+                        for (auto const& request : state->requests_)
+                            self_.resume(request);
+                    }
+                    if (!messages.empty() || allDone)
+                        break;
+                    state->messages_.wait(seenEvents);
+                }
+                if (allDone && state->responseType_ == HttpTilesRequestState::binaryMimeType) {
+                    std::unique_lock lock(state->writerMutex_);
+                    state->writer_->sendEndOfStream();
+                    messages.emplace_back(std::move(state->writerOutput_));
+                    state->writerOutput_.clear();
+                }
+                auto span = state->trace_ ? state->trace_->span("HttpService::stream") : Trace::Span();
+
+                size_t size = 0;
+                for (auto const& message : messages)
+                    size += message.size();
+                state->bytesUncompressed_ += size;
+                streamedBytesUncompressed_.add(size);
+
+                if (state->compressor_) {
+                    // Compress the messages as one chunk, since each
+                    // call to compress() flushes the compressor.
+                    std::string compressed;
+                    if (size) {
+                        std::string chunk;
+                        chunk.reserve(size);
+                        for (auto const& message : messages)
+                            chunk += message;
+                        state->compressor_->compress(chunk, compressed);
+                    }
+                    if (allDone)
+                        state->compressor_->finish(compressed);
+                    messages.clear();
+                    messages.emplace_back(std::move(compressed));
+                    size = messages.back().size();
+                }
+                state->bytesSent_ += size;
+                streamedBytesSent_.add(size);
 
-                if (!strBuf.empty()) {
-                    log().debug("Streaming {} bytes...", strBuf.size());
-                    sink.write(strBuf.data(), strBuf.size());
+                if (size) {
+                    log().debug("Streaming {} bytes...", size);
+                    for (auto const& message : messages)
+                        sink.write(message.data(), message.size());
                     sink.os.flush();
-                    state->buffer_.str("");  // Clear buffer after reading.
                 }
 
                 // Call sink.done() when all requests are done.
                 if (allDone) {
+                    responseBytesUncompressed_ += state->bytesUncompressed_;
+                    responseBytesSent_ += state->bytesSent_;
                     sink.done();
                 }
 
                 return true;
             },
             // Network error/timeout of request to datasource:
-            // cleanup callback to abort the requests.
-            [state, this](bool success)
+            // cleanup callback to abort the requests. It holds the server thread's
+            // streaming mark, so other connections are served by a spare thread.
+            [state, this, streaming = HttpServer::beginStreaming()](bool success)
             {
+                state->admission_->release();
+                {
+                    // Drop whatever the client did not receive.
+                    std::vector<std::string> dropped;
+                    state->takeMessages(dropped);
+                }
                 if (!success) {
                     log().warn("Aborting tiles request {}", state->requestId_);
                     for (auto& request : state->requests_) {
@@ -367,18 +1458,420 @@ struct HttpService::Impl
                     }
                 }
                 else {
-                    log().info("Tiles request {} was successful.", state->requestId_);
+                    log().info(
+                        "Tiles request {} was successful: {} bytes, {} bytes sent ({}), at most {} bytes buffered.",
+                        state->requestId_,
+                        state->bytesUncompressed_,
+                        state->bytesSent_,
+                        state->compressor_ ? state->compressor_->encoding() : "identity",
+                        state->peakBufferedBytes_.load());
+                }
+            });
+    }
+
+    /**
+     * Search the tiles of a bounding box for features which match a simfil
+     * query. Tiles are fetched through the generic mapget service, so cached
+     * tiles are reused, and matches are streamed as soon as they are found.
+     */
+    void handleSearchRequest(const httplib::Request& req, httplib::Response& res) const
+    {
+        auto badRequest = [&res](std::string const& message)
+        {
+            res.status = 400;
+            res.set_content(message, "text/plain");
+        };
+
+        // Parse the JSON request.
+        nlohmann::json j = nlohmann::json::parse(req.body);
+        if (!j.contains("mapId") || !j.contains("bbox") || !j.contains("query"))
+            return badRequest("Missing mapId, bbox or query.");
+        auto mapId = j["mapId"].get<std::string>();
+        auto bbox = j["bbox"].get<std::vector<double>>();
+        if (bbox.size() != 4)
+            return badRequest("The bbox must be [minLon, minLat, maxLon, maxLat].");
+        auto zoomLevel = j.value<uint16_t>("zoom", 13);
+        std::vector<TileId> tileIds;
+        try {
+            tileIds = TileId::tilesInBbox({bbox[0], bbox[1]}, {bbox[2], bbox[3]}, zoomLevel, maxSearchTiles);
+        }
+        catch (std::exception const& e) {
+            return badRequest(e.what());
+        }
+
+        // Search the given layers, or all feature layers of the map.
+        AuthHeaders authHeaders{req.headers.begin(), req.headers.end()};
+        std::vector<std::string> layerIds;
+        if (j.contains("layerIds")) {
+            layerIds = j["layerIds"].get<std::vector<std::string>>();
+        }
+        else {
+            for (auto const& info : self_.info(authHeaders)) {
+                if (info.mapId_ != mapId)
+                    continue;
+                for (auto const& [layerId, layerInfo] : info.layers_) {
+                    if (layerInfo->type_ == LayerType::Features)
+                        layerIds.push_back(layerId);
+                }
+            }
+        }
+        if (layerIds.empty())
+            return badRequest(fmt::format("No feature layers to search in map {}.", mapId));
+
+        auto state = std::make_shared<HttpSearchRequestState>();
+        state->query_ = j["query"].get<std::string>();
+        if (auto compiled = TileFeatureLayer::compileQuery(state->query_); !compiled)
+            return badRequest(fmt::format("Invalid query '{}': {}", state->query_, compiled.error().message));
+        state->limit_ = j.value<uint64_t>("limit", 0);
+        state->idsOnly_ = j.value("idsOnly", false);
+        log().info(
+            "Processing search request {} over {} tiles in {} layers",
+            state->requestId_,
+            tileIds.size(),
+            layerIds.size());
+
+        // Searches count against the same limits as /tiles requests.
+        auto identity = clientIdentity(req);
+        state->admission_ = admitOrReject(res, identity, tileIds.size() * layerIds.size());
+        if (!state->admission_)
+            return;
+
+        for (auto const& layerId : layerIds) {
+            auto request = std::make_shared<LayerTilesRequest>(mapId, layerId, tileIds);
+            request->clientId_ = identity;
+            request->onFeatureLayer([state, this](auto&& layer)
+            {
+                HttpSearchRequestState::addResult(state, layer, searchEvaluationPool_);
+            });
+            request->onDone_ = [state](RequestStatus)
+            {
+                std::unique_lock lock(state->mutex_);
+                state->resultEvent_.notify_one();
+            };
+            state->requests_.push_back(std::move(request));
+        }
+
+        if (!self_.request(state->requests_, authHeaders)) {
+            state->admission_->release();
+            res.status = 400;
+            std::vector<std::underlying_type_t<RequestStatus>> requestStatuses{};
+            for (const auto& r : state->requests_) {
+                requestStatuses.push_back(static_cast<std::underlying_type_t<RequestStatus>>(r->getStatus()));
+                if (r->getStatus() == RequestStatus::Unauthorized) {
+                    res.status = 403;  // Forbidden.
+                }
+            }
+            res.set_content(
+                nlohmann::json::object({{"requestStatuses", requestStatuses}}).dump(),
+                "application/json");
+            return;
+        }
+
+        // Stream the matches like tile responses, see handleTilesRequest().
+        // Once the limit is reached, the remaining tile requests are aborted.
+        res.set_content_provider(
+            HttpTilesRequestState::jsonlMimeType,
+            [state, this](size_t offset, httplib::DataSink& sink)
+            {
+                // Wait until there are matches to be streamed.
+                std::string strBuf;
+                bool allDone = false;
+                {
+                    std::unique_lock lock(state->mutex_);
+                    state->resultEvent_.wait(
+                        lock,
+                        [&] { return !state->lines_.empty() || state->isDone(); });
+                    strBuf.swap(state->lines_);
+                    allDone = state->isDone();
+                    if (allDone && state->error_) {
+                        strBuf += nlohmann::json::object({{"error", *state->error_}}).dump();
+                        strBuf += '\n';
+                    }
+                }
+
+                if (!strBuf.empty()) {
+                    sink.write(strBuf.data(), strBuf.size());
+                    sink.os.flush();
+                }
+
+                if (allDone) {
+                    for (auto const& request : state->requests_) {
+                        if (!request->isDone())
+                            self_.abort(request);
+                    }
+                    sink.done();
+                }
+                return true;
+            },
+            [state, this, streaming = HttpServer::beginStreaming()](bool success)
+            {
+                state->admission_->release();
+                if (!success) {
+                    log().warn("Aborting search request {}", state->requestId_);
+                    state->stopped_ = true;
+                    for (auto const& request : state->requests_) {
+                        self_.abort(request);
+                    }
+                }
+                else
+                    log().info("Search request {} found {} matches.", state->requestId_, state->matchCount());
+            });
+    }
+
+    /**
+     * Open a viewport subscription for a client. The response is a binary
+     * tile stream which stays open until the client disconnects, the
+     * subscription is replaced or closed via /abort. The tiles to stream
+     * are set with the initial request and subsequent /subscribe/update calls.
+     */
+    void handleSubscribeRequest(const httplib::Request& req, httplib::Response& res) const
+    {
+        // Parse the JSON request.
+        nlohmann::json j = nlohmann::json::parse(req.body);
+        if (!j.contains("clientId")) {
+            res.status = 400;
+            res.set_content("Missing clientId", "text/plain");
+            return;
+        }
+        auto subscription = std::make_shared<ViewportSubscription>(j["clientId"].get<std::string>(), clientIdentity(req));
+        auto const& clientId = subscription->clientId_;
+
+        // A subscription counts as an open request of its client, with the
+        // tiles of its viewport. A new subscription replaces the previous
+        // one of the same client, and is admitted in its place.
+        auto requestsJson = j.value("requests", nlohmann::json::array());
+        std::shared_ptr<Admission> superseded;
+        if (auto previous = this->subscription(subscription->key_)) {
+            std::unique_lock lock(previous->mutex_);
+            superseded = previous->admission_;
+        }
+        subscription->admission_ = admitOrReject(res, subscription->identity_, numViewportTiles(requestsJson), superseded);
+        if (!subscription->admission_)
+            return;
+        subscription->maxBufferedBytes_ = maxResponseBufferBytes_;
+
+        closeSubscription(subscription->key_);
+        if (j.contains("stringPoolOffsets")) {
+            for (auto& item : j["stringPoolOffsets"].items()) {
+                subscription->stringOffsets_[item.key()] = item.value().get<simfil::StringId>();
+            }
+        }
+        if (j.value("messageCompression", "none") == "zstd")
+            subscription->writer_->enableCompression();
+        {
+            std::unique_lock lock(subscriptionMapMutex_);
+            subscriptionPerClientId_[subscription->key_] = subscription;
+        }
+        log().info("Opened viewport subscription for client {}", clientId);
+
+        if (!requestsJson.empty())
+            updateSubscription(subscription, requestsJson, AuthHeaders{req.headers.begin(), req.headers.end()});
+
+        res.set_content_provider(
+            HttpTilesRequestState::binaryMimeType,
+            [subscription](size_t offset, httplib::DataSink& sink)
+            {
+                std::unique_lock lock(subscription->mutex_);
+
+                // Wake up regularly while the viewport is idle, so httplib
+                // can notice that the client has disconnected.
+                subscription->resultEvent_.wait_for(
+                    lock,
+                    std::chrono::seconds(1),
+                    [&] { return !subscription->buffer_.empty() || subscription->closed_; });
+                auto closed = subscription->closed_;
+                if (closed && subscription->overflowed_)
+                    log().warn("Closing viewport subscription for client {}: It does not keep up with its tiles.",
+                               subscription->clientId_);
+                if (closed)
+                    subscription->writer_->sendEndOfStream();
+
+                std::string strBuf;
+                strBuf.swap(subscription->buffer_);
+                lock.unlock();
+
+                if (!strBuf.empty()) {
+                    sink.write(strBuf.data(), strBuf.size());
+                    sink.os.flush();
                 }
+                if (closed)
+                    sink.done();
+                return true;
+            },
+            [subscription, this, streaming = HttpServer::beginStreaming()](bool)
+            {
+                closeSubscription(subscription->key_, subscription);
+                log().info("Closed viewport subscription for client {}", subscription->clientId_);
             });
     }
 
+    /** Number of tiles in the requests of a subscription's viewport. */
+    static size_t numViewportTiles(nlohmann::json const& requestsJson)
+    {
+        size_t numTiles = 0;
+        for (auto const& requestJson : requestsJson)
+            numTiles += requestJson.value("tileIds", nlohmann::json::array()).size();
+        return numTiles;
+    }
+
+    /**
+     * Set the tiles of a subscription's viewport. Tiles which were already
+     * sent are not requested again. Pending requests are only aborted if
+     * some of their unsent tiles left the viewport, and their unsent tiles
+     * which are still in the viewport are requested again.
+     * Returns the number of requested and cancelled tiles.
+     */
+    nlohmann::json updateSubscription(
+        std::shared_ptr<ViewportSubscription> const& subscriptionPtr,
+        nlohmann::json const& requestsJson,
+        AuthHeaders const& authHeaders) const
+    {
+        using LayerKey = ViewportSubscription::LayerKey;
+
+        // Parse the new viewport, keeping the client's tile order.
+        std::vector<std::pair<LayerKey, std::vector<uint64_t>>> viewport;
+        std::map<LayerKey, std::set<uint64_t>> wanted;
+        for (auto const& requestJson : requestsJson) {
+            LayerKey layerKey{requestJson.at("mapId").get<std::string>(), requestJson.at("layerId").get<std::string>()};
+            auto tileIds = requestJson.at("tileIds").get<std::vector<uint64_t>>();
+            wanted[layerKey].insert(tileIds.begin(), tileIds.end());
+            viewport.emplace_back(std::move(layerKey), std::move(tileIds));
+        }
+
+        auto& subscription = *subscriptionPtr;
+        std::weak_ptr<ViewportSubscription> weakSubscription = subscriptionPtr;
+        std::vector<LayerTilesRequest::Ptr> toAbort;
+        std::vector<LayerTilesRequest::Ptr> toRequest;
+        size_t numCancelledTiles = 0;
+        {
+            std::unique_lock lock(subscription.mutex_);
+            if (subscription.closed_)
+                return nlohmann::json::object();
+
+            // Forget sent tiles which left the viewport, so they
+            // are sent again if they come back into view.
+            for (auto& [layerKey, sentTiles] : subscription.sent_) {
+                auto const& wantedTiles = wanted[layerKey];
+                std::erase_if(sentTiles, [&](auto tileId) { return !wantedTiles.count(tileId); });
+            }
+            subscription.wanted_ = wanted;
+
+            // Keep pending requests unless some of their unsent tiles left the viewport.
+            std::map<LayerKey, std::set<uint64_t>> pending;
+            std::erase_if(subscription.requests_, [](auto const& r) { return r->isDone(); });
+            std::erase_if(
+                subscription.requests_,
+                [&](auto const& r)
+                {
+                    LayerKey layerKey{r->mapId_, r->layerId_};
+                    auto const& sentTiles = subscription.sent_[layerKey];
+                    auto const& wantedTiles = wanted[layerKey];
+                    std::vector<uint64_t> unsent;
+                    size_t numLeft = 0;
+                    for (auto const& tileId : r->tiles_) {
+                        if (sentTiles.count(tileId.value_))
+                            continue;
+                        unsent.push_back(tileId.value_);
+                        if (!wantedTiles.count(tileId.value_))
+                            ++numLeft;
+                    }
+                    if (numLeft) {
+                        numCancelledTiles += numLeft;
+                        toAbort.push_back(r);
+                        return true;
+                    }
+                    pending[layerKey].insert(unsent.begin(), unsent.end());
+                    return false;
+                });
+
+            // Request the tiles which are neither sent nor pending.
+            for (auto const& [layerKey, tileIds] : viewport) {
+                auto const& sentTiles = subscription.sent_[layerKey];
+                auto& pendingTiles = pending[layerKey];
+                std::vector<TileId> missing;
+                for (auto const& tileId : tileIds) {
+                    if (!sentTiles.count(tileId) && pendingTiles.insert(tileId).second)
+                        missing.emplace_back(tileId);
+                }
+                if (missing.empty())
+                    continue;
+                auto request = std::make_shared<LayerTilesRequest>(layerKey.first, layerKey.second, std::move(missing));
+                request->clientId_ = subscription.identity_;
+                request->onFeatureLayer([weakSubscription](auto&& layer) {
+                    if (auto s = weakSubscription.lock())
+                        s->addResult(layer);
+                });
+                request->onSourceDataLayer([weakSubscription](auto&& layer) {
+                    if (auto s = weakSubscription.lock())
+                        s->addResult(layer);
+                });
+                subscription.requests_.push_back(request);
+                toRequest.push_back(std::move(request));
+            }
+        }
+
+        // Abort and request outside of the lock, since results
+        // may be delivered to the subscription right away.
+        for (auto const& request : toAbort)
+            self_.abort(request);
+        size_t numRequestedTiles = 0;
+        auto requestStatuses = nlohmann::json::array();
+        for (auto const& request : toRequest) {
+            numRequestedTiles += request->tiles_.size();
+            self_.request({request}, authHeaders);
+            requestStatuses.push_back(static_cast<std::underlying_type_t<RequestStatus>>(request->getStatus()));
+        }
+
+        return nlohmann::json::object({
+            {"requestedTiles", numRequestedTiles},
+            {"cancelledTiles", numCancelledTiles},
+            {"requestStatuses", requestStatuses}});
+    }
+
+    void handleSubscribeUpdateRequest(const httplib::Request& req, httplib::Response& res) const
+    {
+        // Parse the JSON request.
+        nlohmann::json j = nlohmann::json::parse(req.body);
+        auto subscription = j.contains("clientId") ?
+            this->subscription(clientRequestKey(clientIdentity(req), j["clientId"].get<std::string>())) :
+            nullptr;
+        if (!subscription) {
+            res.status = 404;
+            res.set_content("No viewport subscription for this clientId", "text/plain");
+            return;
+        }
+
+        // The new viewport is admitted in place of the previous one.
+        auto requestsJson = j.value("requests", nlohmann::json::array());
+        std::shared_ptr<Admission> previous;
+        {
+            std::unique_lock lock(subscription->mutex_);
+            previous = subscription->admission_;
+        }
+        auto admission = admitOrReject(res, subscription->identity_, numViewportTiles(requestsJson), previous);
+        if (!admission)
+            return;
+        {
+            std::unique_lock lock(subscription->mutex_);
+            if (!subscription->closed_)
+                subscription->admission_.swap(admission);
+        }
+        if (admission)
+            admission->release();
+
+        auto result = updateSubscription(subscription, requestsJson, AuthHeaders{req.headers.begin(), req.headers.end()});
+        res.set_content(result.dump(), "application/json");
+    }
+
     void handleAbortRequest(const httplib::Request& req, httplib::Response& res) const
     {
         // Parse the JSON request.
         nlohmann::json j = nlohmann::json::parse(req.body);
         if (j.contains("clientId")) {
             auto const clientId = j["clientId"].get<std::string>();
-            abortRequestsForClientId(clientId);
+            auto const key = clientRequestKey(clientIdentity(req), clientId);
+            abortRequestsForClientId(key);
+            closeSubscription(key);
         }
         else {
             res.status = 400;
@@ -412,10 +1905,209 @@ struct HttpService::Impl
         oss << "<h2>Cache Statistics</h2>";
         oss << "<pre>" << cacheStats.dump(4) << "</pre>";  // Indentation of 4 for pretty printing
 
+        // Output response compression stats
+        auto uncompressed = responseBytesUncompressed_.load();
+        auto sent = responseBytesSent_.load();
+        auto responseStats = nlohmann::json::object({
+            {"supported-encodings", std::string(ResponseCompressor::supportedEncodings())},
+            {"compression-level", responseCompressionLevel_},
+            {"bytes-uncompressed", uncompressed},
+            {"bytes-sent", sent},
+            {"compression-ratio", sent ? static_cast<double>(uncompressed) / static_cast<double>(sent) : 0.},
+            {"max-buffer-bytes-per-response", maxResponseBufferBytes_.load()}});
+        oss << "<h2>Response Statistics</h2>";
+        oss << "<pre>" << responseStats.dump(4) << "</pre>";
+
         oss << "</body></html>";
         res.set_content(oss.str(), "text/html");
     }
 
+    [[nodiscard]] bool sampleTrace() const
+    {
+        auto rate = traceSampleRate_.load();
+        if (rate <= 0.)
+            return false;
+        thread_local std::mt19937 generator{std::random_device{}()};
+        return std::uniform_real_distribution<double>(0., 1.)(generator) < rate;
+    }
+
+    void retainTrace(Trace::Ptr const& trace) const
+    {
+        std::unique_lock lock(traceMutex_);
+        traces_.push_back(trace);
+        if (traces_.size() > maxRetainedTraces)
+            traces_.pop_front();
+    }
+
+    void handleTracesRequest(const httplib::Request&, httplib::Response& res) const
+    {
+        std::vector<Trace::Ptr> traces;
+        {
+            std::unique_lock lock(traceMutex_);
+            traces.assign(traces_.begin(), traces_.end());
+        }
+        res.set_content(Trace::toChromeJson(traces), "application/json");
+    }
+
+    void handleMetricsRequest(const httplib::Request&, httplib::Response& res) const
+    {
+        res.set_content(Metrics::get().toPrometheusText(), "text/plain; version=0.0.4; charset=utf-8");
+    }
+
+    /**
+     * Check whether an If-None-Match header value matches the given ETag.
+     * If-None-Match uses the weak comparison, so W/ prefixes are ignored.
+     */
+    static bool etagMatches(std::string const& ifNoneMatch, std::string_view etag)
+    {
+        if (etag.starts_with("W/"))
+            etag.remove_prefix(2);
+        std::istringstream tokens(ifNoneMatch);
+        std::string token;
+        while (std::getline(tokens, token, ',')) {
+            auto begin = token.find_first_not_of(" \t");
+            if (begin == std::string::npos)
+                continue;
+            auto end = token.find_last_not_of(" \t");
+            auto candidate = std::string_view(token).substr(begin, end - begin + 1);
+            if (candidate.starts_with("W/"))
+                candidate.remove_prefix(2);
+            if (candidate == "*" || candidate == etag)
+                return true;
+        }
+        return false;
+    }
+
+    /**
+     * Serve a single tile layer for GET /tile/{map}/{layer}/{tileId}. Unlike
+     * /tiles responses, the tile is self-contained, i.e. it carries its full
+     * string pool, so it can be stored by HTTP caches like nginx or Varnish.
+     * The ETag of a feature layer is weak, as it is derived from the features
+     * only, while that of other layers is derived from the encoded tile.
+     * Cache-Control is derived from the tile's TTL. A matching If-None-Match
+     * header is answered with 304. The tile id is a mapget TileId, and an MVT
+     * is encoded in its geographic grid, not as a Web Mercator tile.
+     */
+    void handleTileRequest(const httplib::Request& req, httplib::Response& res) const
+    {
+        auto mapId = req.matches[1].str();
+        auto layerId = req.matches[2].str();
+        auto tileIdStr = req.matches[3].str();
+        uint64_t tileIdValue = 0;
+        auto [tileIdEnd, tileIdError] =
+            std::from_chars(tileIdStr.data(), tileIdStr.data() + tileIdStr.size(), tileIdValue);
+        if (tileIdError != std::errc() || tileIdEnd != tileIdStr.data() + tileIdStr.size()) {
+            res.status = 400;
+            res.set_content(fmt::format("Invalid tile id {}.", tileIdStr), "text/plain");
+            return;
+        }
+        auto tileId = TileId(tileIdValue);
+
+        // Determine the response type. Unlike /tiles, any Accept
+        // header is allowed, and the binary stream is the default.
+        auto accept = req.get_header_value("Accept");
+        std::string responseType = HttpTilesRequestState::binaryMimeType;
+        if (accept.find(HttpTilesRequestState::mvtMimeType) != std::string::npos)
+            responseType = HttpTilesRequestState::mvtMimeType;
+        else if (accept.find("application/json") != std::string::npos)
+            responseType = "application/json";
+
+        // Fetch the tile through the service, so it is cached like any other.
+        // The admission is held until the tile is delivered.
+        auto identity = clientIdentity(req);
+        auto admission = admitOrReject(res, identity, 1);
+        if (!admission)
+            return;
+        auto request = std::make_shared<LayerTilesRequest>(mapId, layerId, std::vector<TileId>{tileId});
+        request->clientId_ = identity;
+        auto result = std::make_shared<TileLayer::Ptr>();
+        request->onFeatureLayer([result](auto&& layer) { *result = layer; });
+        request->onSourceDataLayer([result](auto&& layer) { *result = layer; });
+        if (!self_.request({request}, AuthHeaders{req.headers.begin(), req.headers.end()})) {
+            res.status = request->getStatus() == RequestStatus::Unauthorized ? 403 : 404;
+            res.set_content(fmt::format("Layer {}/{} is not available.", mapId, layerId), "text/plain");
+            return;
+        }
+        if (!request->wait(tileRequestTimeout)) {
+            self_.abort(request);
+            res.status = 504;  // Gateway Timeout.
+            res.set_content(fmt::format("Tile {} was not delivered in time.", tileId.value_), "text/plain");
+            return;
+        }
+        auto layer = *result;
+        if (!layer && request->getSkippedTileCount()) {
+            res.status = 404;
+            res.set_content(
+                fmt::format("Tile {} is outside the zoom levels or coverage of {}/{}.", tileId.value_, mapId, layerId),
+                "text/plain");
+            return;
+        }
+        if (!layer) {
+            res.status = 503;  // Service Unavailable.
+            res.set_content(fmt::format("Tile {} was not delivered.", tileId.value_), "text/plain");
+            return;
+        }
+        auto featureLayer = std::dynamic_pointer_cast<TileFeatureLayer>(layer);
+        if (responseType == HttpTilesRequestState::mvtMimeType && !featureLayer) {
+            res.status = 406;  // Not Acceptable.
+            res.set_content("Only feature layers can be encoded as MVT.", "text/plain");
+            return;
+        }
+
+        // Tiles with an error must not be stored, as they would shadow a
+        // later successful fill. Others may be stored until they expire.
+        std::string cacheControl = "public, no-cache";
+        if (layer->error())
+            cacheControl = "no-store";
+        else if (auto ttl = layer->ttl()) {
+            auto remaining = std::chrono::duration_cast<std::chrono::seconds>(
+                layer->timestamp() + *ttl - std::chrono::system_clock::now());
+            cacheControl = fmt::format("public, max-age={}", std::max<int64_t>(remaining.count(), 0));
+        }
+        res.set_header("Cache-Control", cacheControl);
+        res.set_header("Vary", "Accept");
+
+        // For feature layers, the ETag is computed from the content hash before
+        // serialization, so a tile which is refilled with the same features keeps
+        // its ETag, and a revalidation is answered without encoding the tile.
+        // The ETag is weak, as the timestamp, TTL or error of such a tile may
+        // differ. The content hash is cached per tile version.
+        std::string etag;
+        if (featureLayer) {
+            auto format = responseType == HttpTilesRequestState::binaryMimeType ?
+                fmt::format("bin-{}", TileLayerStream::CurrentProtocolVersion.toString()) :
+                responseType == HttpTilesRequestState::mvtMimeType ? std::string("mvt") : std::string("json");
+            etag = fmt::format("W/\"{:016x}-{}\"", contentHashes_->get(*featureLayer), format);
+            res.set_header("ETag", etag);
+            if (etagMatches(req.get_header_value("If-None-Match"), etag)) {
+                res.status = 304;  // Not Modified.
+                return;
+            }
+        }
+
+        std::string content;
+        if (responseType == HttpTilesRequestState::binaryMimeType) {
+            // Without differential string updates, the whole string pool is written.
+            TileLayerStream::StringPoolOffsetMap stringOffsets;
+            TileLayerStream::Writer writer{content, stringOffsets, false};
+            writer.write(layer);
+        }
+        else if (responseType == HttpTilesRequestState::mvtMimeType)
+            content = featureLayer->toMvt();
+        else
+            layer->writeJson(content);
+
+        if (etag.empty()) {
+            etag = fmt::format("\"{}\"", stringToHash(content).substr(0, 16));
+            res.set_header("ETag", etag);
+            if (etagMatches(req.get_header_value("If-None-Match"), etag)) {
+                res.status = 304;  // Not Modified.
+                return;
+            }
+        }
+        res.set_content(std::move(content), responseType);
+    }
+
     void handleLocateRequest(const httplib::Request& req, httplib::Response& res) const
     {
         // Parse the JSON request.
@@ -637,6 +2329,32 @@ HttpService::HttpService(Cache::Ptr cache, bool watchConfig)
 
 HttpService::~HttpService() = default;
 
+void HttpService::setResponseCompressionLevel(int level)
+{
+    impl_->responseCompressionLevel_ = level;
+}
+
+void HttpService::setMaxResponseBuffer(size_t bytes)
+{
+    impl_->maxResponseBufferBytes_ = bytes;
+}
+
+void HttpService::setClientLimits(size_t maxRequests, size_t maxTiles)
+{
+    impl_->maxRequestsPerClient_ = maxRequests;
+    impl_->maxTilesPerClient_ = maxTiles;
+}
+
+void HttpService::setClientAddressHeader(std::string header)
+{
+    impl_->clientAddressHeader_ = std::move(header);
+}
+
+void HttpService::setTraceSampleRate(double rate)
+{
+    impl_->traceSampleRate_ = std::clamp(rate, 0., 1.);
+}
+
 void HttpService::setup(httplib::Server& server)
 {
     server.Post(
@@ -644,6 +2362,26 @@ void HttpService::setup(httplib::Server& server)
         [&](const httplib::Request& req, httplib::Response& res)
         { impl_->handleTilesRequest(req, res); });
 
+    server.Get(
+        R"(/tile/([^/]+)/([^/]+)/(\d+))",
+        [this](const httplib::Request& req, httplib::Response& res)
+        { impl_->handleTileRequest(req, res); });
+
+    server.Post(
+        "/search",
+        [this](const httplib::Request& req, httplib::Response& res)
+        { impl_->handleSearchRequest(req, res); });
+
+    server.Post(
+        "/subscribe",
+        [this](const httplib::Request& req, httplib::Response& res)
+        { impl_->handleSubscribeRequest(req, res); });
+
+    server.Post(
+        "/subscribe/update",
+        [this](const httplib::Request& req, httplib::Response& res)
+        { impl_->handleSubscribeUpdateRequest(req, res); });
+
     server.Post(
         "/abort",
         [&](const httplib::Request& req, httplib::Response& res)
@@ -659,6 +2397,16 @@ void HttpService::setup(httplib::Server& server)
         [this](const httplib::Request& req, httplib::Response& res)
         { impl_->handleStatusRequest(req, res); });
 
+    server.Get(
+        "/traces",
+        [this](const httplib::Request& req, httplib::Response& res)
+        { impl_->handleTracesRequest(req, res); });
+
+    server.Get(
+        "/metrics",
+        [this](const httplib::Request& req, httplib::Response& res)
+        { impl_->handleMetricsRequest(req, res); });
+
     server.Post(
         "/locate",
         [this](const httplib::Request& req, httplib::Response& res)
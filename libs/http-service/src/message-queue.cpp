@@ -0,0 +1,44 @@
+#include "message-queue.h"
+
+#include <algorithm>
+
+namespace mapget
+{
+
+MessageQueue::~MessageQueue()
+{
+    auto node = head_.exchange(nullptr);
+    while (node) {
+        auto next = node->next_;
+        delete node;
+        node = next;
+    }
+}
+
+void MessageQueue::push(std::string message)
+{
+    auto node = new Node{std::move(message), head_.load(std::memory_order_relaxed)};
+    while (!head_.compare_exchange_weak(node->next_, node, std::memory_order_release, std::memory_order_relaxed));
+    notify();
+}
+
+void MessageQueue::drain(std::vector<std::string>& out)
+{
+    auto node = head_.exchange(nullptr, std::memory_order_acquire);
+    auto first = out.size();
+    while (node) {
+        out.emplace_back(std::move(node->message_));
+        auto next = node->next_;
+        delete node;
+        node = next;
+    }
+    std::reverse(out.begin() + static_cast<std::ptrdiff_t>(first), out.end());
+}
+
+void MessageQueue::notify()
+{
+    events_.fetch_add(1);
+    events_.notify_all();
+}
+
+}  // namespace mapget
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace mapget
+{
+
+/**
+ * Multi-producer single-consumer queue of serialized response messages.
+ * Worker threads push their messages, and the HTTP streaming thread drains
+ * them in push order. Both sides are lock-free: Messages are moved into the
+ * queue and out of it, so their bytes are never copied.
+ *
+ * The consumer waits for new messages with wait(), using the event count
+ * which it read before draining the queue, so no wake-up can be lost.
+ */
+class MessageQueue
+{
+public:
+    MessageQueue() = default;
+    ~MessageQueue();
+    MessageQueue(MessageQueue const&) = delete;
+    MessageQueue& operator=(MessageQueue const&) = delete;
+
+    /** Append a message, and wake up the consumer. */
+    void push(std::string message);
+
+    /** Move all queued messages to the end of out, oldest first. */
+    void drain(std::vector<std::string>& out);
+
+    /** Wake up the consumer without a message, e.g. when a request is done. */
+    void notify();
+
+    /** Get the number of pushes and notifications so far. */
+    [[nodiscard]] uint64_t events() const { return events_.load(); }
+
+    /** Block until the event count differs from the given one. */
+    void wait(uint64_t seenEvents) const { events_.wait(seenEvents); }
+
+private:
+    struct Node
+    {
+        std::string message_;
+        Node* next_ = nullptr;
+    };
+
+    // Most recently pushed message. The consumer takes the whole
+    // list at once, and reverses it to restore the push order.
+    std::atomic<Node*> head_{nullptr};
+    std::atomic_uint64_t events_{0};
+};
+
+}  // namespace mapget
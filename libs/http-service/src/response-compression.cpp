@@ -0,0 +1,158 @@
+#include "response-compression.h"
+#include "mapget/log.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <optional>
+#include <ranges>
+
+#include <zstd.h>
+#ifdef MAPGET_WITH_ZLIB
+#include <zlib.h>
+#endif
+
+namespace mapget
+{
+
+namespace
+{
+
+class ZstdCompressor : public ResponseCompressor
+{
+public:
+    explicit ZstdCompressor(int level) : ctx_(ZSTD_createCCtx())
+    {
+        if (!ctx_)
+            raise("Failed to create zstd compression context.");
+        level = level ? std::clamp(level, 1, ZSTD_maxCLevel()) : ZSTD_CLEVEL_DEFAULT;
+        ZSTD_CCtx_setParameter(ctx_, ZSTD_c_compressionLevel, level);
+    }
+
+    ~ZstdCompressor() override { ZSTD_freeCCtx(ctx_); }
+
+    [[nodiscard]] std::string_view encoding() const override { return "zstd"; }
+
+    void compress(std::string_view input, std::string& out) override { run(input, ZSTD_e_flush, out); }
+
+    void finish(std::string& out) override { run({}, ZSTD_e_end, out); }
+
+private:
+    void run(std::string_view input, ZSTD_EndDirective mode, std::string& out)
+    {
+        ZSTD_inBuffer in{input.data(), input.size(), 0};
+        size_t remaining = 0;
+        do {
+            auto offset = out.size();
+            out.resize(offset + ZSTD_CStreamOutSize());
+            ZSTD_outBuffer outBuffer{out.data() + offset, out.size() - offset, 0};
+            remaining = ZSTD_compressStream2(ctx_, &outBuffer, &in, mode);
+            out.resize(offset + outBuffer.pos);
+            if (ZSTD_isError(remaining))
+                raiseFmt("zstd response compression failed: {}", ZSTD_getErrorName(remaining));
+        } while (remaining != 0 || in.pos < in.size);
+    }
+
+    ZSTD_CCtx* ctx_;
+};
+
+#ifdef MAPGET_WITH_ZLIB
+class GzipCompressor : public ResponseCompressor
+{
+public:
+    explicit GzipCompressor(int level)
+    {
+        level = level ? std::clamp(level, 1, 9) : Z_DEFAULT_COMPRESSION;
+        // Window bits above 15 select the gzip container format.
+        if (deflateInit2(&stream_, level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+            raise("Failed to initialize gzip compression.");
+    }
+
+    ~GzipCompressor() override { deflateEnd(&stream_); }
+
+    [[nodiscard]] std::string_view encoding() const override { return "gzip"; }
+
+    void compress(std::string_view input, std::string& out) override { run(input, Z_SYNC_FLUSH, out); }
+
+    void finish(std::string& out) override { run({}, Z_FINISH, out); }
+
+private:
+    void run(std::string_view input, int flush, std::string& out)
+    {
+        constexpr size_t chunkSize = 1 << 16;
+        stream_.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(input.data()));
+        stream_.avail_in = static_cast<uInt>(input.size());
+        do {
+            auto offset = out.size();
+            out.resize(offset + chunkSize);
+            stream_.next_out = reinterpret_cast<Bytef*>(out.data() + offset);
+            stream_.avail_out = chunkSize;
+            auto result = deflate(&stream_, flush);
+            out.resize(offset + chunkSize - stream_.avail_out);
+            if (result == Z_STREAM_ERROR)
+                raise("gzip response compression failed.");
+        } while (stream_.avail_out == 0);
+    }
+
+    z_stream stream_{};
+};
+#endif
+
+std::string_view trim(std::string_view s)
+{
+    auto begin = s.find_first_not_of(" \t");
+    if (begin == std::string_view::npos)
+        return {};
+    auto end = s.find_last_not_of(" \t");
+    return s.substr(begin, end - begin + 1);
+}
+
+/**
+ * Check whether the Accept-Encoding value accepts the given encoding,
+ * either by name or by wildcard, with a non-zero quality value. An entry
+ * for the encoding takes precedence over the wildcard, regardless of their
+ * order, so e.g. `*, zstd;q=0` does not accept zstd.
+ */
+bool accepts(std::string_view acceptEncoding, std::string_view encoding)
+{
+    std::optional<bool> byName;
+    std::optional<bool> byWildcard;
+    for (auto entryRange : acceptEncoding | std::views::split(',')) {
+        auto entry = trim(std::string_view(entryRange.begin(), entryRange.end()));
+        auto paramsStart = entry.find(';');
+        auto name = trim(entry.substr(0, paramsStart));
+        if (name != encoding && name != "*")
+            continue;
+        auto accepted = true;
+        if (paramsStart != std::string_view::npos) {
+            auto params = entry.substr(paramsStart + 1);
+            if (auto qPos = params.find("q="); qPos != std::string_view::npos)
+                accepted = std::strtod(std::string(params.substr(qPos + 2)).c_str(), nullptr) > 0.;
+        }
+        (name == encoding ? byName : byWildcard) = accepted;
+    }
+    return byName.value_or(byWildcard.value_or(false));
+}
+
+}  // namespace
+
+std::string_view ResponseCompressor::supportedEncodings()
+{
+#ifdef MAPGET_WITH_ZLIB
+    return "zstd, gzip";
+#else
+    return "zstd";
+#endif
+}
+
+std::unique_ptr<ResponseCompressor> ResponseCompressor::fromAcceptEncoding(std::string_view acceptEncoding, int level)
+{
+    if (accepts(acceptEncoding, "zstd"))
+        return std::make_unique<ZstdCompressor>(level);
+#ifdef MAPGET_WITH_ZLIB
+    if (accepts(acceptEncoding, "gzip"))
+        return std::make_unique<GzipCompressor>(level);
+#endif
+    return nullptr;
+}
+
+}  // namespace mapget
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <string_view>
+
+namespace mapget
+{
+
+/**
+ * Streaming compressor for HTTP response bodies. Each call to compress()
+ * flushes its output, so the client can decode everything which was sent
+ * so far. This keeps the latency of streamed tile responses low.
+ */
+class ResponseCompressor
+{
+public:
+    virtual ~ResponseCompressor() = default;
+
+    /**
+     * Create a compressor for the preferred supported encoding which
+     * is accepted according to the given Accept-Encoding header value.
+     * Encodings are preferred in the order of supportedEncodings().
+     * Returns nullptr if the client accepts none of them.
+     * @param level Compression level, clamped to the range of the
+     *  chosen encoding. Zero selects the encoding's default level.
+     */
+    static std::unique_ptr<ResponseCompressor> fromAcceptEncoding(std::string_view acceptEncoding, int level);
+
+    /** Encodings which were available at build time, in order of preference. */
+    static std::string_view supportedEncodings();
+
+    /** Value of the Content-Encoding header, e.g. "zstd". */
+    [[nodiscard]] virtual std::string_view encoding() const = 0;
+
+    /** Compress and flush the given bytes, appending the output to out. */
+    virtual void compress(std::string_view input, std::string& out) = 0;
+
+    /** End the compressed stream, appending the remaining output to out. */
+    virtual void finish(std::string& out) = 0;
+};
+
+}  // namespace mapget
@@ -0,0 +1,134 @@
+#pragma once
+
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace mapget
+{
+
+/**
+ * Span recorder for a single traced operation, e.g. one /tiles request.
+ * The recorded spans can be exported in Chrome's trace event JSON format,
+ * which can be opened in chrome://tracing or https://ui.perfetto.dev.
+ *
+ * Code paths which may be part of a traced operation open spans on the
+ * calling thread's current trace (see Trace::Scope and Trace::currentSpan()).
+ * If no trace is current, opening a span only costs a thread-local lookup.
+ */
+class Trace
+{
+public:
+    using Ptr = std::shared_ptr<Trace>;
+    using Clock = std::chrono::steady_clock;
+
+    /**
+     * A span which is recorded when it is destroyed. A default-constructed
+     * span is inactive, and does not record anything.
+     */
+    class Span
+    {
+    public:
+        Span() = default;
+        Span(Trace* trace, std::string_view name, std::string detail = {});
+        Span(Span&& other) noexcept;
+        Span& operator=(Span&& other) noexcept;
+        ~Span();
+
+        /** Record the span now, instead of on destruction. */
+        void end();
+
+    private:
+        Trace* trace_ = nullptr;
+        std::string_view name_;
+        std::string detail_;
+        Clock::time_point begin_;
+    };
+
+    /**
+     * Makes a trace the current trace of the calling thread while
+     * the scope exists. Scopes may be nested. A null trace suspends
+     * tracing for the scope.
+     */
+    class Scope
+    {
+    public:
+        explicit Scope(Trace* trace);
+        explicit Scope(Ptr const& trace) : Scope(trace.get()) {}
+        ~Scope();
+        Scope(Scope const&) = delete;
+        Scope& operator=(Scope const&) = delete;
+
+    private:
+        Trace* previous_;
+    };
+
+    /** Construct a trace. The name labels its spans in the exported JSON. */
+    explicit Trace(std::string name);
+
+    /** Get the trace's name. */
+    [[nodiscard]] std::string const& name() const { return name_; }
+
+    /**
+     * Open a span on this trace. The name must be a string literal,
+     * or otherwise outlive the trace. The optional detail, e.g. a tile key,
+     * is shown in the span's arguments.
+     */
+    [[nodiscard]] Span span(std::string_view name, std::string detail = {});
+
+    /** Record a span which has already ended, e.g. the time a tile was queued. */
+    void addSpan(std::string_view name, Clock::time_point begin, Clock::time_point end, std::string detail = {});
+
+    /** Get the current trace of the calling thread, or null. */
+    static Trace* current();
+
+    /** Open a span on the current trace. Inactive if there is no current trace. */
+    [[nodiscard]] static Span currentSpan(std::string_view name)
+    {
+        if (auto trace = current())
+            return trace->span(name);
+        return {};
+    }
+
+    /**
+     * Open a span on the current trace. The detail string is
+     * only computed if there is a current trace.
+     */
+    template <class DetailFun>
+    [[nodiscard]] static Span currentSpan(std::string_view name, DetailFun&& detail)
+    {
+        if (auto trace = current())
+            return trace->span(name, detail());
+        return {};
+    }
+
+    /** Export this trace in Chrome's trace event JSON format. */
+    [[nodiscard]] std::string toChromeJson() const;
+
+    /**
+     * Export several traces into one Chrome trace JSON document.
+     * Each trace is shown as a separate process.
+     */
+    [[nodiscard]] static std::string toChromeJson(std::vector<Ptr> const& traces);
+
+private:
+    struct Event
+    {
+        std::string_view name_;
+        std::string detail_;
+        Clock::time_point begin_;
+        Clock::time_point end_;
+        uint32_t threadId_;
+    };
+
+    void appendEvents(std::string& out, uint32_t processId) const;
+
+    std::string name_;
+    mutable std::mutex mutex_;
+    std::vector<Event> events_;
+};
+
+}  // namespace mapget
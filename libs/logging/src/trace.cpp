@@ -0,0 +1,175 @@
+#include "mapget/trace.h"
+
+#include "fmt/format.h"
+
+#include <atomic>
+
+namespace mapget
+{
+
+namespace
+{
+
+thread_local Trace* currentTrace = nullptr;
+
+/** Small sequential id of the calling thread, which is more readable than a native handle. */
+uint32_t traceThreadId()
+{
+    static std::atomic_uint32_t nextThreadId{1};
+    thread_local uint32_t threadId = nextThreadId++;
+    return threadId;
+}
+
+/** Timestamps are exported relative to the construction of the first trace. */
+Trace::Clock::time_point traceStart()
+{
+    static auto const start = Trace::Clock::now();
+    return start;
+}
+
+double microsecondsSinceStart(Trace::Clock::time_point t)
+{
+    return std::chrono::duration<double, std::micro>(t - traceStart()).count();
+}
+
+void appendJsonString(std::string& out, std::string_view s)
+{
+    out += '"';
+    for (auto c : s) {
+        switch (c) {
+        case '"': out += "\\\""; break;
+        case '\\': out += "\\\\"; break;
+        case '\n': out += "\\n"; break;
+        case '\r': out += "\\r"; break;
+        case '\t': out += "\\t"; break;
+        default:
+            if (static_cast<unsigned char>(c) < 0x20)
+                out += fmt::format("\\u{:04x}", static_cast<int>(c));
+            else
+                out += c;
+        }
+    }
+    out += '"';
+}
+
+}  // namespace
+
+Trace::Span::Span(Trace* trace, std::string_view name, std::string detail)
+    : trace_(trace), name_(name), detail_(std::move(detail)), begin_(Clock::now())
+{
+}
+
+Trace::Span::Span(Span&& other) noexcept
+    : trace_(other.trace_), name_(other.name_), detail_(std::move(other.detail_)), begin_(other.begin_)
+{
+    other.trace_ = nullptr;
+}
+
+Trace::Span& Trace::Span::operator=(Span&& other) noexcept
+{
+    if (this != &other) {
+        end();
+        trace_ = other.trace_;
+        name_ = other.name_;
+        detail_ = std::move(other.detail_);
+        begin_ = other.begin_;
+        other.trace_ = nullptr;
+    }
+    return *this;
+}
+
+Trace::Span::~Span()
+{
+    end();
+}
+
+void Trace::Span::end()
+{
+    if (!trace_)
+        return;
+    trace_->addSpan(name_, begin_, Clock::now(), std::move(detail_));
+    trace_ = nullptr;
+}
+
+Trace::Scope::Scope(Trace* trace) : previous_(currentTrace)
+{
+    currentTrace = trace;
+}
+
+Trace::Scope::~Scope()
+{
+    currentTrace = previous_;
+}
+
+Trace::Trace(std::string name) : name_(std::move(name))
+{
+    traceStart();
+}
+
+Trace::Span Trace::span(std::string_view name, std::string detail)
+{
+    return {this, name, std::move(detail)};
+}
+
+void Trace::addSpan(std::string_view name, Clock::time_point begin, Clock::time_point end, std::string detail)
+{
+    auto threadId = traceThreadId();
+    std::unique_lock lock(mutex_);
+    events_.push_back({name, std::move(detail), begin, end, threadId});
+}
+
+Trace* Trace::current()
+{
+    return currentTrace;
+}
+
+void Trace::appendEvents(std::string& out, uint32_t processId) const
+{
+    // The process name metadata event labels the trace in the viewer.
+    out += fmt::format(R"({{"name":"process_name","ph":"M","pid":{},"args":{{"name":)", processId);
+    appendJsonString(out, name_);
+    out += "}}";
+
+    std::unique_lock lock(mutex_);
+    for (auto const& event : events_) {
+        out += R"(,{"name":)";
+        appendJsonString(out, event.name_);
+        out += fmt::format(
+            R"(,"cat":"mapget","ph":"X","ts":{:.3f},"dur":{:.3f},"pid":{},"tid":{})",
+            microsecondsSinceStart(event.begin_),
+            std::chrono::duration<double, std::micro>(event.end_ - event.begin_).count(),
+            processId,
+            event.threadId_);
+        if (!event.detail_.empty()) {
+            out += R"(,"args":{"detail":)";
+            appendJsonString(out, event.detail_);
+            out += '}';
+        }
+        out += '}';
+    }
+}
+
+std::string Trace::toChromeJson() const
+{
+    std::string result = R"({"traceEvents":[)";
+    appendEvents(result, 1);
+    result += R"(],"displayTimeUnit":"ms"})";
+    return result;
+}
+
+std::string Trace::toChromeJson(std::vector<Ptr> const& traces)
+{
+    std::string result = R"({"traceEvents":[)";
+    uint32_t processId = 0;
+    for (auto const& trace : traces) {
+        if (!trace)
+            continue;
+        if (processId)
+            result += ',';
+        trace->appendEvents(result, ++processId);
+    }
+    result += R"(],"displayTimeUnit":"ms"})";
+    return result;
+}
+
+}  // namespace mapget
@@ -1,7 +1,10 @@
 #pragma once
 
+#include <limits>
+#include <optional>
 #include <span>
 #include <string_view>
+#include <vector>
 
 #include "tl/expected.hpp"
 
@@ -79,11 +82,14 @@ public:
      *  a layerInfo object for the layer name stored for the tile.
      * @param stringPoolGetter Function which will be called to retrieve
      *  a string pool for the node name of the tile.
+     * @param quantized Whether the layer was written with a vertex precision,
+     *  as indicated by the TileLayerStream::QuantizedMessageFlag.
      */
     TileFeatureLayer(
         std::istream& inputStream,
         LayerInfoResolveFun const& layerInfoResolveFun,
-        StringPoolResolveFun const& stringPoolGetter
+        StringPoolResolveFun const& stringPoolGetter,
+        bool quantized = false
     );
 
     /**
@@ -208,6 +214,33 @@ public:
     /** Convert to (Geo-) JSON. */
     nlohmann::json toJson() const override;
 
+    /**
+     * Write the (Geo-) JSON feature collection directly into the given
+     * string, walking the feature model. Yields the same JSON as toJson(),
+     * but is much faster for dense tiles, as no DOM is allocated.
+     */
+    void writeJson(std::string& out) const override;
+
+    /**
+     * Encode the features as a Mapbox Vector Tile (specification 2.1) with
+     * a single layer named after the layer id. Geometries are projected into
+     * the tile extent, clipped to the tile plus the given buffer, and
+     * quantized. Lines are split where they leave the clip area, and mesh
+     * triangles become polygons. The feature id, id parts and attributes
+     * are flattened into MVT properties with dot-separated keys. A feature
+     * with points, lines and polygons is split into one MVT feature per
+     * geometry type. The MVT feature id is 3 * i + (type - 1), with i being
+     * the feature's index in this layer and type the MVT geometry type, so
+     * the parts of a feature have distinct ids.
+     *
+     * Note: The tile is not a Web Mercator (z/x/y) tile, but a tile of
+     * mapget's geographic grid (see TileId), with 2^(z+1) columns and 2^z
+     * rows. Longitude and latitude are mapped linearly onto the extent, so
+     * a renderer must place the tile at its TileId bounds in WGS84 (i.e.
+     * use an equirectangular projection), not at a Web Mercator tile.
+     */
+    [[nodiscard]] std::string toMvt(uint32_t extent = 4096, uint32_t buffer = 64) const;
+
     /** Access number of stored features */
     size_t size() const;
 
@@ -222,6 +255,100 @@ public:
     /** Shared pointer type */
     using Ptr = std::shared_ptr<TileFeatureLayer>;
 
+    /**
+     * Pairs of feature id hash and feature content hash, sorted by id hash.
+     * The id hash is the one which is used by find(). The content hash
+     * covers the feature's id, attributes and relations, and its
+     * geometries as quantized by Geometry::getHash().
+     */
+    using FeatureDigest = std::vector<std::pair<uint64_t, uint64_t>>;
+
+    /** Compute the digest of all features in this layer. */
+    [[nodiscard]] FeatureDigest featureDigest() const;
+
+    /**
+     * Hash which identifies the content version of this layer.
+     * Two layers with equal features have the same content hash.
+     */
+    [[nodiscard]] uint64_t contentHash() const;
+    [[nodiscard]] static uint64_t contentHash(FeatureDigest const& digest);
+
+    /**
+     * Information which is attached to a layer that only contains
+     * the difference between a base version of a tile and a newer one.
+     */
+    struct DeltaInfo
+    {
+        // Content hash of the tile version which the delta applies to.
+        uint64_t baseContentHash_ = 0;
+
+        // Id hashes of features which were removed from the base version.
+        std::vector<uint64_t> removedFeatureIdHashes_;
+
+        template <typename S>
+        void serialize(S& s)
+        {
+            s.value8b(baseContentHash_);
+            s.container8b(removedFeatureIdHashes_, std::numeric_limits<uint32_t>::max());
+        }
+    };
+
+    /**
+     * Create a delta layer which turns a previous version of this layer,
+     * described by its feature digest, into this layer. The delta contains
+     * copies of all added or modified features, and the id hashes of removed
+     * features. If nothing has changed, the delta layer is empty.
+     * The currentDigest may be passed if it was already computed for this layer.
+     */
+    TileFeatureLayer::Ptr deltaFrom(FeatureDigest const& baseDigest);
+    TileFeatureLayer::Ptr deltaFrom(FeatureDigest const& baseDigest, FeatureDigest const& currentDigest);
+
+    /**
+     * Apply this delta layer to the base version which it was created
+     * against. Returns the newer version as a complete layer.
+     * Throws if this is not a delta layer, or if the base does not match.
+     */
+    TileFeatureLayer::Ptr applyDelta(TileFeatureLayer::Ptr const& base);
+
+    /**
+     * Create a layer which contains copies of all features for which the
+     * given simfil query evaluates to true. The query is evaluated per
+     * feature in any-mode, using the compiled expression cache of this layer.
+     * Throws if the query cannot be compiled or evaluated.
+     */
+    TileFeatureLayer::Ptr filter(std::string_view query);
+
+    /**
+     * Check whether the given simfil query evaluates to true for a feature
+     * of this layer, in any-mode. Throws if the query cannot be compiled
+     * or evaluated.
+     */
+    bool matches(std::string_view query, Feature const& feature);
+
+    /**
+     * Compile the given simfil query like filter() does, without a layer to
+     * evaluate it on, e.g. to reject a malformed filter before any tile is
+     * requested. Returns the compilation error, if there is one.
+     */
+    static tl::expected<void, simfil::Error> compileQuery(std::string_view query);
+
+    /**
+     * Quantize vertices when this layer is serialized. Vertex offsets are then
+     * stored as integer multiples of the given precisions (in coordinate units),
+     * delta- and varint-encoded along each geometry, and z is dropped from
+     * geometries where it is zero everywhere. This shrinks line and polygon
+     * geometry considerably, at the cost of the given accuracy. E.g., an
+     * xyPrecision of 1e-7 keeps WGS84 positions accurate to about 1cm.
+     * An xyPrecision of zero keeps the lossless float encoding. The default
+     * is the LayerInfo::vertexPrecision_ of the layer.
+     */
+    void setVertexPrecision(double xyPrecision, double zPrecision = 1e-3);
+    [[nodiscard]] std::pair<double, double> vertexPrecision() const;
+
+    /** Get/Set the delta information. Only set for delta layers. */
+    [[nodiscard]] std::optional<DeltaInfo> const& deltaInfo() const;
+    void setDeltaInfo(DeltaInfo info);
+
     /**
      * Evaluate a (potentially cached) simfil query on this pool
      *
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <limits>
+#include <type_traits>
+
+#include <bitsery/bitsery.h>
+#include "sfl/segmented_vector.hpp"
+
+namespace bitsery
+{
+
+namespace ext
+{
+
+/**
+ * Serializes a segmented_vector column, whose elements are stored in memory
+ * exactly as bitsery would encode them field by field, i.e. without padding
+ * and in little-endian byte order. The encoding is identical to s.container(),
+ * but each column page is copied from/to the stream buffer in a single call,
+ * instead of issuing one adapter call per element field. On big-endian hosts,
+ * the elements are (de-)serialized one by one.
+ */
+struct FlatColumnExt
+{
+    template <typename Ser, typename T, size_t N, typename Fnc>
+    void serialize(Ser& ser, sfl::segmented_vector<T, N> const& column, Fnc&&) const
+    {
+        static_assert(std::is_trivially_copyable_v<T>);
+        details::writeSize(ser.adapter(), column.size());
+        if constexpr (std::endian::native == std::endian::little) {
+            for (size_t i = 0; i < column.size(); i += N) {
+                auto count = std::min(N, column.size() - i);
+                ser.adapter().template writeBuffer<1>(reinterpret_cast<uint8_t const*>(&column[i]), count * sizeof(T));
+            }
+        }
+        else {
+            for (auto const& element : column)
+                ser.object(element);
+        }
+    }
+
+    template <typename Des, typename T, size_t N, typename Fnc>
+    void deserialize(Des& des, sfl::segmented_vector<T, N>& column, Fnc&&) const
+    {
+        static_assert(std::is_trivially_copyable_v<T>);
+        size_t size = 0;
+        details::readSize(des.adapter(), size, std::numeric_limits<uint32_t>::max(), std::true_type{});
+        column.resize(size);
+        if constexpr (std::endian::native == std::endian::little) {
+            for (size_t i = 0; i < size; i += N) {
+                auto count = std::min(N, size - i);
+                des.adapter().template readBuffer<1>(reinterpret_cast<uint8_t*>(&column[i]), count * sizeof(T));
+            }
+        }
+        else {
+            for (auto& element : column)
+                des.object(element);
+        }
+    }
+};
+
+
+}
+
+namespace traits
+{
+
+template <typename T>
+struct ExtensionTraits<ext::FlatColumnExt, T>
+{
+    using TValue = void;
+    static constexpr bool SupportValueOverload = false;
+    static constexpr bool SupportObjectOverload = false;
+    static constexpr bool SupportLambdaOverload = false;
+};
+
+}
+
+}
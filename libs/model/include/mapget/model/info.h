@@ -3,6 +3,7 @@
 #include <string>
 #include <vector>
 #include <memory>
+#include <unordered_set>
 #include <nlohmann/json.hpp>
 #include "sfl/small_vector.hpp"
 #include <variant>
@@ -229,6 +230,37 @@ struct Coverage
 
     /** Serialize Coverage to JSON. */
     [[nodiscard]] nlohmann::json toJson() const;
+
+    /**
+     * Check whether the given tile overlaps a filled part of this coverage.
+     * The tile may have any zoom level: A tile on a higher level is checked
+     * against its ancestor on the coverage's level, a tile on a lower level
+     * against all its descendants within the coverage.
+     */
+    [[nodiscard]] bool intersects(TileId const& tile) const;
+};
+
+/**
+ * Precomputed lookup structure for the coverages of a layer, so that
+ * checking a tile does not scan the coverage bitmaps. Filled bitmaps are
+ * expanded into the set of filled tiles, and the set of filled tiles and
+ * all their ancestors. A tile then overlaps a filled part if it is in the
+ * second set, or one of its ancestors is in the first. Coverages without
+ * a bitmap are kept as rectangles.
+ */
+class CoverageIndex
+{
+public:
+    explicit CoverageIndex(std::vector<Coverage> const& coverages);
+
+    /** Same as Coverage::intersects() for any of the indexed coverages. */
+    [[nodiscard]] bool intersects(TileId const& tile) const;
+
+private:
+    std::vector<Coverage> ranges_;
+    std::unordered_set<uint64_t> filledTiles_;
+    std::unordered_set<uint64_t> filledTilesAndAncestors_;
+    uint64_t filledLevels_ = 0;  // Bitmask of the levels of filledTiles_
 };
 
 /**
@@ -266,6 +298,31 @@ struct LayerInfo
     /** Version of the map layer. */
     Version version_;
 
+    /**
+     * Precision to which the vertices of the layer's tiles are quantized
+     * when they are serialized, see TileFeatureLayer::setVertexPrecision().
+     * Zero, the default, keeps the lossless float encoding.
+     */
+    double vertexPrecision_ = 0.;
+
+    /**
+     * Index of coverage_, which covers() uses if it is set. It is built by
+     * fromJson() and by the service when a data source is added. Call
+     * indexCoverage() again after coverage_ was changed.
+     */
+    std::shared_ptr<const CoverageIndex> coverageIndex_;
+
+    /** Build coverageIndex_ from coverage_. */
+    void indexCoverage();
+
+    /**
+     * Check whether the layer may have data for the given tile, i.e. whether
+     * the tile is on one of the layer's zoom levels, and overlaps one of its
+     * coverages. A layer without zoom levels or coverages is assumed to
+     * provide all levels or the whole world, respectively.
+     */
+    [[nodiscard]] bool covers(TileId const& tile) const;
+
     /**
      * Validate that a unique id composition exists that matches this feature id.
      * The field values must match the limitations of the IdPartDataType, and
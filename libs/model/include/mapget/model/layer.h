@@ -44,6 +44,11 @@ struct MapTileKey
     // The tile's associated map tile id
     TileId tileId_;
 
+    // Optional name of a representation which is derived from the tile
+    // layer, e.g. its MVT encoding. Derived representations are cached
+    // under their own key, next to the tile layer itself.
+    std::string variant_;
+
     /** Constructor to parse the key from a string, as returned by toString. */
     explicit MapTileKey(std::string const& str);
 
@@ -54,14 +59,18 @@ struct MapTileKey
     MapTileKey() = default;
 
     /** Convert the key to a string. The string will be in the form of
-     *  "(0):(1):(2):(3)", with
+     *  "(0):(1):(2):(3)[:(4)]", with
      *   (0) being the layer type enum name,
      *   (1) being the map id,
      *   (2) being the layer id,
-     *   (3) being the hexadecimal tile id.
+     *   (3) being the hexadecimal tile id,
+     *   (4) being the variant, if it is not empty.
      */
     [[nodiscard]] std::string toString() const;
 
+    /** Get the key of a derived representation of this tile layer. */
+    [[nodiscard]] MapTileKey derived(std::string variant) const;
+
     /** Operator <, allows this struct to be used as an std::map key. */
     bool operator<(MapTileKey const& other) const;
 
@@ -179,6 +188,13 @@ public:
     virtual void write(std::ostream& outputStream);
     virtual nlohmann::json toJson() const;
 
+    /**
+     * Append the JSON representation of this layer to the given string.
+     * The default implementation serializes toJson(); layers may override
+     * this to write their JSON without building a DOM first.
+     */
+    virtual void writeJson(std::string& out) const;
+
 protected:
     Version mapVersion_{0, 0, 0};
     TileId tileId_;
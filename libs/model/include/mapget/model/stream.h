@@ -3,13 +3,71 @@
 #include "layer.h"
 #include "stringpool.h"
 
+#include <istream>
 #include <map>
+#include <span>
 #include <sstream>
 #include <shared_mutex>
+#include <vector>
 
 namespace mapget
 {
 
+/**
+ * Read-only std::istream over a contiguous byte range. The bytes are
+ * not copied, so the range must outlive the stream. This allows the
+ * std::istream-based deserialization functions of the model to run
+ * directly on a receive buffer.
+ */
+class ByteSpanInputStream : public std::istream
+{
+public:
+    explicit ByteSpanInputStream(std::span<const std::byte> bytes);
+
+    /** Number of bytes which have been read from the range so far. */
+    [[nodiscard]] size_t consumed() const;
+
+private:
+    struct Buffer : public std::streambuf
+    {
+        explicit Buffer(std::span<const std::byte> bytes);
+        [[nodiscard]] size_t consumed() const;
+
+    protected:
+        pos_type seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which) override;
+        pos_type seekpos(pos_type pos, std::ios_base::openmode which) override;
+    };
+
+    Buffer buffer_;
+};
+
+/**
+ * std::ostream which appends to a std::string. Unlike std::ostringstream,
+ * the bytes are written to the target string in place, so the result
+ * can be handed out without copying it. The target must outlive the stream.
+ */
+class StringOutputStream : public std::ostream
+{
+public:
+    explicit StringOutputStream(std::string& target);
+
+private:
+    struct Buffer : public std::streambuf
+    {
+        explicit Buffer(std::string& target);
+
+    protected:
+        int_type overflow(int_type ch) override;
+        std::streamsize xsputn(const char* s, std::streamsize n) override;
+        pos_type seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which) override;
+
+    private:
+        std::string& target_;
+    };
+
+    Buffer buffer_;
+};
+
 /**
  * Protocol for binary streaming of TileLayer and associated
  * StringPool dictionary objects. The general stream encoding is a simple
@@ -17,7 +75,10 @@ namespace mapget
  * - The version (6b) indicates the protocol version which was used to
  *   serialise the blob. This must be compatible with the current version
  *   which is used by the mapget library.
- * - The type (1B) must be one fo the MessageType enum values.
+ * - The type (1B) must be one fo the MessageType enum values. It may
+ *   be combined with the CompressedMessageFlag, in which case the value
+ *   is a zstd frame which decompresses to the serialized object, and for
+ *   TileFeatureLayers with the QuantizedMessageFlag.
  * - The length (4b)  indicates the byte-length of the serialized object,
  *   which is stored in the value.
  */
@@ -29,13 +90,48 @@ public:
         StringPool = 1,
         TileFeatureLayer = 2,
         TileSourceDataLayer = 3,
+        TileFeatureLayerDelta = 4,
         EndOfStream = 128
     };
 
     struct StringPoolCache;
 
-    /** Protocol Version which parsed blobs must be compatible with. */
-    static constexpr Version CurrentProtocolVersion{0, 1, 1};
+    /**
+     * Protocol Version which parsed blobs must be compatible with.
+     * 0.1.2: Added the CompressedMessageFlag.
+     * 0.1.3: Added the TileFeatureLayerDelta message.
+     * 0.1.4: Added the QuantizedMessageFlag.
+     */
+    static constexpr Version CurrentProtocolVersion{0, 1, 4};
+
+    /**
+     * Bit which is set in the message type of a StringPool or TileLayer
+     * message, if the message value is zstd-compressed. Compressed messages
+     * are only sent to clients which asked for them.
+     */
+    static constexpr uint8_t CompressedMessageFlag = 0x40;
+
+    /**
+     * Bit which is set in the message type of a TileFeatureLayer(Delta)
+     * message, if the layer has a vertex precision (see
+     * TileFeatureLayer::setVertexPrecision()). Only then, the value holds the
+     * precision and quantized vertices, so layers without a precision are
+     * encoded as before. Readers older than 0.1.4 skip such messages.
+     */
+    static constexpr uint8_t QuantizedMessageFlag = 0x20;
+
+    /**
+     * Largest decompressed size of a compressed message which a Reader
+     * accepts. The Reader allocates the size which a zstd frame declares,
+     * so a malformed frame must not be able to demand more than this.
+     */
+    static constexpr size_t MaxDecompressedMessageSize = size_t(256) << 20;
+
+    /** Default zstd level for Writer::enableCompression(). */
+    static constexpr int DefaultCompressionLevel = 3;
+
+    /** Size of a message header in bytes. Version: 6B, Type: 1B, Size: 4B */
+    static constexpr size_t MessageHeaderSize = 6 + 1 + 4;
 
     /** Map to keep track of the highest sent string id per datasource node. */
     using StringPoolOffsetMap = std::unordered_map<std::string, simfil::StringId>;
@@ -56,22 +152,44 @@ public:
 
         /**
          * Add some bytes to parse. The next object will be parsed once
-         * sufficient bytes are available.
+         * sufficient bytes are available. Complete messages are parsed
+         * directly from the passed bytes; only the trailing part of an
+         * incomplete message is copied into the internal buffer.
          */
         void read(std::string_view const& bytes);
+        void read(std::span<const std::byte> bytes);
 
         /** end-of-stream: Returns true if the internal buffer is exhausted. */
         [[nodiscard]] bool eos();
 
+        /**
+         * Decode TileFeatureLayer and TileSourceDataLayer messages on a pool
+         * of numThreads background threads. The stream is still split at message
+         * boundaries on the thread which calls read(), and StringPool messages
+         * are applied there in stream order, so each tile finds the strings it
+         * depends on. Parsed layers are passed to the callback in stream order,
+         * but from one of the decoding threads. Use waitForPendingLayers() to
+         * block until all received layers have been delivered.
+         * Passing zero threads switches back to decoding within read().
+         */
+        void enableParallelDecoding(uint32_t numThreads);
+
+        /**
+         * Block until all layers which were received so far have been decoded
+         * and passed to the callback. Rethrows the first error which occurred
+         * while decoding. Returns immediately if parallel decoding is disabled.
+         */
+        void waitForPendingLayers();
+
         /** Obtain the string pool cache used by this Reader. */
         std::shared_ptr<StringPoolCache> stringPoolCache();
 
         /**
-         * Read a message header from a stream. Returns true and the next message's type and
-         * size, or false, if no sufficient bytes are available. Throws if the protocol version
-         * in the header does not match the version currently used by mapget.
+         * Read a message header from the start of a byte range. Returns true and the next
+         * message's type and size, or false, if no sufficient bytes are available. Throws if
+         * the protocol version in the header does not match the version currently used by mapget.
          */
-        static bool readMessageHeader(std::stringstream& stream, MessageType& outType, uint32_t& outSize);
+        static bool readMessageHeader(std::span<const std::byte> bytes, MessageType& outType, uint32_t& outSize);
 
     private:
         enum class Phase { ReadHeader, ReadValue };
@@ -81,12 +199,43 @@ public:
         uint32_t nextValueSize_ = 0;
 
         /**
-         * Reads messages from the current available data.
-         * @return True if it can continue and should be called again, false otherwise.
+         * Reads as many messages as possible from the given bytes.
+         * @return The number of bytes which were consumed.
+         */
+        size_t continueReading(std::span<const std::byte> bytes);
+
+        /** Parse a single message value of type nextValueType_. */
+        void readMessage(std::span<const std::byte> value);
+
+        // Decompression context and reusable output buffer, created
+        // once the first compressed message is received.
+        struct Decompression;
+        std::shared_ptr<Decompression> decompression_;
+
+        /**
+         * Decompress a message value if its type carries the CompressedMessageFlag.
+         * The flag is removed from the type. Creates the context on first use.
          */
-        bool continueReading();
+        static std::span<const std::byte> decompressMessage(
+            MessageType& type,
+            std::span<const std::byte> value,
+            std::shared_ptr<Decompression>& decompression);
+
+        /** Deserialize a TileFeatureLayer(Delta) or TileSourceDataLayer message value. */
+        static TileLayer::Ptr parseLayer(
+            MessageType type,
+            std::span<const std::byte> value,
+            LayerInfoResolveFun const& layerInfoProvider,
+            std::shared_ptr<StringPoolCache> const& stringPoolProvider);
 
-        std::stringstream buffer_;
+        // Decoding threads and in-order result delivery,
+        // only present if parallel decoding is enabled.
+        struct ParallelDecoding;
+        std::shared_ptr<ParallelDecoding> parallelDecoding_;
+
+        // Bytes which were received, but not consumed yet. Only ever holds
+        // the beginning of a single, incomplete message.
+        std::vector<std::byte> buffer_;
         LayerInfoResolveFun layerInfoProvider_;
         std::shared_ptr<StringPoolCache> stringPoolProvider_;
         std::function<void(TileLayer::Ptr)> onParsedLayer_;
@@ -94,6 +243,9 @@ public:
 
     /**
      * The Writer turns TileLayer objects and associated StringPools into bytes.
+     * Each message is serialized directly behind a reserved header, into either
+     * a reusable internal buffer or a caller-provided output string. Consumers
+     * receive a view on the complete message and may copy it if they need to.
      */
     struct Writer
     {
@@ -105,15 +257,38 @@ public:
          * Using the same StringId offset map for two Writer objects will
          * lead to undefined behavior.
          *
+         * The message view passed to the callback is only valid
+         * until the next message is written.
+         *
          * Setting differentialStringUpdates=false is necessary when using
          * the Writer with a Cache database, because it is not desirable
          * to store partial StringPool dicts in the database.
          */
         Writer(
-            std::function<void(std::string, MessageType)> onMessage,
+            std::function<void(std::string_view, MessageType)> onMessage,
+            StringPoolOffsetMap& stringPoolOffsets,
+            bool differentialStringUpdates = true);
+
+        /**
+         * Construct a Writer which appends all messages directly to the
+         * given output string, e.g. a response buffer. The output string
+         * must outlive the Writer. It may be cleared or swapped out by the
+         * caller between calls to write().
+         */
+        Writer(
+            std::string& output,
             StringPoolOffsetMap& stringPoolOffsets,
             bool differentialStringUpdates = true);
 
+        /**
+         * Compress the values of subsequent StringPool and TileLayer
+         * messages with zstd at the given level. The compression runs
+         * on the thread which calls write(). Small messages are still
+         * sent uncompressed. Only enable this if the receiving Reader
+         * supports protocol version 0.1.2 or later.
+         */
+        void enableCompression(int level = DefaultCompressionLevel);
+
         /** Serialize a tile layer and the required part of a StringPool. */
         void write(TileLayer::Ptr const& tileLayer);
 
@@ -121,9 +296,15 @@ public:
         void sendEndOfStream();
 
     private:
-        void sendMessage(std::string&& bytes, MessageType msgType);
+        void writeMessage(MessageType msgType, std::function<void(std::ostream&)> const& writeValue);
+
+        std::function<void(std::string_view, MessageType)> onMessage_;
+        std::string* output_ = nullptr;
+        std::string buffer_;
 
-        std::function<void(std::string, MessageType)> onMessage_;
+        // Compression context and buffer for the uncompressed value.
+        struct Compression;
+        std::shared_ptr<Compression> compression_;
         StringPoolOffsetMap& stringPoolOffsets_;
         bool differentialStringUpdates_ = true;
     };
@@ -155,7 +336,7 @@ public:
         [[nodiscard]] virtual StringPoolOffsetMap stringPoolOffsets() const;
 
     protected:
-        std::shared_mutex stringPoolCacheMutex_;
+        mutable std::shared_mutex stringPoolCacheMutex_;
         std::map<std::string, std::shared_ptr<StringPool>, std::less<void>> stringPoolPerNodeId_;
     };
 };
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <cstdint>
+#include <vector>
 
 #include "point.h"
 
@@ -41,6 +42,23 @@ struct TileId
      */
     static TileId fromWgs84(double longitude, double latitude, uint16_t zoomLevel);
 
+    /**
+     * Get all tiles of the given zoom level which intersect the WGS84 bounding
+     * box between sw and ne, in row-major order starting at the north-west tile.
+     * If sw.x > ne.x, the box crosses the antimeridian. Throws if the box
+     * covers more than maxCount tiles, or if the zoom level is above 15,
+     * the highest level whose columns can be represented.
+     */
+    static std::vector<TileId> tilesInBbox(Point const& sw, Point const& ne, uint16_t zoomLevel, size_t maxCount);
+
+    /**
+     * Sort tiles by the distance of their centers to the given focus point,
+     * nearest first, so that tiles around the focus are processed first.
+     * Distances wrap at the antimeridian. Tiles with equal distance keep
+     * their order.
+     */
+    static void sortByDistance(std::vector<TileId>& tiles, Point const& focus);
+
     /**
      * Get the neighbor for a mapget tile id. Tile row will be clamped to [0, maxForLevel],
      * so a positive/negative wraparound is not possible. The tile id column will wrap at the
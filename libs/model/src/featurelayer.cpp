@@ -1,13 +1,19 @@
 #include "featurelayer.h"
 
 #include <algorithm>
+#include <bit>
 #include <cstdint>
 #include <initializer_list>
 #include <iterator>
+#include <numeric>
+#include <optional>
 #include <sstream>
 #include <stdexcept>
 #include <string_view>
 #include <tuple>
+#include <type_traits>
+#include <unordered_set>
+#include <variant>
 #include <vector>
 
 #include <bitsery/bitsery.h>
@@ -22,6 +28,8 @@
 #include "simfil/model/nodes.h"
 #include "mapget/log.h"
 #include "simfil/model/string-pool.h"
+#include "flat-column.h"
+#include "jsonwriter.h"
 #include "simfilutil.h"
 #include "sourcedatareference.h"
 #include "sourceinfo.h"
@@ -44,6 +52,150 @@ void serialize(S& s, mapget::Point& v) {
     s.value8b(v.z);
 }
 
+namespace ext
+{
+
+/**
+ * Serializes the vertex arena of a TileFeatureLayer in a compact form.
+ * Vertex offsets are quantized to integer multiples of the given precision,
+ * and each component is delta-, zigzag- and varint-encoded along its vertex
+ * array. The z component is omitted for arrays where it is zero everywhere.
+ * Components are stored one after another (x..., y..., z...), so decoding
+ * is a varint pass followed by plain prefix-sum and scaling loops, which
+ * the compiler can vectorize.
+ */
+struct QuantizedVertexExt
+{
+    double xyPrecision_ = 0.;
+    double zPrecision_ = 0.;
+
+    // Number of vertex arrays in the arena. Only needed for serialization.
+    size_t numArrays_ = 0;
+
+    template <typename Ser, typename T, typename Fnc>
+    void serialize(Ser& ser, T const& arena, Fnc&&) const
+    {
+        // Elements are only read.
+        auto& storage = const_cast<T&>(arena);
+        std::vector<uint8_t> encoded;
+
+        auto writeVarint = [&encoded](int64_t value) {
+            auto zigzag = (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+            while (zigzag >= 0x80) {
+                encoded.push_back(static_cast<uint8_t>(zigzag) | 0x80);
+                zigzag >>= 7;
+            }
+            encoded.push_back(static_cast<uint8_t>(zigzag));
+        };
+
+        details::writeSize(ser.adapter(), numArrays_);
+        for (size_t a = 0; a < numArrays_; ++a) {
+            auto arrayIndex = static_cast<simfil::ArrayIndex>(a);
+            size_t size = storage.size(arrayIndex);
+            details::writeSize(ser.adapter(), size);
+            if (!size)
+                continue;
+
+            uint8_t hasZ = 0;
+            for (size_t i = 0; i < size && !hasZ; ++i)
+                hasZ = storage.at(arrayIndex, i).z != 0.f;
+
+            encoded.clear();
+            auto encodeComponent = [&](int component, double precision) {
+                int64_t previous = 0;
+                for (size_t i = 0; i < size; ++i) {
+                    auto quantized = std::llround(storage.at(arrayIndex, i)[component] / precision);
+                    writeVarint(quantized - previous);
+                    previous = quantized;
+                }
+            };
+            encodeComponent(0, xyPrecision_);
+            encodeComponent(1, xyPrecision_);
+            if (hasZ)
+                encodeComponent(2, zPrecision_);
+
+            ser.adapter().template writeBytes<1>(hasZ);
+            details::writeSize(ser.adapter(), encoded.size());
+            ser.adapter().template writeBuffer<1>(encoded.data(), encoded.size());
+        }
+    }
+
+    template <typename Des, typename T, typename Fnc>
+    void deserialize(Des& des, T& arena, Fnc&&) const
+    {
+        constexpr size_t maxSize = std::numeric_limits<uint32_t>::max();
+        std::vector<uint8_t> encoded;
+        std::vector<int64_t> quantized;
+        std::vector<float> values;
+
+        size_t numArrays = 0;
+        details::readSize(des.adapter(), numArrays, maxSize, std::true_type{});
+        for (size_t a = 0; a < numArrays; ++a) {
+            size_t size = 0;
+            details::readSize(des.adapter(), size, maxSize, std::true_type{});
+            auto arrayIndex = arena.new_array(size);
+            if (arrayIndex != static_cast<simfil::ArrayIndex>(a))
+                mapget::raise("Unexpected vertex array index while reading quantized vertices.");
+            if (!size)
+                continue;
+
+            uint8_t hasZ = 0;
+            des.adapter().template readBytes<1>(hasZ);
+            size_t numBytes = 0;
+            details::readSize(des.adapter(), numBytes, maxSize, std::true_type{});
+            encoded.resize(numBytes);
+            des.adapter().template readBuffer<1>(encoded.data(), numBytes);
+
+            // Varint pass, which yields the deltas of all components.
+            auto numComponents = hasZ ? 3 : 2;
+            quantized.resize(size * numComponents);
+            size_t pos = 0;
+            for (auto& value : quantized) {
+                uint64_t zigzag = 0;
+                for (int shift = 0;; shift += 7) {
+                    if (pos >= numBytes || shift > 63)
+                        mapget::raise("Malformed quantized vertex array.");
+                    auto byte = encoded[pos++];
+                    zigzag |= static_cast<uint64_t>(byte & 0x7f) << shift;
+                    if (!(byte & 0x80))
+                        break;
+                }
+                value = static_cast<int64_t>(zigzag >> 1) ^ -static_cast<int64_t>(zigzag & 1);
+            }
+
+            // Prefix sums and scaling, per component.
+            values.assign(size * 3, 0.f);
+            for (auto component = 0; component < numComponents; ++component) {
+                auto precision = component < 2 ? xyPrecision_ : zPrecision_;
+                auto* deltas = quantized.data() + component * size;
+                auto* out = values.data() + component * size;
+                std::inclusive_scan(deltas, deltas + size, deltas);
+                for (size_t i = 0; i < size; ++i)
+                    out[i] = static_cast<float>(static_cast<double>(deltas[i]) * precision);
+            }
+
+            for (size_t i = 0; i < size; ++i)
+                arena.emplace_back(arrayIndex, glm::fvec3{values[i], values[size + i], values[2 * size + i]});
+        }
+    }
+};
+
+}
+
+namespace traits
+{
+
+template <typename T>
+struct ExtensionTraits<ext::QuantizedVertexExt, T>
+{
+    using TValue = void;
+    static constexpr bool SupportValueOverload = false;
+    static constexpr bool SupportObjectOverload = false;
+    static constexpr bool SupportLambdaOverload = false;
+};
+
+}
+
 }
 
 namespace
@@ -125,22 +277,61 @@ struct TileFeatureLayer::Impl {
     // Simfil compiled expression cache and environment
     SimfilExpressionCache expressionCache_;
 
+    // Set if this layer only holds the changes relative to a base version.
+    std::optional<DeltaInfo> deltaInfo_;
+
+    // Precision of serialized vertex offsets. If zero,
+    // vertices are serialized as they are stored, as floats.
+    double vertexPrecision_ = 0.;
+    double vertexZPrecision_ = 0.;
+
+    /** Number of arrays in pointBuffers_, as referenced by the geometries. */
+    [[nodiscard]] size_t numVertexArrays() const
+    {
+        simfil::ArrayIndex result = 0;
+        for (auto const& geom : geom_) {
+            if (!geom.isView_)
+                result = std::max(result, geom.detail_.geom_.vertexArray_ + 1);
+        }
+        return static_cast<size_t>(result);
+    }
+
+    // Columns which are stored without padding may be copied as a whole.
+    // Their serialized form must not change, so these asserts guard
+    // against fields being added to the respective Data structs.
+    static_assert(sizeof(Feature::Data) == 6 * sizeof(simfil::ModelNodeAddress));
+    static_assert(sizeof(simfil::ModelNodeAddress) == sizeof(uint32_t));
+    static_assert(sizeof(simfil::ArrayIndex) == sizeof(uint32_t));
+
     // (De-)Serialization
+    // TODO: Reading a layer still copies every column into the model. A
+    //  read-only view which iterates, finds and evaluates features directly
+    //  on the serialized bytes (e.g. of an mmap-ed cache blob) is not
+    //  implemented yet; it needs simfil's ModelPool to work on borrowed
+    //  columns. FlatColumnExt only speeds up the copy of the flat columns.
     template<typename S>
-    void readWrite(S& s) {
+    void readWrite(S& s, bool quantized) {
         constexpr size_t maxColumnSize = std::numeric_limits<uint32_t>::max();
-        s.container(features_, maxColumnSize);
+        s.ext(features_, bitsery::ext::FlatColumnExt{});
         s.container(attributes_, maxColumnSize);
         s.container(validities_, maxColumnSize);
         s.container(featureIds_, maxColumnSize);
-        s.container(attrLayers_, maxColumnSize);
-        s.container(attrLayerLists_, maxColumnSize);
+        s.ext(attrLayers_, bitsery::ext::FlatColumnExt{});
+        s.ext(attrLayerLists_, bitsery::ext::FlatColumnExt{});
         s.object(featureIdPrefix_);
         s.container(relations_, maxColumnSize);
         sortFeatureHashIndex();
         s.container(featureHashIndex_, maxColumnSize);
         s.container(geom_, maxColumnSize);
-        s.ext(pointBuffers_, bitsery::ext::ArrayArenaExt{});
+        // The precision is only stored for quantized layers, so
+        // other layers keep the encoding of older readers.
+        if (quantized) {
+            s.value8b(vertexPrecision_);
+            s.value8b(vertexZPrecision_);
+            s.ext(pointBuffers_, bitsery::ext::QuantizedVertexExt{vertexPrecision_, vertexZPrecision_, numVertexArrays()});
+        }
+        else
+            s.ext(pointBuffers_, bitsery::ext::ArrayArenaExt{});
         s.container(sourceDataReferences_, maxColumnSize);
     }
 
@@ -161,19 +352,22 @@ TileFeatureLayer::TileFeatureLayer(
     impl_(std::make_unique<Impl>(strings)),
     TileLayer(tileId, nodeId, mapId, layerInfo)
 {
+    if (layerInfo && layerInfo->vertexPrecision_ > 0.)
+        setVertexPrecision(layerInfo->vertexPrecision_);
 }
 
 TileFeatureLayer::TileFeatureLayer(
     std::istream& inputStream,
     LayerInfoResolveFun const& layerInfoResolveFun,
-    StringPoolResolveFun const& stringPoolGetter
+    StringPoolResolveFun const& stringPoolGetter,
+    bool quantized
 ) :
     TileLayer(inputStream, layerInfoResolveFun),
     ModelPool(stringPoolGetter(nodeId_)),
     impl_(std::make_unique<Impl>(stringPoolGetter(nodeId_)))
 {
     bitsery::Deserializer<bitsery::InputStreamAdapter> s(inputStream);
-    impl_->readWrite(s);
+    impl_->readWrite(s, quantized);
     if (s.adapter().error() != bitsery::ReaderError::NoError) {
         raise(fmt::format(
             "Failed to read TileFeatureLayer: Error {}",
@@ -291,6 +485,146 @@ uint64_t hashFeatureId(const std::string_view& type, const KeyValueViewPairs& id
     return hash;
 }
 
+
+/** FNV-1a hash of a string, which is stable across platforms. */
+uint64_t hashString(std::string_view const& str)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    for (char c : str) {
+        hash ^= static_cast<uint8_t>(c);
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+void hashCombine(uint64_t& seed, uint64_t hash)
+{
+    seed ^= hash + 0x9e3779b97f4a7c15ULL + (seed << 6) + (seed >> 2);
+}
+
+/**
+ * Hash a model node and its children by walking the model, without building
+ * JSON. Object fields are combined independently of their order, so equal
+ * content yields the same hash regardless of how a layer was assembled.
+ * Fields with the given key, and fields whose name is unknown, are skipped.
+ */
+void hashNode(
+    uint64_t& hash,
+    simfil::ModelNode const& node,
+    simfil::StringPool const& strings,
+    std::optional<simfil::StringId> skippedField = {})
+{
+    auto type = node.type();
+    hashCombine(hash, static_cast<uint64_t>(type));
+    switch (type) {
+    case simfil::ValueType::Object: {
+        uint64_t fieldsHash = 0;
+        for (int64_t i = 0, n = node.size(); i < n; ++i) {
+            auto keyId = node.keyAt(i);
+            if (keyId == skippedField)
+                continue;
+            auto key = strings.resolve(keyId);
+            auto value = node.at(i);
+            if (!key || !value)
+                continue;
+            auto fieldHash = hashString(*key);
+            hashNode(fieldHash, *value, strings);
+            fieldsHash += fieldHash;
+        }
+        hashCombine(hash, fieldsHash);
+        break;
+    }
+    case simfil::ValueType::Array: {
+        for (int64_t i = 0, n = node.size(); i < n; ++i) {
+            if (auto value = node.at(i))
+                hashNode(hash, *value, strings);
+            else
+                hashCombine(hash, 0);
+        }
+        break;
+    }
+    default:
+        std::visit(
+            [&hash](auto&& v)
+            {
+                using T = std::decay_t<decltype(v)>;
+                if constexpr (std::is_same_v<T, bool>)
+                    hashCombine(hash, v ? 1 : 0);
+                else if constexpr (std::is_integral_v<T>)
+                    hashCombine(hash, static_cast<uint64_t>(v));
+                else if constexpr (std::is_floating_point_v<T>)
+                    hashCombine(hash, std::bit_cast<uint64_t>(static_cast<double>(v)));
+                else if constexpr (std::is_convertible_v<T const&, std::string_view>)
+                    hashCombine(hash, hashString(v));
+            },
+            node.value());
+    }
+}
+
+/**
+ * Hash the content of a feature. Geometries are hashed separately via
+ * Geometry::getHash(), so that insignificant coordinate noise is ignored.
+ */
+uint64_t hashFeatureContent(Feature const& feature, simfil::StringPool const& strings)
+{
+    uint64_t hash = 0;
+    hashNode(hash, feature, strings, StringPool::GeometryStr);
+    if (auto geom = feature.geomOrNull()) {
+        geom->forEachGeometry([&hash](auto&& geometry) {
+            hashCombine(hash, static_cast<uint64_t>(geometry->geomType()));
+            hashCombine(hash, std::bit_cast<uint64_t>(geometry->getHash()));
+            return true;
+        });
+    }
+    return hash;
+}
+
+/** Copy the feature id prefix of a layer into owning key-value pairs. */
+KeyValuePairs idPrefixOf(TileFeatureLayer& layer)
+{
+    KeyValuePairs result;
+    auto idPrefix = layer.getIdPrefix();
+    if (!idPrefix)
+        return result;
+    for (auto const& [key, value] : idPrefix->fields()) {
+        auto keyStr = layer.strings()->resolve(key);
+        if (!keyStr)
+            continue;
+        std::visit(
+            [&result, &keyStr](auto&& v)
+            {
+                using T = std::decay_t<decltype(v)>;
+                if constexpr (std::is_same_v<T, int64_t>)
+                    result.emplace_back(std::string(*keyStr), v);
+                else if constexpr (std::is_convertible_v<T, std::string_view>)
+                    result.emplace_back(std::string(*keyStr), std::string(std::string_view(v)));
+            },
+            value->value());
+    }
+    return result;
+}
+
+/** Create an empty layer with the same tile, map, layer and prefix as the given one. */
+TileFeatureLayer::Ptr emptyLayerLike(TileFeatureLayer& layer)
+{
+    auto result = std::make_shared<TileFeatureLayer>(
+        layer.tileId(),
+        layer.nodeId(),
+        layer.mapId(),
+        layer.layerInfo(),
+        layer.strings());
+    result->setTimestamp(layer.timestamp());
+    result->setTtl(layer.ttl());
+    result->setMapVersion(layer.mapVersion());
+    auto [xyPrecision, zPrecision] = layer.vertexPrecision();
+    result->setVertexPrecision(xyPrecision, zPrecision);
+    if (auto legalInfo = layer.legalInfo())
+        result->setLegalInfo(*legalInfo);
+    if (auto idPrefix = idPrefixOf(layer); !idPrefix.empty())
+        result->setIdPrefix(castToKeyValueView(idPrefix));
+    return result;
+}
+
 }  // namespace
 
 simfil::model_ptr<Feature> TileFeatureLayer::newFeature(
@@ -796,7 +1130,7 @@ void TileFeatureLayer::write(std::ostream& outputStream)
 {
     TileLayer::write(outputStream);
     bitsery::Serializer<bitsery::OutputStreamAdapter> s(outputStream);
-    impl_->readWrite(s);
+    impl_->readWrite(s, impl_->vertexPrecision_ > 0.);
     ModelPool::write(outputStream);
 }
 
@@ -811,6 +1145,20 @@ nlohmann::json TileFeatureLayer::toJson() const
     });
 }
 
+void TileFeatureLayer::writeJson(std::string& out) const
+{
+    JsonWriter writer(out, *strings());
+    out += R"({"type":"FeatureCollection","features":[)";
+    auto first = true;
+    for (auto f : *this) {
+        if (!first)
+            out += ',';
+        first = false;
+        writer.write(*f);
+    }
+    out += "]}";
+}
+
 size_t TileFeatureLayer::size() const
 {
     return numRoots();
@@ -1259,4 +1607,173 @@ model_ptr<Feature> TileFeatureLayer::find(const std::string_view& featureId) con
     return find(typeInfo->name_, kvPairs);
 }
 
+TileFeatureLayer::FeatureDigest TileFeatureLayer::featureDigest() const
+{
+    impl_->sortFeatureHashIndex();
+    FeatureDigest result;
+    result.reserve(impl_->featureHashIndex_.size());
+    for (auto const& entry : impl_->featureHashIndex_) {
+        auto feature = resolveFeature(*simfil::ModelNode::Ptr::make(shared_from_this(), entry.featureAddr_));
+        result.emplace_back(entry.idHash_, hashFeatureContent(*feature, *strings()));
+    }
+    return result;
+}
+
+uint64_t TileFeatureLayer::contentHash() const
+{
+    return contentHash(featureDigest());
+}
+
+uint64_t TileFeatureLayer::contentHash(FeatureDigest const& digest)
+{
+    uint64_t hash = digest.size();
+    for (auto const& [idHash, featureContentHash] : digest) {
+        hashCombine(hash, idHash);
+        hashCombine(hash, featureContentHash);
+    }
+    return hash;
+}
+
+TileFeatureLayer::Ptr TileFeatureLayer::deltaFrom(FeatureDigest const& baseDigest)
+{
+    return deltaFrom(baseDigest, featureDigest());
+}
+
+TileFeatureLayer::Ptr
+TileFeatureLayer::deltaFrom(FeatureDigest const& baseDigest, FeatureDigest const& currentDigest)
+{
+    // The digest entries are parallel to the sorted feature hash index.
+    impl_->sortFeatureHashIndex();
+    if (currentDigest.size() != impl_->featureHashIndex_.size())
+        raise("The feature digest passed to deltaFrom() does not belong to this layer.");
+
+    auto self = std::dynamic_pointer_cast<TileFeatureLayer>(shared_from_this());
+    auto result = emptyLayerLike(*this);
+    DeltaInfo deltaInfo{contentHash(baseDigest), {}};
+
+    auto byIdHash = [](auto&& l, auto&& r) { return l.first < r.first; };
+    auto containsIdHash = [&byIdHash](FeatureDigest const& digest, uint64_t idHash) {
+        return std::binary_search(digest.begin(), digest.end(), std::pair<uint64_t, uint64_t>{idHash, 0}, byIdHash);
+    };
+
+    // Copy features which are new or whose content has changed.
+    std::unordered_map<uint32_t, simfil::ModelNode::Ptr> clonedModelNodes;
+    for (auto i = 0; i < currentDigest.size(); ++i) {
+        auto [baseBegin, baseEnd] = std::equal_range(baseDigest.begin(), baseDigest.end(), currentDigest[i], byIdHash);
+        auto unchanged = std::any_of(baseBegin, baseEnd, [&](auto&& baseEntry) {
+            return baseEntry.second == currentDigest[i].second;
+        });
+        if (unchanged)
+            continue;
+        auto feature = resolveFeature(*simfil::ModelNode::Ptr::make(self, impl_->featureHashIndex_[i].featureAddr_));
+        result->clone(clonedModelNodes, self, *feature, feature->typeId(), feature->id()->keyValuePairs());
+    }
+
+    // Note the features which do not exist anymore.
+    for (auto const& [idHash, _] : baseDigest) {
+        if (!deltaInfo.removedFeatureIdHashes_.empty() && deltaInfo.removedFeatureIdHashes_.back() == idHash)
+            continue;
+        if (!containsIdHash(currentDigest, idHash))
+            deltaInfo.removedFeatureIdHashes_.push_back(idHash);
+    }
+
+    result->setDeltaInfo(std::move(deltaInfo));
+    return result;
+}
+
+TileFeatureLayer::Ptr TileFeatureLayer::applyDelta(TileFeatureLayer::Ptr const& base)
+{
+    if (!impl_->deltaInfo_)
+        raise("Cannot apply a layer which is not a delta.");
+    if (base->contentHash() != impl_->deltaInfo_->baseContentHash_)
+        raiseFmt("Delta for tile {} does not apply to the given base version.", tileId_.value_);
+
+    // Features of the base are kept unless they were removed or replaced.
+    std::unordered_set<uint64_t> replacedIdHashes(
+        impl_->deltaInfo_->removedFeatureIdHashes_.begin(),
+        impl_->deltaInfo_->removedFeatureIdHashes_.end());
+    for (auto const& entry : impl_->featureHashIndex_)
+        replacedIdHashes.insert(entry.idHash_);
+
+    std::vector<uint32_t> keptFeatureIndices;
+    for (auto const& entry : base->impl_->featureHashIndex_) {
+        if (!replacedIdHashes.count(entry.idHash_))
+            keptFeatureIndices.push_back(entry.featureAddr_.index());
+    }
+    std::sort(keptFeatureIndices.begin(), keptFeatureIndices.end());
+
+    auto result = emptyLayerLike(*base);
+    std::unordered_map<uint32_t, simfil::ModelNode::Ptr> clonedBaseNodes;
+    for (auto featureIndex : keptFeatureIndices) {
+        auto feature = base->at(featureIndex);
+        result->clone(clonedBaseNodes, base, *feature, feature->typeId(), feature->id()->keyValuePairs());
+    }
+
+    auto self = std::dynamic_pointer_cast<TileFeatureLayer>(shared_from_this());
+    std::unordered_map<uint32_t, simfil::ModelNode::Ptr> clonedDeltaNodes;
+    for (auto feature : *this)
+        result->clone(clonedDeltaNodes, self, *feature, feature->typeId(), feature->id()->keyValuePairs());
+
+    // The result is a complete layer with the delta's version information.
+    result->setTimestamp(timestamp());
+    result->setTtl(ttl());
+    result->setMapVersion(mapVersion());
+    return result;
+}
+
+TileFeatureLayer::Ptr TileFeatureLayer::filter(std::string_view query)
+{
+    auto self = std::dynamic_pointer_cast<TileFeatureLayer>(shared_from_this());
+    auto result = emptyLayerLike(*this);
+    std::unordered_map<uint32_t, simfil::ModelNode::Ptr> clonedModelNodes;
+    for (auto feature : *this) {
+        if (matches(query, *feature))
+            result->clone(clonedModelNodes, self, *feature, feature->typeId(), feature->id()->keyValuePairs());
+    }
+    return result;
+}
+
+bool TileFeatureLayer::matches(std::string_view query, Feature const& feature)
+{
+    auto evaluated = evaluate(query, feature, true, true);
+    if (!evaluated)
+        raiseFmt("Failed to evaluate query '{}': {}", query, evaluated.error().message);
+    return std::any_of(
+        evaluated->values.begin(),
+        evaluated->values.end(),
+        [](auto&& value) { return value.isa(simfil::ValueType::Bool) && value.template as<simfil::ValueType::Bool>(); });
+}
+
+tl::expected<void, simfil::Error> TileFeatureLayer::compileQuery(std::string_view query)
+{
+    auto env = makeEnvironment(std::make_shared<StringPool>(""));
+    auto ast = simfil::compile(*env, query, true, true);
+    if (!ast)
+        return tl::unexpected<simfil::Error>(std::move(ast.error()));
+    return {};
+}
+
+std::optional<TileFeatureLayer::DeltaInfo> const& TileFeatureLayer::deltaInfo() const
+{
+    return impl_->deltaInfo_;
+}
+
+void TileFeatureLayer::setDeltaInfo(DeltaInfo info)
+{
+    impl_->deltaInfo_ = std::move(info);
+}
+
+void TileFeatureLayer::setVertexPrecision(double xyPrecision, double zPrecision)
+{
+    if (xyPrecision < 0. || (xyPrecision > 0. && zPrecision <= 0.))
+        raiseFmt("Invalid vertex precision {}/{}.", xyPrecision, zPrecision);
+    impl_->vertexPrecision_ = xyPrecision;
+    impl_->vertexZPrecision_ = xyPrecision > 0. ? zPrecision : 0.;
+}
+
+std::pair<double, double> TileFeatureLayer::vertexPrecision() const
+{
+    return {impl_->vertexPrecision_, impl_->vertexZPrecision_};
+}
+
 }
@@ -2,6 +2,7 @@
 #include "stream.h"
 #include "mapget/log.h"
 
+#include <algorithm>
 #include <tuple>
 #include <random>
 #include <sstream>
@@ -311,6 +312,139 @@ nlohmann::json Coverage::toJson() const
     return nlohmann::json{{"min", min_.value_}, {"max", max_.value_}, {"filled", filled_}};
 }
 
+bool Coverage::intersects(TileId const& tile) const
+{
+    // Express the tile as a range of columns and rows on the coverage's
+    // zoom level. Levels are at most 62 apart, but a shift beyond 47
+    // bits would overflow, and already spans every 16-bit column.
+    auto const level = static_cast<int>(min_.z());
+    auto const shift = std::min(std::abs(static_cast<int>(tile.z()) - level), 47);
+    uint64_t minX = tile.x(), maxX = tile.x(), minY = tile.y(), maxY = tile.y();
+    if (tile.z() >= level) {
+        minX = maxX = minX >> shift;
+        minY = maxY = minY >> shift;
+    }
+    else {
+        minX <<= shift;
+        maxX = ((maxX + 1) << shift) - 1;
+        minY <<= shift;
+        maxY = ((maxY + 1) << shift) - 1;
+    }
+
+    minX = std::max<uint64_t>(minX, min_.x());
+    maxX = std::min<uint64_t>(maxX, max_.x());
+    minY = std::max<uint64_t>(minY, min_.y());
+    maxY = std::min<uint64_t>(maxY, max_.y());
+    if (minX > maxX || minY > maxY)
+        return false;
+    if (filled_.empty())
+        return true;
+
+    auto const width = static_cast<uint64_t>(max_.x() - min_.x() + 1);
+    for (auto y = minY; y <= maxY; ++y) {
+        for (auto x = minX; x <= maxX; ++x) {
+            auto bit = (y - min_.y()) * width + (x - min_.x());
+            if (bit < filled_.size() && filled_[bit])
+                return true;
+        }
+    }
+    return false;
+}
+
+namespace
+{
+
+// Levels of filled tiles are kept as bits of a 64-bit mask. Tile coordinates
+// have 16 bits, so higher levels cannot be represented anyway.
+constexpr int maxIndexedLevel = 63;
+
+// Id of the ancestor on the given level of the tile (x, y) on level + shift.
+uint64_t ancestorId(uint16_t x, uint16_t y, int shift, int level)
+{
+    if (shift >= 16)
+        x = y = 0;
+    else {
+        x >>= shift;
+        y >>= shift;
+    }
+    return TileId(x, y, static_cast<uint16_t>(level)).value_;
+}
+
+}  // namespace
+
+CoverageIndex::CoverageIndex(std::vector<Coverage> const& coverages)
+{
+    for (auto const& coverage : coverages) {
+        auto const level = static_cast<int>(coverage.min_.z());
+        if (coverage.filled_.empty() || level > maxIndexedLevel) {
+            ranges_.push_back(coverage);
+            continue;
+        }
+
+        auto const width = static_cast<size_t>(coverage.max_.x() - coverage.min_.x() + 1);
+        for (size_t bit = 0; bit < coverage.filled_.size(); ++bit) {
+            if (!coverage.filled_[bit])
+                continue;
+            auto const x = static_cast<uint16_t>(coverage.min_.x() + bit % width);
+            auto const y = static_cast<uint16_t>(coverage.min_.y() + bit / width);
+            if (x > coverage.max_.x() || y > coverage.max_.y())
+                break;
+            filledTiles_.insert(TileId(x, y, level).value_);
+
+            // Stop at the first ancestor which was already inserted,
+            // as its own ancestors were inserted along with it.
+            for (int ancestorLevel = level, shift = 0; ancestorLevel >= 0; --ancestorLevel, ++shift) {
+                if (!filledTilesAndAncestors_.insert(ancestorId(x, y, shift, ancestorLevel)).second)
+                    break;
+            }
+        }
+        filledLevels_ |= uint64_t(1) << level;
+    }
+}
+
+bool CoverageIndex::intersects(TileId const& tile) const
+{
+    // Rectangles are cheap to check, and usually few.
+    for (auto const& range : ranges_) {
+        if (range.intersects(tile))
+            return true;
+    }
+
+    // The tile is filled, or has a filled descendant.
+    if (filledTilesAndAncestors_.count(tile.value_))
+        return true;
+
+    // The tile has a filled ancestor.
+    auto const level = static_cast<int>(tile.z());
+    for (int ancestorLevel = 0; ancestorLevel < level && ancestorLevel <= maxIndexedLevel; ++ancestorLevel) {
+        if (!(filledLevels_ & (uint64_t(1) << ancestorLevel)))
+            continue;
+        if (filledTiles_.count(ancestorId(tile.x(), tile.y(), level - ancestorLevel, ancestorLevel)))
+            return true;
+    }
+    return false;
+}
+
+void LayerInfo::indexCoverage()
+{
+    coverageIndex_ = std::make_shared<CoverageIndex>(coverage_);
+}
+
+bool LayerInfo::covers(TileId const& tile) const
+{
+    if (!zoomLevels_.empty() &&
+        std::find(zoomLevels_.begin(), zoomLevels_.end(), static_cast<int>(tile.z())) == zoomLevels_.end())
+        return false;
+    if (coverage_.empty())
+        return true;
+    if (coverageIndex_)
+        return coverageIndex_->intersects(tile);
+    return std::any_of(
+        coverage_.begin(),
+        coverage_.end(),
+        [&tile](auto const& coverage) { return coverage.intersects(tile); });
+}
+
 std::shared_ptr<LayerInfo> LayerInfo::fromJson(const nlohmann::json& j, std::string const& layerId)
 {
     try {
@@ -329,7 +463,7 @@ std::shared_ptr<LayerInfo> LayerInfo::fromJson(const nlohmann::json& j, std::str
                 coverages.push_back(Coverage::fromJson(item));
             }
 
-        return std::make_shared<LayerInfo>(LayerInfo{
+        auto result = std::make_shared<LayerInfo>(LayerInfo{
             j.value("layerId", layerId),
             type,
             featureTypes,
@@ -337,7 +471,10 @@ std::shared_ptr<LayerInfo> LayerInfo::fromJson(const nlohmann::json& j, std::str
             coverages,
             j.value("canRead", true),
             j.value("canWrite", false),
-            Version::fromJson(j.value("version", Version().toJson()))});
+            Version::fromJson(j.value("version", Version().toJson())),
+            j.value("vertexPrecision", 0.)});
+        result->indexCoverage();
+        return result;
     }
     catch (nlohmann::json::out_of_range const& e) {
         throw missing_field(e.what(), "LayerInfo");
@@ -358,7 +495,7 @@ nlohmann::json LayerInfo::toJson() const
         coverages.push_back(item.toJson());
     }
 
-    return nlohmann::json{
+    auto result = nlohmann::json{
         {"layerId", layerId_},
         {"type", type_},
         {"featureTypes", featureTypes},
@@ -367,6 +504,9 @@ nlohmann::json LayerInfo::toJson() const
         {"canRead", canRead_},
         {"canWrite", canWrite_},
         {"version", version_.toJson()}};
+    if (vertexPrecision_ > 0.)
+        result["vertexPrecision"] = vertexPrecision_;
+    return result;
 }
 
 FeatureTypeInfo const* LayerInfo::getTypeInfo(const std::string_view& sv, bool throwIfMissing)
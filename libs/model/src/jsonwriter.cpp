@@ -0,0 +1,118 @@
+#include "jsonwriter.h"
+
+#include <cmath>
+#include <iterator>
+#include <type_traits>
+#include <variant>
+
+#include "fmt/format.h"
+
+namespace mapget
+{
+
+JsonWriter::JsonWriter(std::string& out, simfil::StringPool const& strings)
+    : out_(out), strings_(strings)
+{
+}
+
+void JsonWriter::write(simfil::ModelNode const& node)
+{
+    switch (node.type()) {
+    case simfil::ValueType::Object: {
+        out_ += '{';
+        auto first = true;
+        for (int64_t i = 0, n = node.size(); i < n; ++i) {
+            // Fields with unresolvable names are skipped, like ModelNode::toJson() does.
+            auto key = strings_.resolve(node.keyAt(i));
+            auto value = node.at(i);
+            if (!key || !value)
+                continue;
+            if (!first)
+                out_ += ',';
+            first = false;
+            writeString(*key);
+            out_ += ':';
+            write(*value);
+        }
+        out_ += '}';
+        break;
+    }
+    case simfil::ValueType::Array: {
+        out_ += '[';
+        for (int64_t i = 0, n = node.size(); i < n; ++i) {
+            if (i > 0)
+                out_ += ',';
+            if (auto value = node.at(i))
+                write(*value);
+            else
+                out_ += "null";
+        }
+        out_ += ']';
+        break;
+    }
+    default:
+        writeScalar(node.value());
+    }
+}
+
+void JsonWriter::writeString(std::string_view str)
+{
+    out_ += '"';
+    // Runs of characters which need no escaping are appended in one go.
+    auto runStart = str.begin();
+    for (auto it = str.begin(); it != str.end(); ++it) {
+        auto c = static_cast<unsigned char>(*it);
+        if (c >= 0x20 && c != '"' && c != '\\')
+            continue;
+        out_.append(runStart, it);
+        runStart = std::next(it);
+        switch (c) {
+        case '"': out_ += "\\\""; break;
+        case '\\': out_ += "\\\\"; break;
+        case '\b': out_ += "\\b"; break;
+        case '\f': out_ += "\\f"; break;
+        case '\n': out_ += "\\n"; break;
+        case '\r': out_ += "\\r"; break;
+        case '\t': out_ += "\\t"; break;
+        default: fmt::format_to(std::back_inserter(out_), "\\u{:04x}", c);
+        }
+    }
+    out_.append(runStart, str.end());
+    out_ += '"';
+}
+
+void JsonWriter::writeScalar(simfil::ScalarValueType const& value)
+{
+    std::visit(
+        [this](auto&& v)
+        {
+            using T = std::decay_t<decltype(v)>;
+            if constexpr (std::is_same_v<T, bool>) {
+                out_ += v ? "true" : "false";
+            }
+            else if constexpr (std::is_integral_v<T>) {
+                fmt::format_to(std::back_inserter(out_), "{}", v);
+            }
+            else if constexpr (std::is_floating_point_v<T>) {
+                if (!std::isfinite(v)) {
+                    out_ += "null";
+                    return;
+                }
+                // Shortest round-trip representation. Keep a fractional
+                // part, so the value is still parsed as a float.
+                auto start = out_.size();
+                fmt::format_to(std::back_inserter(out_), "{}", v);
+                if (out_.find_first_of(".e", start) == std::string::npos)
+                    out_ += ".0";
+            }
+            else if constexpr (std::is_convertible_v<T const&, std::string_view>) {
+                writeString(v);
+            }
+            else {
+                out_ += "null";
+            }
+        },
+        value);
+}
+
+}  // namespace mapget
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+
+#include "simfil/model/nodes.h"
+#include "simfil/model/string-pool.h"
+
+namespace mapget
+{
+
+/**
+ * Writes the JSON representation of simfil model nodes directly into
+ * a string, without building an intermediate nlohmann::json DOM.
+ * The output is equivalent to ModelNode::toJson(), except that object
+ * fields keep their model order instead of being sorted by key.
+ */
+class JsonWriter
+{
+public:
+    JsonWriter(std::string& out, simfil::StringPool const& strings);
+
+    /** Append the given node and all of its children. */
+    void write(simfil::ModelNode const& node);
+
+    /** Append a quoted and escaped JSON string. */
+    void writeString(std::string_view str);
+
+    /** Append a scalar node value. Non-finite floats are written as null. */
+    void writeScalar(simfil::ScalarValueType const& value);
+
+private:
+    std::string& out_;
+    simfil::StringPool const& strings_;
+};
+
+}  // namespace mapget
@@ -28,10 +28,15 @@ MapTileKey::MapTileKey(const std::string& str)
 
     if (partsVec.size() < 4)
         raise(fmt::format("Invalid cache tile id: {}", str));
-    layer_ = nlohmann::json(std::string_view(&*partsVec[1].begin(), distance(partsVec[1]))).get<LayerType>();
+    layer_ = nlohmann::json(std::string_view(&*partsVec[0].begin(), distance(partsVec[0]))).get<LayerType>();
     mapId_ = std::string_view(&*partsVec[1].begin(), distance(partsVec[1]));
     layerId_ = std::string_view(&*partsVec[2].begin(), distance(partsVec[2]));
     std::from_chars(&*partsVec[3].begin(), &*partsVec[3].begin() + distance(partsVec[3]), tileId_.value_, 16);
+    if (partsVec.size() > 4 && !partsVec[4].empty()) {
+        // The variant may itself contain colons.
+        auto variantStart = &*partsVec[4].begin() - str.data();
+        variant_ = str.substr(variantStart);
+    }
 }
 
 MapTileKey::MapTileKey(const TileLayer& data)
@@ -44,24 +49,34 @@ MapTileKey::MapTileKey(const TileLayer& data)
 
 std::string MapTileKey::toString() const
 {
-    return fmt::format(
+    auto result = fmt::format(
         "{}:{}:{}:{:0x}",
         nlohmann::json(layer_).get<std::string>(),
         mapId_,
         layerId_,
         tileId_.value_);
+    if (!variant_.empty())
+        result += fmt::format(":{}", variant_);
+    return result;
+}
+
+MapTileKey MapTileKey::derived(std::string variant) const
+{
+    auto result = *this;
+    result.variant_ = std::move(variant);
+    return result;
 }
 
 bool MapTileKey::operator<(const MapTileKey& other) const
 {
-    return std::tie(layer_, mapId_, layerId_, tileId_) <
-        std::tie(other.layer_, other.mapId_, other.layerId_, other.tileId_);
+    return std::tie(layer_, mapId_, layerId_, tileId_, variant_) <
+        std::tie(other.layer_, other.mapId_, other.layerId_, other.tileId_, other.variant_);
 }
 
 bool MapTileKey::operator==(const MapTileKey& other) const
 {
-    return std::tie(layer_, mapId_, layerId_, tileId_) ==
-        std::tie(other.layer_, other.mapId_, other.layerId_, other.tileId_);
+    return std::tie(layer_, mapId_, layerId_, tileId_, variant_) ==
+        std::tie(other.layer_, other.mapId_, other.layerId_, other.tileId_, other.variant_);
 }
 
 bool MapTileKey::operator!=(const MapTileKey& other) const
@@ -259,4 +274,9 @@ nlohmann::json TileLayer::toJson() const
     return {};
 }
 
+void TileLayer::writeJson(std::string& out) const
+{
+    out += nlohmann::to_string(toJson());
+}
+
 } // namespace mapget
@@ -0,0 +1,482 @@
+#include "featurelayer.h"
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstdint>
+#include <initializer_list>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "simfil/model/nodes.h"
+#include "stringpool.h"
+
+namespace mapget
+{
+
+namespace
+{
+
+/**
+ * Minimal protobuf encoder for the messages of the Mapbox Vector Tile
+ * specification (https://github.com/mapbox/vector-tile-spec, version 2.1).
+ */
+class ProtoWriter
+{
+public:
+    enum WireType : uint32_t { Varint = 0, Fixed64 = 1, LengthDelimited = 2 };
+
+    explicit ProtoWriter(std::string& out) : out_(out) {}
+
+    void varint(uint64_t value)
+    {
+        while (value >= 0x80) {
+            out_ += static_cast<char>((value & 0x7f) | 0x80);
+            value >>= 7;
+        }
+        out_ += static_cast<char>(value);
+    }
+
+    void tag(uint32_t field, WireType wireType) { varint((field << 3) | wireType); }
+
+    void uintField(uint32_t field, uint64_t value)
+    {
+        tag(field, Varint);
+        varint(value);
+    }
+
+    void bytesField(uint32_t field, std::string_view bytes)
+    {
+        tag(field, LengthDelimited);
+        varint(bytes.size());
+        out_ += bytes;
+    }
+
+    void doubleField(uint32_t field, double value)
+    {
+        tag(field, Fixed64);
+        auto bits = std::bit_cast<uint64_t>(value);
+        for (auto i = 0; i < 8; ++i)
+            out_ += static_cast<char>((bits >> (8 * i)) & 0xff);
+    }
+
+    void packedField(uint32_t field, std::vector<uint32_t> const& values)
+    {
+        if (values.empty())
+            return;
+        std::string packed;
+        ProtoWriter packedWriter(packed);
+        for (auto value : values)
+            packedWriter.varint(value);
+        bytesField(field, packed);
+    }
+
+private:
+    std::string& out_;
+};
+
+uint32_t zigzag(int32_t value)
+{
+    return (static_cast<uint32_t>(value) << 1) ^ static_cast<uint32_t>(value >> 31);
+}
+
+// Message field numbers and enums of the MVT schema.
+enum MvtTileField : uint32_t { TileLayers = 3 };
+enum MvtLayerField : uint32_t {
+    LayerName = 1,
+    LayerFeatures = 2,
+    LayerKeys = 3,
+    LayerValues = 4,
+    LayerExtent = 5,
+    LayerVersion = 15
+};
+enum MvtFeatureField : uint32_t { FeatureId = 1, FeatureTags = 2, FeatureType = 3, FeatureGeometry = 4 };
+enum MvtValueField : uint32_t { StringValue = 1, DoubleValue = 3, UintValue = 5, SintValue = 6, BoolValue = 7 };
+enum MvtGeomType : uint32_t { MvtPoint = 1, MvtLineString = 2, MvtPolygon = 3 };
+enum MvtCommand : uint32_t { MoveTo = 1, LineTo = 2, ClosePath = 7 };
+
+using TilePoint = glm::dvec2;
+using TilePointList = std::vector<TilePoint>;
+
+/** Clipping rectangle in tile coordinates, i.e. the tile extent plus buffer. */
+struct ClipBox
+{
+    double min_;
+    double max_;
+
+    [[nodiscard]] bool contains(TilePoint const& p) const
+    {
+        return p.x >= min_ && p.x <= max_ && p.y >= min_ && p.y <= max_;
+    }
+
+    /**
+     * Clip the segment a-b to the box (Liang-Barsky). Returns false
+     * if the segment is entirely outside, otherwise moves a and b.
+     */
+    bool clipSegment(TilePoint& a, TilePoint& b) const
+    {
+        auto t0 = 0.;
+        auto t1 = 1.;
+        auto const d = b - a;
+        auto clipEdge = [&](double p, double q)
+        {
+            if (p == 0.)
+                return q >= 0.;
+            auto r = q / p;
+            if (p < 0.) {
+                if (r > t1) return false;
+                t0 = std::max(t0, r);
+            }
+            else {
+                if (r < t0) return false;
+                t1 = std::min(t1, r);
+            }
+            return true;
+        };
+        if (!clipEdge(-d.x, a.x - min_) || !clipEdge(d.x, max_ - a.x) ||
+            !clipEdge(-d.y, a.y - min_) || !clipEdge(d.y, max_ - a.y))
+            return false;
+        b = a + t1 * d;
+        a = a + t0 * d;
+        return true;
+    }
+
+    /** Clip a polyline, which may fall apart into several parts. */
+    [[nodiscard]] std::vector<TilePointList> clipLine(TilePointList const& line) const
+    {
+        std::vector<TilePointList> parts;
+        for (size_t i = 1; i < line.size(); ++i) {
+            auto a = line[i - 1];
+            auto b = line[i];
+            if (!clipSegment(a, b))
+                continue;
+            // Continue the current part if the segment starts where it ends.
+            if (parts.empty() || parts.back().back() != a)
+                parts.push_back({a});
+            parts.back().push_back(b);
+        }
+        return parts;
+    }
+
+    /** Clip a polygon ring against each box edge (Sutherland-Hodgman). */
+    [[nodiscard]] TilePointList clipRing(TilePointList ring) const
+    {
+        auto clipAgainst = [&](auto&& inside, auto&& intersect)
+        {
+            TilePointList result;
+            result.reserve(ring.size() + 4);
+            for (size_t i = 0; i < ring.size(); ++i) {
+                auto const& cur = ring[i];
+                auto const& prev = ring[(i + ring.size() - 1) % ring.size()];
+                if (inside(cur)) {
+                    if (!inside(prev))
+                        result.push_back(intersect(prev, cur));
+                    result.push_back(cur);
+                }
+                else if (inside(prev))
+                    result.push_back(intersect(prev, cur));
+            }
+            ring = std::move(result);
+        };
+        auto atX = [](TilePoint const& a, TilePoint const& b, double x)
+        { return TilePoint{x, a.y + (b.y - a.y) * (x - a.x) / (b.x - a.x)}; };
+        auto atY = [](TilePoint const& a, TilePoint const& b, double y)
+        { return TilePoint{a.x + (b.x - a.x) * (y - a.y) / (b.y - a.y), y}; };
+
+        clipAgainst([&](auto& p) { return p.x >= min_; }, [&](auto& a, auto& b) { return atX(a, b, min_); });
+        clipAgainst([&](auto& p) { return p.x <= max_; }, [&](auto& a, auto& b) { return atX(a, b, max_); });
+        clipAgainst([&](auto& p) { return p.y >= min_; }, [&](auto& a, auto& b) { return atY(a, b, min_); });
+        clipAgainst([&](auto& p) { return p.y <= max_; }, [&](auto& a, auto& b) { return atY(a, b, max_); });
+        return ring;
+    }
+};
+
+/**
+ * Accumulates the quantized geometry commands of one MVT feature.
+ * Coordinates are delta-encoded against the cursor, which carries
+ * over between the parts of a multi-geometry.
+ */
+class GeometryEncoder
+{
+public:
+    std::vector<uint32_t> commands_;
+
+    void addPoints(TilePointList const& points)
+    {
+        auto quantized = quantize(points, false);
+        if (quantized.empty())
+            return;
+        commands_.push_back(command(MoveTo, quantized.size()));
+        for (auto const& p : quantized)
+            addDelta(p);
+    }
+
+    void addLine(TilePointList const& line)
+    {
+        auto quantized = quantize(line, true);
+        if (quantized.size() < 2)
+            return;
+        commands_.push_back(command(MoveTo, 1));
+        addDelta(quantized[0]);
+        commands_.push_back(command(LineTo, quantized.size() - 1));
+        for (size_t i = 1; i < quantized.size(); ++i)
+            addDelta(quantized[i]);
+    }
+
+    /** Add a ring as an exterior ring. The winding is fixed as needed. */
+    void addRing(TilePointList const& ring)
+    {
+        auto quantized = quantize(ring, true);
+        while (quantized.size() > 1 && quantized.front() == quantized.back())
+            quantized.pop_back();
+        if (quantized.size() < 3)
+            return;
+
+        // Exterior rings have a positive area in tile coordinates (y down).
+        int64_t area = 0;
+        for (size_t i = 0; i < quantized.size(); ++i) {
+            auto const& a = quantized[i];
+            auto const& b = quantized[(i + 1) % quantized.size()];
+            area += static_cast<int64_t>(a.x) * b.y - static_cast<int64_t>(b.x) * a.y;
+        }
+        if (area == 0)
+            return;
+        if (area < 0)
+            std::reverse(quantized.begin(), quantized.end());
+
+        commands_.push_back(command(MoveTo, 1));
+        addDelta(quantized[0]);
+        commands_.push_back(command(LineTo, quantized.size() - 1));
+        for (size_t i = 1; i < quantized.size(); ++i)
+            addDelta(quantized[i]);
+        commands_.push_back(command(ClosePath, 1));
+    }
+
+private:
+    glm::ivec2 cursor_{0, 0};
+
+    static uint32_t command(MvtCommand id, size_t count)
+    {
+        return (id & 0x7) | (static_cast<uint32_t>(count) << 3);
+    }
+
+    static std::vector<glm::ivec2> quantize(TilePointList const& points, bool dropRepeated)
+    {
+        std::vector<glm::ivec2> result;
+        result.reserve(points.size());
+        for (auto const& p : points) {
+            glm::ivec2 q{static_cast<int32_t>(std::lround(p.x)), static_cast<int32_t>(std::lround(p.y))};
+            if (dropRepeated && !result.empty() && result.back() == q)
+                continue;
+            result.push_back(q);
+        }
+        return result;
+    }
+
+    void addDelta(glm::ivec2 const& p)
+    {
+        commands_.push_back(zigzag(p.x - cursor_.x));
+        commands_.push_back(zigzag(p.y - cursor_.y));
+        cursor_ = p;
+    }
+};
+
+/** Builds the key and value tables of an MVT layer, and the tags of its features. */
+class AttributeTable
+{
+public:
+    explicit AttributeTable(simfil::StringPool const& strings) : strings_(strings) {}
+
+    /**
+     * Flatten a model node into tags. Object fields and array items
+     * are joined to their parent's key with a dot.
+     */
+    void flatten(std::string const& key, simfil::ModelNode const& node, std::vector<uint32_t>& tags)
+    {
+        switch (node.type()) {
+        case simfil::ValueType::Object:
+            for (int64_t i = 0, n = node.size(); i < n; ++i) {
+                auto fieldName = strings_.resolve(node.keyAt(i));
+                auto field = node.at(i);
+                if (fieldName && field)
+                    flatten(joinKey(key, *fieldName), *field, tags);
+            }
+            break;
+        case simfil::ValueType::Array:
+            for (int64_t i = 0, n = node.size(); i < n; ++i)
+                if (auto item = node.at(i))
+                    flatten(joinKey(key, std::to_string(i)), *item, tags);
+            break;
+        default:
+            addTag(key, node.value(), tags);
+        }
+    }
+
+    void write(ProtoWriter& layer) const
+    {
+        for (auto const& key : keys_)
+            layer.bytesField(LayerKeys, key);
+        for (auto const& value : values_)
+            layer.bytesField(LayerValues, value);
+    }
+
+private:
+    static std::string joinKey(std::string const& prefix, std::string_view name)
+    {
+        if (prefix.empty())
+            return std::string(name);
+        return prefix + "." + std::string(name);
+    }
+
+    void addTag(std::string const& key, simfil::ScalarValueType const& value, std::vector<uint32_t>& tags)
+    {
+        std::string encoded;
+        ProtoWriter valueWriter(encoded);
+        std::visit(
+            [&](auto&& v)
+            {
+                using T = std::decay_t<decltype(v)>;
+                if constexpr (std::is_same_v<T, bool>)
+                    valueWriter.uintField(BoolValue, v);
+                else if constexpr (std::is_integral_v<T>) {
+                    if (v < 0)
+                        valueWriter.uintField(SintValue, (static_cast<uint64_t>(v) << 1) ^ static_cast<uint64_t>(v >> 63));
+                    else
+                        valueWriter.uintField(UintValue, static_cast<uint64_t>(v));
+                }
+                else if constexpr (std::is_floating_point_v<T>)
+                    valueWriter.doubleField(DoubleValue, v);
+                else if constexpr (std::is_convertible_v<T const&, std::string_view>)
+                    valueWriter.bytesField(StringValue, v);
+            },
+            value);
+        if (encoded.empty())
+            return;
+        tags.push_back(index(keyIndex_, keys_, key));
+        tags.push_back(index(valueIndex_, values_, encoded));
+    }
+
+    static uint32_t index(
+        std::unordered_map<std::string, uint32_t>& lookup,
+        std::vector<std::string>& table,
+        std::string const& entry)
+    {
+        auto [it, inserted] = lookup.emplace(entry, static_cast<uint32_t>(table.size()));
+        if (inserted)
+            table.push_back(entry);
+        return it->second;
+    }
+
+    simfil::StringPool const& strings_;
+    std::unordered_map<std::string, uint32_t> keyIndex_;
+    std::unordered_map<std::string, uint32_t> valueIndex_;
+    std::vector<std::string> keys_;
+    std::vector<std::string> values_;
+};
+
+}  // namespace
+
+std::string TileFeatureLayer::toMvt(uint32_t extent, uint32_t buffer) const
+{
+    auto const sw = tileId().sw();
+    auto const size = tileId().size();
+    auto const scaleX = extent / size.x;
+    auto const scaleY = extent / size.y;
+    auto const northEdge = sw.y + size.y;
+    auto toTile = [&](Point const& p) {
+        return TilePoint{(p.x - sw.x) * scaleX, (northEdge - p.y) * scaleY};
+    };
+    ClipBox const clipBox{-static_cast<double>(buffer), static_cast<double>(extent + buffer)};
+
+    std::string features;
+    ProtoWriter featuresWriter(features);
+    AttributeTable attributes(*strings());
+    std::vector<uint32_t> tags;
+    TilePointList points;
+
+    uint64_t featureIndex = 0;
+    for (auto feature : *this) {
+        auto const id = featureIndex++;
+        auto geometries = feature->geomOrNull();
+        if (!geometries)
+            continue;
+
+        // Feature id, id parts and attributes become the feature's tags.
+        // Map and layer id are the same for all features and are left out.
+        tags.clear();
+        simfil::ModelNode const& featureNode = *feature;
+        for (int64_t i = 0, n = featureNode.size(); i < n; ++i) {
+            auto fieldId = featureNode.keyAt(i);
+            if (fieldId == StringPool::TypeStr || fieldId == StringPool::GeometryStr ||
+                fieldId == StringPool::RelationsStr || fieldId == StringPool::SourceDataStr ||
+                fieldId == StringPool::MapIdStr || fieldId == StringPool::LayerIdStr)
+                continue;
+            auto field = featureNode.at(i);
+            auto fieldName = strings()->resolve(fieldId);
+            if (!field || !fieldName)
+                continue;
+            attributes.flatten(fieldId == StringPool::PropertiesStr ? "" : std::string(*fieldName), *field, tags);
+        }
+
+        // One MVT feature is written per MVT geometry type. Each of them
+        // gets its own id, as MVT feature ids should be unique in a layer.
+        GeometryEncoder encoders[3];
+        geometries->forEachGeometry([&](auto&& geom) {
+            points.clear();
+            for (size_t i = 0, n = geom->numPoints(); i < n; ++i)
+                points.push_back(toTile(geom->pointAt(i)));
+
+            switch (geom->geomType()) {
+            case GeomType::Points: {
+                TilePointList inside;
+                for (auto const& p : points)
+                    if (clipBox.contains(p))
+                        inside.push_back(p);
+                encoders[MvtPoint - 1].addPoints(inside);
+                break;
+            }
+            case GeomType::Line:
+                for (auto const& part : clipBox.clipLine(points))
+                    encoders[MvtLineString - 1].addLine(part);
+                break;
+            case GeomType::Polygon:
+                encoders[MvtPolygon - 1].addRing(clipBox.clipRing(points));
+                break;
+            case GeomType::Mesh:
+                for (size_t i = 0; i + 2 < points.size(); i += 3)
+                    encoders[MvtPolygon - 1].addRing(clipBox.clipRing({points[i], points[i + 1], points[i + 2]}));
+                break;
+            }
+            return true;
+        });
+
+        for (auto type : {MvtPoint, MvtLineString, MvtPolygon}) {
+            auto const& commands = encoders[type - 1].commands_;
+            if (commands.empty())
+                continue;
+            std::string featureMessage;
+            ProtoWriter featureWriter(featureMessage);
+            featureWriter.uintField(FeatureId, id * 3 + type - 1);
+            featureWriter.packedField(FeatureTags, tags);
+            featureWriter.uintField(FeatureType, type);
+            featureWriter.packedField(FeatureGeometry, commands);
+            featuresWriter.bytesField(LayerFeatures, featureMessage);
+        }
+    }
+
+    std::string layer;
+    ProtoWriter layerWriter(layer);
+    layerWriter.uintField(LayerVersion, 2);
+    layerWriter.bytesField(LayerName, layerInfo()->layerId_);
+    layer += features;
+    attributes.write(layerWriter);
+    layerWriter.uintField(LayerExtent, extent);
+
+    std::string tile;
+    ProtoWriter(tile).bytesField(TileLayers, layer);
+    return tile;
+}
+
+}  // namespace mapget
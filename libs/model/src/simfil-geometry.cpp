@@ -249,9 +249,9 @@ auto Polygon::area() const -> double
 auto LineString::bbox() const -> BBox
 {
     auto minx = std::numeric_limits<double>::max();
-    auto maxx = std::numeric_limits<double>::min();
+    auto maxx = std::numeric_limits<double>::lowest();
     auto miny = std::numeric_limits<double>::max();
-    auto maxy = std::numeric_limits<double>::min();
+    auto maxy = std::numeric_limits<double>::lowest();
 
     if (points.empty())
         return {{0, 0}, {0, 0}};
@@ -2,12 +2,24 @@
 #include "sourcedatalayer.h"
 #include "info.h"
 #include "mapget/log.h"
+#include "mapget/trace.h"
 #include "simfil/model/nodes.h"
 
 #include <bitsery/bitsery.h>
 #include <bitsery/adapter/stream.h>
 #include <bitsery/traits/string.h>
+#include <bitsery/traits/vector.h>
+#include <zstd.h>
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <limits>
 #include <memory>
+#include <optional>
+#include <mutex>
+#include <span>
+#include <thread>
 
 #include "featurelayer.h"
 #include "sourcedatalayer.h"
@@ -15,6 +27,279 @@
 namespace mapget
 {
 
+namespace
+{
+// Receive buffer capacity which a Reader keeps after it has been drained.
+constexpr size_t maxRetainedBufferCapacity = 1 << 20;
+
+// Message values below this size are not worth compressing.
+constexpr size_t minCompressedValueSize = 256;
+}
+
+struct TileLayerStream::Reader::Decompression
+{
+    Decompression() : context_(ZSTD_createDCtx())
+    {
+        if (!context_)
+            raise("Failed to create zstd decompression context.");
+    }
+
+    ~Decompression() { ZSTD_freeDCtx(context_); }
+
+    /** Decompress a zstd frame. The result is valid until the next call. */
+    std::span<const std::byte> decompress(std::span<const std::byte> frame)
+    {
+        auto size = ZSTD_getFrameContentSize(frame.data(), frame.size());
+        if (size == ZSTD_CONTENTSIZE_ERROR || size == ZSTD_CONTENTSIZE_UNKNOWN)
+            raise("Received compressed message without a valid zstd frame header.");
+        if (size > MaxDecompressedMessageSize)
+            raiseFmt(
+                "Received compressed message with size {}, at most {} bytes are allowed.",
+                size,
+                MaxDecompressedMessageSize);
+
+        buffer_.resize(size);
+        auto result = ZSTD_decompressDCtx(context_, buffer_.data(), buffer_.size(), frame.data(), frame.size());
+        if (ZSTD_isError(result))
+            raiseFmt("Failed to decompress message: {}", ZSTD_getErrorName(result));
+        return {buffer_.data(), result};
+    }
+
+    ZSTD_DCtx* context_;
+    std::vector<std::byte> buffer_;
+};
+
+struct TileLayerStream::Reader::ParallelDecoding
+{
+    struct Job
+    {
+        uint64_t sequenceNumber_ = 0;
+        MessageType type_ = MessageType::None;
+        std::vector<std::byte> value_;
+    };
+
+    ParallelDecoding(
+        uint32_t numThreads,
+        LayerInfoResolveFun layerInfoProvider,
+        std::shared_ptr<StringPoolCache> stringPoolProvider,
+        std::function<void(TileLayer::Ptr)> onParsedLayer)
+        : layerInfoProvider_(std::move(layerInfoProvider)),
+          stringPoolProvider_(std::move(stringPoolProvider)),
+          onParsedLayer_(std::move(onParsedLayer))
+    {
+        for (auto i = 0u; i < numThreads; ++i)
+            threads_.emplace_back([this] { work(); });
+    }
+
+    ~ParallelDecoding()
+    {
+        {
+            std::lock_guard lock(jobsMutex_);
+            shouldStop_ = true;
+        }
+        jobsAvailable_.notify_all();
+        for (auto& thread : threads_)
+            thread.join();
+    }
+
+    /** Copy a (possibly compressed) layer message value and queue it for decoding. */
+    void dispatch(MessageType type, std::span<const std::byte> value)
+    {
+        uint64_t sequenceNumber = 0;
+        {
+            std::lock_guard lock(resultsMutex_);
+            sequenceNumber = nextSequenceNumber_++;
+        }
+        {
+            std::lock_guard lock(jobsMutex_);
+            jobs_.push_back({sequenceNumber, type, {value.begin(), value.end()}});
+        }
+        jobsAvailable_.notify_one();
+    }
+
+    void wait()
+    {
+        std::unique_lock lock(resultsMutex_);
+        allDelivered_.wait(lock, [this] { return nextDelivery_ == nextSequenceNumber_; });
+        if (error_)
+            std::rethrow_exception(std::exchange(error_, nullptr));
+    }
+
+    void work()
+    {
+        // Each thread keeps its own decompression context.
+        std::shared_ptr<Decompression> decompression;
+        while (true) {
+            Job job;
+            {
+                std::unique_lock lock(jobsMutex_);
+                jobsAvailable_.wait(lock, [this] { return shouldStop_ || !jobs_.empty(); });
+                if (shouldStop_)
+                    return;
+                job = std::move(jobs_.front());
+                jobs_.pop_front();
+            }
+
+            TileLayer::Ptr layer;
+            try {
+                auto type = job.type_;
+                auto value = decompressMessage(type, job.value_, decompression);
+                layer = parseLayer(type, value, layerInfoProvider_, stringPoolProvider_);
+            }
+            catch (...) {
+                std::lock_guard lock(resultsMutex_);
+                if (!error_)
+                    error_ = std::current_exception();
+            }
+            deliver(job.sequenceNumber_, std::move(layer));
+        }
+    }
+
+    /**
+     * Store a decoded layer, and pass all layers to the callback which
+     * are now complete in stream order. The callback is invoked under
+     * the results lock, so it is never called concurrently.
+     */
+    void deliver(uint64_t sequenceNumber, TileLayer::Ptr layer)
+    {
+        {
+            std::lock_guard lock(resultsMutex_);
+            results_.emplace(sequenceNumber, std::move(layer));
+            while (!results_.empty() && results_.begin()->first == nextDelivery_) {
+                auto ready = std::move(results_.begin()->second);
+                results_.erase(results_.begin());
+                ++nextDelivery_;
+                if (!ready)
+                    continue;
+                try {
+                    onParsedLayer_(ready);
+                }
+                catch (...) {
+                    if (!error_)
+                        error_ = std::current_exception();
+                }
+            }
+        }
+        allDelivered_.notify_all();
+    }
+
+    LayerInfoResolveFun layerInfoProvider_;
+    std::shared_ptr<StringPoolCache> stringPoolProvider_;
+    std::function<void(TileLayer::Ptr)> onParsedLayer_;
+
+    std::mutex jobsMutex_;
+    std::condition_variable jobsAvailable_;
+    std::deque<Job> jobs_;
+    bool shouldStop_ = false;
+
+    std::mutex resultsMutex_;
+    std::condition_variable allDelivered_;
+    std::map<uint64_t, TileLayer::Ptr> results_;
+    uint64_t nextSequenceNumber_ = 0;
+    uint64_t nextDelivery_ = 0;
+    std::exception_ptr error_;
+
+    std::vector<std::thread> threads_;
+};
+
+struct TileLayerStream::Writer::Compression
+{
+    explicit Compression(int level) : context_(ZSTD_createCCtx()), level_(level)
+    {
+        if (!context_)
+            raise("Failed to create zstd compression context.");
+    }
+
+    ~Compression() { ZSTD_freeCCtx(context_); }
+
+    ZSTD_CCtx* context_;
+    int level_;
+    std::string plainValue_;
+};
+
+ByteSpanInputStream::ByteSpanInputStream(std::span<const std::byte> bytes)
+    : std::istream(nullptr), buffer_(bytes)
+{
+    rdbuf(&buffer_);
+}
+
+size_t ByteSpanInputStream::consumed() const
+{
+    return buffer_.consumed();
+}
+
+ByteSpanInputStream::Buffer::Buffer(std::span<const std::byte> bytes)
+{
+    // The get area is never written to, so casting away const is safe.
+    auto* begin = const_cast<char*>(reinterpret_cast<char const*>(bytes.data()));
+    setg(begin, begin, begin + bytes.size());
+}
+
+size_t ByteSpanInputStream::Buffer::consumed() const
+{
+    return static_cast<size_t>(gptr() - eback());
+}
+
+std::streambuf::pos_type ByteSpanInputStream::Buffer::seekoff(
+    off_type off,
+    std::ios_base::seekdir dir,
+    std::ios_base::openmode which)
+{
+    if (!(which & std::ios_base::in))
+        return pos_type(off_type(-1));
+
+    off_type base = 0;
+    if (dir == std::ios_base::cur)
+        base = gptr() - eback();
+    else if (dir == std::ios_base::end)
+        base = egptr() - eback();
+
+    auto target = base + off;
+    if (target < 0 || target > egptr() - eback())
+        return pos_type(off_type(-1));
+    setg(eback(), eback() + target, egptr());
+    return pos_type(target);
+}
+
+std::streambuf::pos_type ByteSpanInputStream::Buffer::seekpos(pos_type pos, std::ios_base::openmode which)
+{
+    return seekoff(off_type(pos), std::ios_base::beg, which);
+}
+
+StringOutputStream::StringOutputStream(std::string& target)
+    : std::ostream(nullptr), buffer_(target)
+{
+    rdbuf(&buffer_);
+}
+
+StringOutputStream::Buffer::Buffer(std::string& target) : target_(target)
+{
+}
+
+std::streambuf::int_type StringOutputStream::Buffer::overflow(int_type ch)
+{
+    if (!traits_type::eq_int_type(ch, traits_type::eof()))
+        target_.push_back(traits_type::to_char_type(ch));
+    return traits_type::not_eof(ch);
+}
+
+std::streamsize StringOutputStream::Buffer::xsputn(const char* s, std::streamsize n)
+{
+    target_.append(s, static_cast<size_t>(n));
+    return n;
+}
+
+std::streambuf::pos_type StringOutputStream::Buffer::seekoff(
+    off_type off,
+    std::ios_base::seekdir dir,
+    std::ios_base::openmode which)
+{
+    // Only support tellp(), which reports the size of the target.
+    if (off != 0 || dir != std::ios_base::cur || !(which & std::ios_base::out))
+        return pos_type(off_type(-1));
+    return pos_type(off_type(target_.size()));
+}
+
 TileLayerStream::Reader::Reader(
     LayerInfoResolveFun layerInfoProvider,
     std::function<void(TileLayer::Ptr)> onParsedLayer,
@@ -29,60 +314,168 @@ TileLayerStream::Reader::Reader(
 
 void TileLayerStream::Reader::read(const std::string_view& bytes)
 {
-    buffer_ << bytes;
-    while (continueReading());
+    read(std::as_bytes(std::span(bytes.data(), bytes.size())));
+}
+
+void TileLayerStream::Reader::read(std::span<const std::byte> bytes)
+{
+    if (buffer_.empty()) {
+        // Fast path: Parse directly from the given bytes, and
+        // only retain the beginning of an incomplete trailing message.
+        auto consumed = continueReading(bytes);
+        buffer_.assign(bytes.begin() + consumed, bytes.end());
+    }
+    else {
+        buffer_.insert(buffer_.end(), bytes.begin(), bytes.end());
+        auto consumed = continueReading(buffer_);
+        buffer_.erase(buffer_.begin(), buffer_.begin() + consumed);
+    }
+
+    if (buffer_.empty()) {
+        // Do not hold on to the memory of large messages which were
+        // assembled from multiple chunks.
+        if (buffer_.capacity() > maxRetainedBufferCapacity)
+            std::vector<std::byte>().swap(buffer_);
+    }
+    else if (currentPhase_ == Phase::ReadValue) {
+        // Avoid repeated re-allocation while the value is being received.
+        buffer_.reserve(nextValueSize_);
+    }
 }
 
 bool TileLayerStream::Reader::eos()
 {
-    return (buffer_.tellp() - buffer_.tellg()) == 0;
+    return buffer_.empty();
 }
 
-bool TileLayerStream::Reader::continueReading()
+size_t TileLayerStream::Reader::continueReading(std::span<const std::byte> bytes)
 {
-    if (currentPhase_ == Phase::ReadHeader)
+    size_t consumed = 0;
+    while (true)
     {
-        if (readMessageHeader(buffer_, nextValueType_, nextValueSize_)) {
+        if (currentPhase_ == Phase::ReadHeader)
+        {
+            if (!readMessageHeader(bytes.subspan(consumed), nextValueType_, nextValueSize_))
+                break;
+            consumed += MessageHeaderSize;
             currentPhase_ = Phase::ReadValue;
         }
-        else {
-            return false;
-        }
+
+        if (bytes.size() - consumed < nextValueSize_)
+            break;
+
+        // Advance by the announced size, regardless of how many
+        // bytes were actually consumed by the deserializer.
+        auto value = bytes.subspan(consumed, nextValueSize_);
+        consumed += nextValueSize_;
+        currentPhase_ = Phase::ReadHeader;
+        readMessage(value);
     }
+    return consumed;
+}
 
-    bitsery::Deserializer<bitsery::InputStreamAdapter> s(buffer_);
-    auto numUnreadBytes = buffer_.tellp() - buffer_.tellg();
-    if (numUnreadBytes < nextValueSize_)
-        return false;
+void TileLayerStream::Reader::enableParallelDecoding(uint32_t numThreads)
+{
+    if (parallelDecoding_)
+        parallelDecoding_->wait();
+    parallelDecoding_.reset();
+    if (numThreads > 0)
+        parallelDecoding_ = std::make_shared<ParallelDecoding>(
+            numThreads,
+            layerInfoProvider_,
+            stringPoolProvider_,
+            onParsedLayer_);
+}
 
-    if (nextValueType_ == MessageType::TileFeatureLayer)
-    {
-        auto start = std::chrono::system_clock::now();
-        auto layer = std::make_shared<TileFeatureLayer>(buffer_, layerInfoProvider_, [this](auto&& nodeId) {
-            return stringPoolProvider_->getStringPool(nodeId);
-        });
+void TileLayerStream::Reader::waitForPendingLayers()
+{
+    if (parallelDecoding_)
+        parallelDecoding_->wait();
+}
 
-        // Calculate duration.
-        auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now() - start);
-        log().trace("Reading {} kB took {} ms.", nextValueSize_/1000, elapsed.count());
-        onParsedLayer_(layer);
+void TileLayerStream::Reader::readMessage(std::span<const std::byte> value)
+{
+    auto messageType = nextValueType_;
+    auto plainType = static_cast<MessageType>(
+        static_cast<uint8_t>(messageType) & ~(CompressedMessageFlag | QuantizedMessageFlag));
+
+    auto isLayerMessage = [](MessageType type) {
+        return type == MessageType::TileFeatureLayer || type == MessageType::TileFeatureLayerDelta ||
+               type == MessageType::TileSourceDataLayer;
+    };
+
+    // Layers do not depend on each other, so they may be handed
+    // off to the decoding threads, still compressed.
+    if (parallelDecoding_ && isLayerMessage(plainType)) {
+        parallelDecoding_->dispatch(messageType, value);
+        return;
     }
-    else if (nextValueType_ == MessageType::TileSourceDataLayer)
+
+    value = decompressMessage(messageType, value, decompression_);
+
+    if (isLayerMessage(plainType))
     {
-        auto layer = std::make_shared<TileSourceDataLayer>(buffer_, layerInfoProvider_, [this](auto&& nodeId) {
-            return stringPoolProvider_->getStringPool(nodeId);
-        });
-        onParsedLayer_(layer);
+        onParsedLayer_(parseLayer(messageType, value, layerInfoProvider_, stringPoolProvider_));
     }
-    else if (nextValueType_ == MessageType::StringPool)
+    else if (messageType == MessageType::StringPool)
     {
-        // Read the node id which identifies the string pool.
-        std::string stringPoolNodeId = StringPool::readDataSourceNodeId(buffer_);
-        stringPoolProvider_->getStringPool(stringPoolNodeId)->read(buffer_);
+        // Read the node id which identifies the string pool. String pools
+        // only ever grow, so updating them while previously received layers
+        // are still being decoded is safe.
+        ByteSpanInputStream valueStream(value);
+        std::string stringPoolNodeId = StringPool::readDataSourceNodeId(valueStream);
+        stringPoolProvider_->getStringPool(stringPoolNodeId)->read(valueStream);
     }
+}
 
-    currentPhase_ = Phase::ReadHeader;
-    return true;
+std::span<const std::byte> TileLayerStream::Reader::decompressMessage(
+    MessageType& type,
+    std::span<const std::byte> value,
+    std::shared_ptr<Decompression>& decompression)
+{
+    if (!(static_cast<uint8_t>(type) & CompressedMessageFlag))
+        return value;
+    if (!decompression)
+        decompression = std::make_shared<Decompression>();
+    type = static_cast<MessageType>(static_cast<uint8_t>(type) & ~CompressedMessageFlag);
+    return decompression->decompress(value);
+}
+
+TileLayer::Ptr TileLayerStream::Reader::parseLayer(
+    MessageType type,
+    std::span<const std::byte> value,
+    LayerInfoResolveFun const& layerInfoProvider,
+    std::shared_ptr<StringPoolCache> const& stringPoolProvider)
+{
+    ByteSpanInputStream valueStream(value);
+    auto stringPoolGetter = [&stringPoolProvider](auto&& nodeId) {
+        return stringPoolProvider->getStringPool(nodeId);
+    };
+    auto const quantized = (static_cast<uint8_t>(type) & QuantizedMessageFlag) != 0;
+    type = static_cast<MessageType>(static_cast<uint8_t>(type) & ~QuantizedMessageFlag);
+
+    if (type == MessageType::TileFeatureLayer || type == MessageType::TileFeatureLayerDelta)
+    {
+        // A delta message prefixes the layer with its DeltaInfo.
+        TileFeatureLayer::DeltaInfo deltaInfo;
+        if (type == MessageType::TileFeatureLayerDelta) {
+            bitsery::Deserializer<bitsery::InputStreamAdapter> s(valueStream);
+            s.object(deltaInfo);
+            if (s.adapter().error() != bitsery::ReaderError::NoError)
+                raise("Failed to read TileFeatureLayerDelta header.");
+        }
+
+        auto start = std::chrono::system_clock::now();
+        auto layer = std::make_shared<TileFeatureLayer>(valueStream, layerInfoProvider, stringPoolGetter, quantized);
+        if (type == MessageType::TileFeatureLayerDelta)
+            layer->setDeltaInfo(std::move(deltaInfo));
+
+        // Calculate duration.
+        auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now() - start);
+        log().trace("Reading {} kB took {} ms.", value.size()/1000, elapsed.count());
+        return layer;
+    }
+    return std::make_shared<TileSourceDataLayer>(valueStream, layerInfoProvider, stringPoolGetter);
 }
 
 std::shared_ptr<TileLayerStream::StringPoolCache> TileLayerStream::Reader::stringPoolCache()
@@ -90,16 +483,14 @@ std::shared_ptr<TileLayerStream::StringPoolCache> TileLayerStream::Reader::strin
     return stringPoolProvider_;
 }
 
-bool TileLayerStream::Reader::readMessageHeader(std::stringstream & stream, MessageType& outType, uint32_t& outSize)
+bool TileLayerStream::Reader::readMessageHeader(std::span<const std::byte> bytes, MessageType& outType, uint32_t& outSize)
 {
-    bitsery::Deserializer<bitsery::InputStreamAdapter> s(stream);
-    auto numUnreadBytes = stream.tellp() - stream.tellg();
-
-    // Version: 6B, Type: 1B, Size: 4B
-    constexpr auto headerSize = 6 + 1 + 4;
-    if (numUnreadBytes < headerSize)
+    if (bytes.size() < MessageHeaderSize)
         return false;
 
+    ByteSpanInputStream headerStream(bytes.first(MessageHeaderSize));
+    bitsery::Deserializer<bitsery::InputStreamAdapter> s(headerStream);
+
     Version protocolVersion;
     s.object(protocolVersion);
     if (!protocolVersion.isCompatible(CurrentProtocolVersion)) {
@@ -115,7 +506,7 @@ bool TileLayerStream::Reader::readMessageHeader(std::stringstream & stream, Mess
 }
 
 TileLayerStream::Writer::Writer(
-    std::function<void(std::string, MessageType)> onMessage,
+    std::function<void(std::string_view, MessageType)> onMessage,
     StringPoolOffsetMap& stringPoolOffsets,
     bool differentialStringUpdates)
     : onMessage_(std::move(onMessage)),
@@ -124,40 +515,58 @@ TileLayerStream::Writer::Writer(
 {
 }
 
+TileLayerStream::Writer::Writer(
+    std::string& output,
+    StringPoolOffsetMap& stringPoolOffsets,
+    bool differentialStringUpdates)
+    : output_(&output),
+      stringPoolOffsets_(stringPoolOffsets),
+      differentialStringUpdates_(differentialStringUpdates)
+{
+}
+
+void TileLayerStream::Writer::enableCompression(int level)
+{
+    compression_ = std::make_shared<Compression>(level);
+}
+
 void TileLayerStream::Writer::write(TileLayer::Ptr const& tileLayer)
 {
+    auto span = Trace::currentSpan("TileLayerStream::Writer::write");
+
+    // The client's string pool offset is only advanced once the layer
+    // was written as well, and a caller's output is rolled back if
+    // either message fails, so the output never holds a partial write.
+    auto const writeStart = output_ ? output_->size() : 0;
+    std::optional<simfil::StringId> updatedStringOffset;
     if (auto modelPool = std::dynamic_pointer_cast<simfil::ModelPool>(tileLayer)) {
         if (auto strings = modelPool->strings()) {
-            auto& highestStringKnownToClient = stringPoolOffsets_[tileLayer->nodeId()];
+            auto offsetIt = stringPoolOffsets_.find(tileLayer->nodeId());
+            auto highestStringKnownToClient = offsetIt != stringPoolOffsets_.end() ? offsetIt->second : 0;
             auto highestString = strings->highest();
 
             if (highestStringKnownToClient < highestString)
             {
                 // Need to send the client an update for the string pool.
-                std::stringstream serializedStrings;
                 auto stringUpdateOffset = 0;
                 if (differentialStringUpdates_)
                     stringUpdateOffset = highestStringKnownToClient + 1;
-                strings->write(serializedStrings, stringUpdateOffset);
-                sendMessage(serializedStrings.str(), MessageType::StringPool);
-                highestStringKnownToClient = highestString;
+                writeMessage(MessageType::StringPool, [&](std::ostream& out) {
+                    strings->write(out, stringUpdateOffset);
+                });
+                updatedStringOffset = highestString;
             }
         }
     }
 
-    // Send the actual layer
-    std::stringstream serializedLayer;
-    auto start = std::chrono::system_clock::now();
-    tileLayer->write(serializedLayer);
-    auto bytes = serializedLayer.str();
-    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now() - start);
-    log().trace("Writing {} kB took {} ms.", bytes.size()/1000, elapsed.count());
-
+    auto featureLayer = std::dynamic_pointer_cast<TileFeatureLayer>(tileLayer);
+    const auto isDelta = featureLayer && featureLayer->deltaInfo();
+    const auto isQuantized = featureLayer && featureLayer->vertexPrecision().first > 0.;
     const auto layerType = tileLayer->layerInfo()->type_;
-    const auto messageType = [&layerType]() {
+    const auto messageType = [&layerType, &isDelta]() {
         switch (layerType) {
         case mapget::LayerType::Features:
-            return MessageType::TileFeatureLayer;
+            return isDelta ? MessageType::TileFeatureLayerDelta : MessageType::TileFeatureLayer;
         case mapget::LayerType::SourceData:
             return MessageType::TileSourceDataLayer;
         default:
@@ -166,36 +575,118 @@ void TileLayerStream::Writer::write(TileLayer::Ptr const& tileLayer)
         return MessageType::None;
     }();
 
-    sendMessage(std::move(bytes), messageType);
+    // Send the actual layer
+    try {
+        auto headerMsgType = messageType;
+        if (isQuantized)
+            headerMsgType = static_cast<MessageType>(static_cast<uint8_t>(messageType) | QuantizedMessageFlag);
+        writeMessage(headerMsgType, [&](std::ostream& out) {
+            auto start = std::chrono::system_clock::now();
+            auto startPos = out.tellp();
+            if (isDelta) {
+                bitsery::Serializer<bitsery::OutputStreamAdapter> s(out);
+                s.object(*featureLayer->deltaInfo());
+            }
+            tileLayer->write(out);
+            auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now() - start);
+            log().trace("Writing {} kB took {} ms.", (out.tellp() - startPos)/1000, elapsed.count());
+        });
+    }
+    catch (...) {
+        if (output_)
+            output_->resize(writeStart);
+        throw;
+    }
+
+    if (updatedStringOffset)
+        stringPoolOffsets_[tileLayer->nodeId()] = *updatedStringOffset;
 }
 
-void TileLayerStream::Writer::sendMessage(std::string&& bytes, TileLayerStream::MessageType msgType)
+void TileLayerStream::Writer::writeMessage(
+    TileLayerStream::MessageType msgType,
+    std::function<void(std::ostream&)> const& writeValue)
 {
-    // TODO refactor the preparation of tile layer & field dicts storage format
-    //  such that the encoding logic is not split over multiple functions.
-
-    std::stringstream message;
-    bitsery::Serializer<bitsery::OutputStreamAdapter> s(message);
-
-    // Write protocol version
-    s.object(CurrentProtocolVersion);
-
-    // Write message type
-    s.value1b(msgType);
-
-    // Write content length
-    s.value4b((uint32_t)bytes.size());
+    // Serialize into the caller's output, or into the internal buffer,
+    // which keeps its capacity across messages.
+    auto& message = output_ ? *output_ : buffer_;
+    if (!output_)
+        message.clear();
+    auto messageStart = message.size();
+
+    auto writeHeader = [](std::string& target, MessageType headerMsgType, uint32_t valueSize)
+    {
+        StringOutputStream headerStream(target);
+        bitsery::Serializer<bitsery::OutputStreamAdapter> s(headerStream);
+
+        // Write protocol version
+        s.object(CurrentProtocolVersion);
+
+        // Write message type
+        s.value1b(headerMsgType);
+
+        // Write content length
+        s.value4b(valueSize);
+    };
+
+    // Reserve the header, then serialize the value right behind it.
+    // If serialization fails, the output is reset to its previous size,
+    // so it does not keep a header without its value.
+    auto headerMsgType = msgType;
+    try {
+        writeHeader(message, headerMsgType, 0);
+        if (compression_ && msgType != MessageType::EndOfStream) {
+            // Serialize into the reusable plain value buffer first.
+            auto& plainValue = compression_->plainValue_;
+            plainValue.clear();
+            StringOutputStream plainValueStream(plainValue);
+            writeValue(plainValueStream);
+
+            if (plainValue.size() >= minCompressedValueSize) {
+                auto valueStart = message.size();
+                auto bound = ZSTD_compressBound(plainValue.size());
+                message.resize(valueStart + bound);
+                auto compressedSize = ZSTD_compressCCtx(
+                    compression_->context_,
+                    message.data() + valueStart,
+                    bound,
+                    plainValue.data(),
+                    plainValue.size(),
+                    compression_->level_);
+                if (ZSTD_isError(compressedSize))
+                    raiseFmt("Failed to compress message: {}", ZSTD_getErrorName(compressedSize));
+                message.resize(valueStart + compressedSize);
+                headerMsgType = static_cast<MessageType>(static_cast<uint8_t>(msgType) | CompressedMessageFlag);
+            }
+            else {
+                message.append(plainValue);
+            }
+        }
+        else {
+            StringOutputStream valueStream(message);
+            writeValue(valueStream);
+        }
+    }
+    catch (...) {
+        message.resize(messageStart);
+        throw;
+    }
 
-    // Write content
-    message << bytes;
+    // Now that the content length is known, fill in the header.
+    // The header is small enough to not require a heap allocation.
+    std::string header;
+    writeHeader(header, headerMsgType, (uint32_t)(message.size() - messageStart - MessageHeaderSize));
+    std::copy(header.begin(), header.end(), message.begin() + (std::ptrdiff_t)messageStart);
 
     // Notify result
-    onMessage_(message.str(), msgType);
+    if (onMessage_)
+        onMessage_(
+            std::string_view(message).substr(messageStart),
+            static_cast<MessageType>(static_cast<uint8_t>(msgType) & ~QuantizedMessageFlag));
 }
 
 void TileLayerStream::Writer::sendEndOfStream()
 {
-    sendMessage("", MessageType::EndOfStream);
+    writeMessage(MessageType::EndOfStream, [](std::ostream&) {});
 }
 
 std::shared_ptr<StringPool> TileLayerStream::StringPoolCache::getStringPool(const std::string_view& nodeId)
@@ -208,7 +699,7 @@ std::shared_ptr<StringPool> TileLayerStream::StringPoolCache::getStringPool(cons
         }
     }
     {
-        std::unique_lock stringPoolWriteLock(stringPoolCacheMutex_, std::defer_lock);
+        std::unique_lock stringPoolWriteLock(stringPoolCacheMutex_);
         // Was it inserted already now?
         auto it = stringPoolPerNodeId_.find(std::string(nodeId));
         if (it != stringPoolPerNodeId_.end())
@@ -222,6 +713,7 @@ std::shared_ptr<StringPool> TileLayerStream::StringPoolCache::getStringPool(cons
 TileLayerStream::StringPoolOffsetMap TileLayerStream::StringPoolCache::stringPoolOffsets() const
 {
     auto result = StringPoolOffsetMap();
+    std::shared_lock stringPoolReadLock(stringPoolCacheMutex_);
     for (auto const& [nodeId, stringPool] : stringPoolPerNodeId_)
         result.emplace(nodeId, stringPool->highest());
     return result;
@@ -69,6 +69,59 @@ TileId TileId::fromWgs84(double longitude, double latitude, uint16_t zoomLevel)
     return {(uint16_t)x, (uint16_t)y, zoomLevel};
 }
 
+std::vector<TileId> TileId::tilesInBbox(Point const& sw, Point const& ne, uint16_t zoomLevel, size_t maxCount)
+{
+    if (zoomLevel > 15)
+        raiseFmt("Zoom level {} is not supported, the highest zoom level is 15.", zoomLevel);
+    auto const numCols = static_cast<int64_t>(1ull << (zoomLevel + 1));
+
+    // Keep the eastern edge out of the next column, so that a box
+    // which ends at lon=180 does not wrap around to column zero.
+    auto const crossesAntimeridian = sw.x > ne.x;
+    auto const eastLon = crossesAntimeridian ? ne.x : std::min(ne.x, MAX_LON - 1e-9);
+    auto const westLon = crossesAntimeridian ? sw.x : std::max(sw.x, MIN_LON);
+    auto const nw = fromWgs84(westLon, std::clamp(ne.y, MIN_LAT, MAX_LAT), zoomLevel);
+    auto const se = fromWgs84(eastLon, std::clamp(sw.y, MIN_LAT, MAX_LAT), zoomLevel);
+
+    auto const numColsInBox = (static_cast<int64_t>(se.x()) - nw.x() + numCols) % numCols + 1;
+    auto const numRowsInBox = static_cast<int64_t>(se.y()) - nw.y() + 1;
+    if (numRowsInBox <= 0)
+        return {};
+    if (static_cast<uint64_t>(numColsInBox * numRowsInBox) > maxCount)
+        raiseFmt("Bounding box covers {} tiles at zoom level {}, at most {} are allowed.",
+            numColsInBox * numRowsInBox, zoomLevel, maxCount);
+
+    std::vector<TileId> result;
+    result.reserve(numColsInBox * numRowsInBox);
+    for (auto y = static_cast<int64_t>(nw.y()); y <= se.y(); ++y)
+        for (auto col = 0; col < numColsInBox; ++col)
+            result.emplace_back(
+                static_cast<uint16_t>((nw.x() + col) % numCols),
+                static_cast<uint16_t>(y),
+                zoomLevel);
+    return result;
+}
+
+void TileId::sortByDistance(std::vector<TileId>& tiles, Point const& focus)
+{
+    auto distance = [&focus](TileId const& tile)
+    {
+        auto center = tile.center();
+        auto dx = std::abs(center.x - focus.x);
+        dx = std::min(dx, LON_EXTENT - dx);
+        auto dy = center.y - focus.y;
+        return dx * dx + dy * dy;
+    };
+
+    std::vector<std::pair<double, TileId>> keyed;
+    keyed.reserve(tiles.size());
+    for (auto const& tile : tiles)
+        keyed.emplace_back(distance(tile), tile);
+    std::stable_sort(keyed.begin(), keyed.end(), [](auto const& l, auto const& r) { return l.first < r.first; });
+    for (size_t i = 0; i < tiles.size(); ++i)
+        tiles[i] = keyed[i].second;
+}
+
 TileId TileId::neighbor(int32_t offsetX, int32_t offsetY) const
 {
     if (glm::abs(offsetX) > 1 || glm::abs(offsetY) > 1) {
@@ -63,7 +63,16 @@ namespace py = pybind11;
 class PyRequest : public LayerTilesRequest
 {
 public:
-    using LayerTilesRequest::LayerTilesRequest;
+    PyRequest(std::string mapId, std::string layerId, std::vector<TileId> tiles)
+        : LayerTilesRequest(std::move(mapId), std::move(layerId), std::move(tiles))
+    {
+        // Results arrive on a background thread, so wake up
+        // next() when the request is done without a result.
+        onDone_ = [this](RequestStatus) {
+            std::unique_lock lock(bufferMutex_);
+            bufferSignal_.notify_all();
+        };
+    }
 
     void notifyResult(TileLayer::Ptr result) override {
         std::unique_lock lock(bufferMutex_);
@@ -163,10 +172,18 @@ void bindHttpClient(py::module_& m)
         )pbdoc", py::call_guard<py::gil_scoped_release>());
 
     py::class_<HttpClient, std::shared_ptr<HttpClient>>(m, "Client")
-        .def(py::init<const std::string&, uint16_t>(),
+        .def(py::init([](const std::string& host, uint16_t port) {
+                 // Destroying the client waits for running requests, whose
+                 // callbacks may need the GIL, so the GIL is released for it.
+                 return std::shared_ptr<HttpClient>(new HttpClient(host, port), [](HttpClient* client) {
+                     py::gil_scoped_release release;
+                     delete client;
+                 });
+             }),
              R"pbdoc(
                 Connect to a running mapget HTTP service. Immediately calls the /sources
                 endpoint, and caches the result for the lifetime of this object.
+                Connections are kept alive, and requests are processed in the background.
             )pbdoc",
              py::arg("host"), py::arg("port"))
         .def("sources", [](HttpClient& self){
@@ -186,7 +203,19 @@ void bindHttpClient(py::module_& m)
             },
             R"pbdoc(
                 Post a Request for a number of tiles from a particular map layer.
-                Returns the request object which was put in.
+                Returns the request object which was put in. Results can be
+                consumed by iterating over it while they arrive.
+            )pbdoc",
+            py::arg("request"))
+        .def(
+            "request",
+            [](HttpClient& self, std::vector<std::shared_ptr<PyRequest>> const& requests) {
+                self.request(std::vector<LayerTilesRequest::Ptr>(requests.begin(), requests.end()));
+                return requests;
+            },
+            R"pbdoc(
+                Post several Requests with a single call to the service.
+                Returns the list of request objects which was put in.
             )pbdoc",
-            py::arg("request"));
+            py::arg("requests"));
 }
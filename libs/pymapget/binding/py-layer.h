@@ -197,7 +197,11 @@ void bindTileLayer(py::module_& m)
         .def(
             "geojson",
             [](TileFeatureLayer& self)
-            { return self.toJson().dump(); },
+            {
+                std::string result;
+                self.writeJson(result);
+                return result;
+            },
             R"pbdoc(
             Convert this tile to a GeoJSON feature collection.
         )pbdoc");
@@ -6,6 +6,7 @@
 #include "mapget/model/info.h"
 #include "mapget/model/featurelayer.h"
 #include "mapget/model/stream.h"
+#include "metrics.h"
 
 namespace mapget
 {
@@ -31,9 +32,18 @@ public:
      */
     void putTileLayer(TileLayer::Ptr const& l);
 
+    /**
+     * Upsert a TileLayer under the given key, which may differ from the
+     * layer's own key, e.g. to cache a filtered variant of the layer.
+     */
+    void putTileLayer(MapTileKey const& tileKey, TileLayer::Ptr const& l);
+
     /** Used by DataSource to retrieve a cached TileLayer. */
     TileLayer::Ptr getTileLayer(MapTileKey const& tileKey, DataSourceInfo const& dataSource);
 
+    /** Retrieve a cached TileLayer, resolving its layer info with the given function. */
+    TileLayer::Ptr getTileLayer(MapTileKey const& tileKey, LayerInfoResolveFun const& layerInfoProvider);
+
     /** Override for CachedStringPoolCache::getStringPool() */
     std::shared_ptr<StringPool> getStringPool(std::string_view const&) override;
 
@@ -43,13 +53,13 @@ public:
     virtual std::optional<std::string> getTileLayerBlob(MapTileKey const& k) = 0;
 
     /** Abstract: Upsert (update or insert) a TileLayer blob. */
-    virtual void putTileLayerBlob(MapTileKey const& k, std::string const& v) = 0;
+    virtual void putTileLayerBlob(MapTileKey const& k, std::string_view const& v) = 0;
 
     /** Abstract: Retrieve a string-pool blob for a sourceNodeId. */
     virtual std::optional<std::string> getStringPoolBlob(std::string_view const& sourceNodeId) = 0;
 
     /** Abstract: Upsert (update or insert) a string-pool blob. */
-    virtual void putStringPoolBlob(std::string_view const& sourceNodeId, std::string const& v) = 0;
+    virtual void putStringPoolBlob(std::string_view const& sourceNodeId, std::string_view const& v) = 0;
 
     // Override this method if your cache implementation has special stats.
 
@@ -61,6 +71,11 @@ public:
      */
     virtual nlohmann::json getStatistics() const;
 
+    /**
+     * Name of the cache backend, which labels the cache latency
+     * histograms of the /metrics endpoint.
+     */
+    virtual std::string backendName() const { return "custom"; }
 
 protected:
     // Used by DataSource::cachedStringPoolOffset()
@@ -73,6 +88,16 @@ protected:
     // Statistics
     int64_t cacheHits_ = 0;
     int64_t cacheMisses_ = 0;
+
+private:
+    // Latency histograms, which are resolved on first use,
+    // as the backend name is not known during construction.
+    Metrics::Histogram& getLatency();
+    Metrics::Histogram& putLatency();
+    void resolveMetrics();
+    std::once_flag metricsResolved_;
+    Metrics::Histogram* getLatency_ = nullptr;
+    Metrics::Histogram* putLatency_ = nullptr;
 };
 
 }
@@ -27,17 +27,19 @@ public:
     std::optional<std::string> getTileLayerBlob(MapTileKey const& k) override;
 
     /** Upsert a TileLayer blob. */
-    void putTileLayerBlob(MapTileKey const& k, std::string const& v) override;
+    void putTileLayerBlob(MapTileKey const& k, std::string_view const& v) override;
 
     /** Retrieve a string-pool blob for a sourceNodeId -> No-Op */
     std::optional<std::string> getStringPoolBlob(std::string_view const& sourceNodeId) override {return {};}
 
     /** Upsert a string-pool blob. -> No-Op */
-    void putStringPoolBlob(std::string_view const& sourceNodeId, std::string const& v) override {}
+    void putStringPoolBlob(std::string_view const& sourceNodeId, std::string_view const& v) override {}
 
     /** Enriches the statistics with info about the number of cached tiles. */
     nlohmann::json getStatistics() const override;
 
+    std::string backendName() const override { return "memory"; }
+
 private:
     // Cached tile blobs.
     std::shared_mutex cacheMutex_;
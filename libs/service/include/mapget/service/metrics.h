@@ -0,0 +1,122 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace mapget
+{
+
+/**
+ * Process-wide registry of counters and latency histograms, which
+ * are rendered in the Prometheus text exposition format by the
+ * HttpService's /metrics endpoint.
+ *
+ * Registering a metric takes a lock, so callers look up their metrics
+ * once and keep the returned reference. Recording values is lock-free.
+ */
+class Metrics
+{
+public:
+    using Labels = std::vector<std::pair<std::string, std::string>>;
+
+    /** Monotonic counter, which may be incremented from any thread. */
+    class Counter
+    {
+    public:
+        void add(uint64_t n = 1) { value_.fetch_add(n, std::memory_order_relaxed); }
+        [[nodiscard]] uint64_t value() const { return value_.load(std::memory_order_relaxed); }
+
+    private:
+        std::atomic_uint64_t value_{0};
+    };
+
+    /** Value which may go up and down, e.g. a number of buffered bytes. */
+    class Gauge
+    {
+    public:
+        void add(int64_t n) { value_.fetch_add(n, std::memory_order_relaxed); }
+        void sub(int64_t n) { value_.fetch_sub(n, std::memory_order_relaxed); }
+        [[nodiscard]] int64_t value() const { return value_.load(std::memory_order_relaxed); }
+
+    private:
+        std::atomic_int64_t value_{0};
+    };
+
+    /**
+     * Latency histogram with fixed buckets. Durations are reported
+     * in seconds. An observation increments one bucket and the sum.
+     */
+    class Histogram
+    {
+    public:
+        /** Upper bucket bounds in microseconds. The +Inf bucket is implicit. */
+        static constexpr std::array<uint64_t, 16> bucketBoundsUs = {
+            100, 250, 500,
+            1'000, 2'500, 5'000,
+            10'000, 25'000, 50'000,
+            100'000, 250'000, 500'000,
+            1'000'000, 2'500'000, 5'000'000,
+            10'000'000};
+
+        /** Record a single duration. */
+        void observe(std::chrono::steady_clock::duration d);
+
+        /** Records the time between its construction and destruction. */
+        class ScopedTimer
+        {
+        public:
+            explicit ScopedTimer(Histogram& h) : histogram_(h) {}
+            ~ScopedTimer() { histogram_.observe(std::chrono::steady_clock::now() - start_); }
+            ScopedTimer(ScopedTimer const&) = delete;
+            ScopedTimer& operator=(ScopedTimer const&) = delete;
+
+        private:
+            Histogram& histogram_;
+            std::chrono::steady_clock::time_point start_ = std::chrono::steady_clock::now();
+        };
+
+        /** Get the (non-cumulative) number of observations per bucket. */
+        [[nodiscard]] std::array<uint64_t, bucketBoundsUs.size() + 1> bucketCounts() const;
+
+        /** Get the sum of all observed durations in microseconds. */
+        [[nodiscard]] uint64_t sumUs() const { return sumUs_.load(std::memory_order_relaxed); }
+
+    private:
+        std::array<std::atomic_uint64_t, bucketBoundsUs.size() + 1> buckets_{};
+        std::atomic_uint64_t sumUs_{0};
+    };
+
+    /** Get the process-wide metrics registry. */
+    static Metrics& get();
+
+    /**
+     * Get or create the counter with the given name and labels. By
+     * convention, counter names end with `_total`. The returned reference
+     * stays valid for the lifetime of the process.
+     */
+    Counter& counter(std::string const& name, std::string const& help, Labels const& labels = {});
+
+    /** Get or create the gauge with the given name and labels. */
+    Gauge& gauge(std::string const& name, std::string const& help, Labels const& labels = {});
+
+    /** Get or create the histogram with the given name and labels. */
+    Histogram& histogram(std::string const& name, std::string const& help, Labels const& labels = {});
+
+    /** Render all metrics in the Prometheus text exposition format (v0.0.4). */
+    [[nodiscard]] std::string toPrometheusText() const;
+
+private:
+    Metrics();
+    ~Metrics();
+
+    struct Impl;
+    std::unique_ptr<Impl> impl_;
+};
+
+}  // namespace mapget
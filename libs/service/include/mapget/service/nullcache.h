@@ -18,13 +18,15 @@ public:
     std::optional<std::string> getTileLayerBlob(MapTileKey const& k) override;
 
     /** Upsert a TileLayer blob - does nothing. */
-    void putTileLayerBlob(MapTileKey const& k, std::string const& v) override;
+    void putTileLayerBlob(MapTileKey const& k, std::string_view const& v) override;
 
     /** Retrieve a string-pool blob for a sourceNodeId - always returns empty. */
     std::optional<std::string> getStringPoolBlob(std::string_view const& sourceNodeId) override;
 
     /** Upsert a string-pool blob - does nothing. */
-    void putStringPoolBlob(std::string_view const& sourceNodeId, std::string const& v) override;
+    void putStringPoolBlob(std::string_view const& sourceNodeId, std::string_view const& v) override;
+
+    std::string backendName() const override { return "null"; }
 };
 
 }
\ No newline at end of file
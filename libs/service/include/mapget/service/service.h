@@ -4,9 +4,13 @@
 #include "datasource.h"
 #include "mapget/model/sourcedatalayer.h"
 #include "mapget/model/layer.h"
+#include "mapget/trace.h"
 #include "memcache.h"
 
+#include <atomic>
+#include <chrono>
 #include <condition_variable>
+#include <limits>
 #include <mutex>
 #include <utility>
 
@@ -43,9 +47,22 @@ public:
     /** Get the current status of the request. */
     RequestStatus getStatus();
 
+    /**
+     * Get the number of tiles which were skipped, because they are outside
+     * the zoom levels or coverage of every data source for the map layer.
+     * There is no result for these tiles.
+     */
+    size_t getSkippedTileCount() const;
+
     /** Wait for the request to be done. */
     void wait();
 
+    /**
+     * Wait for the request to be done, but at most for the given duration.
+     * Returns true if the request is done.
+     */
+    bool wait(std::chrono::steady_clock::duration timeout);
+
     /** Check whether the request is done or still running. */
     bool isDone();
 
@@ -61,6 +78,29 @@ public:
      */
     std::vector<TileId> tiles_;
 
+    /**
+     * Optional simfil expression. If set, only features for which it
+     * evaluates to true are passed to onFeatureLayer. The service filters
+     * each result tile, and HttpClient sends the filter to the remote
+     * service. Tiles for which the filter cannot be evaluated are passed
+     * on without features, and with the evaluation error set.
+     */
+    std::string filter_;
+
+    /**
+     * Optional trace, which records spans for the processing of
+     * this request's tiles, e.g. queueing, filling and caching.
+     * Export it with Trace::toChromeJson() once the request is done.
+     */
+    Trace::Ptr trace_;
+
+    /**
+     * Identity of the client which issued this request. The service
+     * shares its workers fairly between clients (see Service::setClientWeight()).
+     * Requests without a client id share one anonymous client's share.
+     */
+    std::string clientId_;
+
     /**
      * The callback function which is called when all tiles have been processed.
      */
@@ -77,6 +117,7 @@ public:
 
 protected:
     virtual void notifyResult(TileLayer::Ptr);
+    void notifySkipped();
     void setStatus(RequestStatus s);
     void notifyStatus();
     nlohmann::json toJson();
@@ -95,6 +136,18 @@ private:
     // So the requester can track how many results have been received.
     size_t resultCount_ = 0;
 
+    // So the service can complete the request without results
+    // for tiles which no data source covers.
+    size_t skippedTileCount_ = 0;
+
+    // So the service can report how long tiles waited for a worker,
+    // and count each tile which waits for an identical job only once.
+    std::chrono::steady_clock::time_point queuedAt_;
+    size_t coalescedTileIndex_ = std::numeric_limits<size_t>::max();
+
+    // Set while the consumer cannot take more results, see Service::pause().
+    std::atomic_bool paused_ = false;
+
     // Mutex/condition variable for reading/setting request status.
     std::mutex statusMutex_;
     std::condition_variable statusConditionVariable_;
@@ -167,6 +220,25 @@ public:
      */
     void abort(LayerTilesRequest::Ptr const& r);
 
+    /**
+     * Stop scheduling the remaining tiles of the given request, e.g. while
+     * its consumer cannot keep up with the results. Tiles which are already
+     * being processed are still delivered. This does not lock the service,
+     * so it may be called from a result callback.
+     */
+    void pause(LayerTilesRequest::Ptr const& r);
+
+    /** Continue scheduling the remaining tiles of a paused request. */
+    void resume(LayerTilesRequest::Ptr const& r);
+
+    /**
+     * Set the share of worker time of a client, relative to other clients,
+     * for requests with the given LayerTilesRequest::clientId_. Workers pick
+     * the next tile from the client which has received the fewest tiles in
+     * proportion to its weight. The default weight is 1.
+     */
+    void setClientWeight(std::string const& clientId, double weight);
+
     /** DataSourceInfo for all data sources which have been added to this Service. */
     std::vector<DataSourceInfo> info(std::optional<AuthHeaders> const& clientHeaders = {});
 
@@ -2,9 +2,11 @@
 
 #include "cache.h"
 #include <sqlite3.h>
+#include <condition_variable>
 #include <memory>
 #include <mutex>
 #include <string>
+#include <thread>
 
 namespace mapget
 {
@@ -12,7 +14,9 @@ namespace mapget
 /**
  * A persistent cache implementation that stores layers and string pools
  * in SQLite. Oldest tiles are removed automatically in FIFO order when cacheMaxTiles is
- * reached.
+ * reached. The eviction runs on a background thread, and the number of stored tiles
+ * is persisted alongside the tiles, so opening a large cache does not require a
+ * full table scan. String pools are only deserialized on first use.
  */
 class SQLiteCache : public Cache
 {
@@ -24,15 +28,35 @@ public:
     ~SQLiteCache() override;
 
     std::optional<std::string> getTileLayerBlob(MapTileKey const& k) override;
-    void putTileLayerBlob(MapTileKey const& k, std::string const& v) override;
+    void putTileLayerBlob(MapTileKey const& k, std::string_view const& v) override;
     std::optional<std::string> getStringPoolBlob(std::string_view const& sourceNodeId) override;
-    void putStringPoolBlob(std::string_view const& sourceNodeId, std::string const& v) override;
+    void putStringPoolBlob(std::string_view const& sourceNodeId, std::string_view const& v) override;
+
+    /**
+     * Block until the background eviction has brought the number of
+     * stored tiles down to cacheMaxTiles. Returns immediately if no
+     * eviction is pending.
+     */
+    void waitForPendingEviction();
+
+    /**
+     * Adds the following values to the default cache statistics:
+     * `sqlite-tile-count`: Number of tiles currently stored in the database.
+     */
+    nlohmann::json getStatistics() const override;
+
+    std::string backendName() const override { return "sqlite"; }
 
 private:
     void initDatabase();
     void executeSQL(const std::string& sql);
     void prepareStatements();
-    void cleanupOldestTiles();
+    int64_t storedTileCount() const;
+    void evictionWorker();
+
+    // Number of tiles which are deleted in one go by the eviction worker.
+    // The database lock is released between batches.
+    static constexpr int64_t evictionBatchSize_ = 256;
 
     sqlite3* db_{nullptr};
     std::string dbPath_;
@@ -40,6 +64,13 @@ private:
     bool clearCache_;
     mutable std::mutex dbMutex_;
 
+    // Background eviction state, guarded by dbMutex_.
+    std::thread evictionThread_;
+    std::condition_variable evictionCondition_;
+    bool evictionPending_ = false;
+    bool evictionRunning_ = false;
+    bool shouldStop_ = false;
+
     // Prepared statements for performance
     struct Statements {
         sqlite3_stmt* getTile{nullptr};
@@ -48,7 +79,7 @@ private:
         sqlite3_stmt* deleteTile{nullptr};
         sqlite3_stmt* getStringPool{nullptr};
         sqlite3_stmt* putStringPool{nullptr};
-        sqlite3_stmt* getOldestTile{nullptr};
+        sqlite3_stmt* evictOldestTiles{nullptr};
         sqlite3_stmt* getTileCount{nullptr};
     } stmts_;
 };
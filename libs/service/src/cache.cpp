@@ -1,5 +1,6 @@
 #include "cache.h"
 #include "mapget/log.h"
+#include "mapget/trace.h"
 
 #include "fmt/format.h"
 
@@ -29,23 +30,35 @@ std::shared_ptr<StringPool> Cache::getStringPool(const std::string_view& nodeId)
         std::shared_ptr<StringPool> stringPool = std::make_shared<StringPool>(nodeId);
         auto cachedStringsBlob = getStringPoolBlob(nodeId);
         if (cachedStringsBlob) {
-            // Read the string pool from the stream.
-            std::stringstream stream;
-            stream << *cachedStringsBlob;
-
-            // First, read the header and the datasource node id.
-            // These must match what we expect.
-            TileLayerStream::MessageType streamMessageType;
-            uint32_t streamMessageSize;
-            TileLayerStream::Reader::readMessageHeader(stream, streamMessageType, streamMessageSize);
-            auto streamDataSourceNodeId = StringPool::readDataSourceNodeId(stream);
-            if (streamMessageType != TileLayerStream::MessageType::StringPool || streamDataSourceNodeId != nodeId) {
-                raise("Stream header error while parsing string pool.");
-            }
+            try {
+                // Read the string pool directly from the blob.
+                auto blobBytes = std::as_bytes(std::span(cachedStringsBlob->data(), cachedStringsBlob->size()));
+
+                // First, read the header and the datasource node id.
+                // These must match what we expect.
+                TileLayerStream::MessageType streamMessageType;
+                uint32_t streamMessageSize;
+                if (!TileLayerStream::Reader::readMessageHeader(blobBytes, streamMessageType, streamMessageSize)) {
+                    raise("Stream header error while parsing string pool.");
+                }
+                ByteSpanInputStream stream(blobBytes.subspan(TileLayerStream::MessageHeaderSize));
+                auto streamDataSourceNodeId = StringPool::readDataSourceNodeId(stream);
+                if (streamMessageType != TileLayerStream::MessageType::StringPool || streamDataSourceNodeId != nodeId) {
+                    raise("Stream header error while parsing string pool.");
+                }
 
-            // Now, actually read the string pool message.
-            stringPool->read(stream);
-            stringPoolOffsets_.emplace(nodeId, stringPool->highest());
+                // Now, actually read the string pool message.
+                stringPool->read(stream);
+                stringPoolOffsets_.emplace(nodeId, stringPool->highest());
+            }
+            catch (std::exception const& e) {
+                // E.g., the blob was written with an incompatible protocol version.
+                // Treat it like a miss: Start over with an empty pool, so the
+                // offset stays at zero, and the next written tile layer
+                // overwrites the blob with the full string pool.
+                log().warn("Could not read cached string pool of {}: {}", nodeId, e.what());
+                stringPool = std::make_shared<StringPool>(nodeId);
+            }
         }
         auto [itNew, _] = stringPoolPerNodeId_.emplace(nodeId, stringPool);
         return itNew->second;
@@ -62,13 +75,8 @@ nlohmann::json Cache::getStatistics() const {
 
 TileLayer::Ptr Cache::getTileLayer(const MapTileKey& tileKey, DataSourceInfo const& dataSource)
 {
-    auto tileBlob = getTileLayerBlob(tileKey);
-    if (!tileBlob) {
-        ++cacheMisses_;
-        return nullptr;
-    }
-    TileLayer::Ptr result;
-    TileLayerStream::Reader tileReader(
+    return getTileLayer(
+        tileKey,
         [&dataSource, &tileKey](auto&& mapId, auto&& layerId) {
             if (dataSource.mapId_ != mapId) {
                 raiseFmt(
@@ -78,11 +86,34 @@ TileLayer::Ptr Cache::getTileLayer(const MapTileKey& tileKey, DataSourceInfo con
                     dataSource.mapId_);
             }
             return dataSource.getLayer(std::string(layerId));
-        },
+        });
+}
+
+TileLayer::Ptr Cache::getTileLayer(const MapTileKey& tileKey, LayerInfoResolveFun const& layerInfoProvider)
+{
+    Metrics::Histogram::ScopedTimer timer(getLatency());
+    auto span = Trace::currentSpan("Cache::getTileLayer");
+    auto tileBlob = getTileLayerBlob(tileKey);
+    if (!tileBlob) {
+        ++cacheMisses_;
+        return nullptr;
+    }
+    TileLayer::Ptr result;
+    TileLayerStream::Reader tileReader(
+        layerInfoProvider,
         [&](auto&& parsedLayer){result = parsedLayer;},
         shared_from_this());
 
-    tileReader.read(*tileBlob);
+    try {
+        tileReader.read(*tileBlob);
+    }
+    catch (std::exception const& e) {
+        // E.g., the blob was written with an incompatible protocol version.
+        // Treat it like a miss, so the tile is fetched and cached again.
+        log().warn("Could not read cached tile {}: {}", tileKey.toString(), e.what());
+        ++cacheMisses_;
+        return nullptr;
+    }
     ++cacheHits_;
     log().debug("Returned tile from cache: {}", tileKey.tileId_.value_);
     return result;
@@ -90,27 +121,61 @@ TileLayer::Ptr Cache::getTileLayer(const MapTileKey& tileKey, DataSourceInfo con
 
 void Cache::putTileLayer(TileLayer::Ptr const& l)
 {
+    putTileLayer(MapTileKey(*l), l);
+}
+
+void Cache::putTileLayer(MapTileKey const& tileKey, TileLayer::Ptr const& l)
+{
+    Metrics::Histogram::ScopedTimer timer(putLatency());
+    auto span = Trace::currentSpan("Cache::putTileLayer");
     std::unique_lock stringPoolOffsetLock(stringPoolOffsetMutex_);
     TileLayerStream::Writer tileWriter(
-        [&l, this](auto&& msg, auto&& msgType)
+        [&l, &tileKey, this](auto&& msg, auto&& msgType)
         {
             if (msgType == TileLayerStream::MessageType::TileFeatureLayer ||
                 msgType == TileLayerStream::MessageType::TileSourceDataLayer)
-                putTileLayerBlob(MapTileKey(*l), msg);
+                putTileLayerBlob(tileKey, msg);
             else if (msgType == TileLayerStream::MessageType::StringPool)
                 putStringPoolBlob(l->nodeId(), msg);
         },
         stringPoolOffsets_,
         /* differentialStringUpdates= */ false);
-    log().debug("Writing tile layer to cache: {}", MapTileKey(*l).toString());
+    log().debug("Writing tile layer to cache: {}", tileKey.toString());
     tileWriter.write(l);
 }
 
+Metrics::Histogram& Cache::getLatency()
+{
+    std::call_once(metricsResolved_, [this]{ resolveMetrics(); });
+    return *getLatency_;
+}
+
+Metrics::Histogram& Cache::putLatency()
+{
+    std::call_once(metricsResolved_, [this]{ resolveMetrics(); });
+    return *putLatency_;
+}
+
+void Cache::resolveMetrics()
+{
+    getLatency_ = &Metrics::get().histogram(
+        "mapget_cache_get_seconds",
+        "Time to look up and parse a cached tile layer.",
+        {{"backend", backendName()}});
+    putLatency_ = &Metrics::get().histogram(
+        "mapget_cache_put_seconds",
+        "Time to serialize and store a tile layer in the cache.",
+        {{"backend", backendName()}});
+}
+
 simfil::StringId Cache::cachedStringPoolOffset(std::string const& nodeId)
 {
     if (nodeId.empty()) {
         raise("Tried to query cached string pool offset for empty node ID!");
     }
+    // String pools are loaded lazily, so make sure that the
+    // offset for the node is known before it is looked up.
+    getStringPool(nodeId);
     std::unique_lock stringPoolOffsetLock(stringPoolOffsetMutex_);
     auto it = stringPoolOffsets_.find(nodeId);
     if (it != stringPoolOffsets_.end()) {
@@ -15,7 +15,7 @@ std::optional<std::string> MemCache::getTileLayerBlob(const MapTileKey& k)
     return {};
 }
 
-void MemCache::putTileLayerBlob(const MapTileKey& k, const std::string& v)
+void MemCache::putTileLayerBlob(const MapTileKey& k, std::string_view const& v)
 {
     std::unique_lock cacheLock(cacheMutex_);
     auto ks = k.toString();
@@ -0,0 +1,189 @@
+#include "metrics.h"
+#include "mapget/log.h"
+
+#include "fmt/format.h"
+
+#include <algorithm>
+#include <map>
+#include <mutex>
+
+namespace mapget
+{
+
+namespace
+{
+
+std::string escapeLabelValue(std::string_view value)
+{
+    std::string result;
+    result.reserve(value.size());
+    for (auto c : value) {
+        switch (c) {
+        case '\\': result += "\\\\"; break;
+        case '"': result += "\\\""; break;
+        case '\n': result += "\\n"; break;
+        default: result += c;
+        }
+    }
+    return result;
+}
+
+/** Render labels as `a="x",b="y"`, which also serves as the series key. */
+std::string renderLabels(Metrics::Labels const& labels)
+{
+    std::string result;
+    for (auto const& [key, value] : labels) {
+        if (!result.empty())
+            result += ',';
+        result += fmt::format("{}=\"{}\"", key, escapeLabelValue(value));
+    }
+    return result;
+}
+
+std::string withLabel(std::string const& labels, std::string_view extra)
+{
+    if (labels.empty())
+        return fmt::format("{{{}}}", extra);
+    return fmt::format("{{{},{}}}", labels, extra);
+}
+
+}  // namespace
+
+void Metrics::Histogram::observe(std::chrono::steady_clock::duration d)
+{
+    auto us = static_cast<uint64_t>(
+        std::max<int64_t>(std::chrono::duration_cast<std::chrono::microseconds>(d).count(), 0));
+    auto bucket = std::lower_bound(bucketBoundsUs.begin(), bucketBoundsUs.end(), us) - bucketBoundsUs.begin();
+    buckets_[bucket].fetch_add(1, std::memory_order_relaxed);
+    sumUs_.fetch_add(us, std::memory_order_relaxed);
+}
+
+std::array<uint64_t, Metrics::Histogram::bucketBoundsUs.size() + 1> Metrics::Histogram::bucketCounts() const
+{
+    std::array<uint64_t, bucketBoundsUs.size() + 1> result{};
+    for (size_t i = 0; i < result.size(); ++i)
+        result[i] = buckets_[i].load(std::memory_order_relaxed);
+    return result;
+}
+
+struct Metrics::Impl
+{
+    enum class Type { Counter, Gauge, Histogram };
+
+    struct Family
+    {
+        Type type_;
+        std::string help_;
+        // Series per rendered label set. The metric objects are
+        // heap-allocated, so references to them remain stable.
+        std::map<std::string, std::unique_ptr<Counter>> counters_;
+        std::map<std::string, std::unique_ptr<Gauge>> gauges_;
+        std::map<std::string, std::unique_ptr<Histogram>> histograms_;
+    };
+
+    mutable std::mutex mutex_;
+    std::map<std::string, Family> families_;
+
+    Family& family(std::string const& name, std::string const& help, Type type)
+    {
+        auto [it, inserted] = families_.try_emplace(name, Family{type, help});
+        if (!inserted && it->second.type_ != type)
+            raiseFmt("Metric '{}' is already registered with a different type.", name);
+        return it->second;
+    }
+};
+
+Metrics::Metrics() : impl_(std::make_unique<Impl>()) {}
+
+Metrics::~Metrics() = default;
+
+Metrics& Metrics::get()
+{
+    static Metrics instance;
+    return instance;
+}
+
+Metrics::Counter& Metrics::counter(std::string const& name, std::string const& help, Labels const& labels)
+{
+    std::unique_lock lock(impl_->mutex_);
+    auto& series = impl_->family(name, help, Impl::Type::Counter).counters_[renderLabels(labels)];
+    if (!series)
+        series = std::make_unique<Counter>();
+    return *series;
+}
+
+Metrics::Gauge& Metrics::gauge(std::string const& name, std::string const& help, Labels const& labels)
+{
+    std::unique_lock lock(impl_->mutex_);
+    auto& series = impl_->family(name, help, Impl::Type::Gauge).gauges_[renderLabels(labels)];
+    if (!series)
+        series = std::make_unique<Gauge>();
+    return *series;
+}
+
+Metrics::Histogram& Metrics::histogram(std::string const& name, std::string const& help, Labels const& labels)
+{
+    std::unique_lock lock(impl_->mutex_);
+    auto& series = impl_->family(name, help, Impl::Type::Histogram).histograms_[renderLabels(labels)];
+    if (!series)
+        series = std::make_unique<Histogram>();
+    return *series;
+}
+
+std::string Metrics::toPrometheusText() const
+{
+    std::unique_lock lock(impl_->mutex_);
+    std::string result;
+
+    for (auto const& [name, family] : impl_->families_)
+    {
+        if (family.type_ == Impl::Type::Counter) {
+            result += fmt::format("# HELP {} {}\n# TYPE {} counter\n", name, family.help_, name);
+            for (auto const& [labels, counter] : family.counters_) {
+                result += fmt::format(
+                    "{}{} {}\n",
+                    name,
+                    labels.empty() ? "" : fmt::format("{{{}}}", labels),
+                    counter->value());
+            }
+            continue;
+        }
+
+        if (family.type_ == Impl::Type::Gauge) {
+            result += fmt::format("# HELP {} {}\n# TYPE {} gauge\n", name, family.help_, name);
+            for (auto const& [labels, gauge] : family.gauges_) {
+                result += fmt::format(
+                    "{}{} {}\n",
+                    name,
+                    labels.empty() ? "" : fmt::format("{{{}}}", labels),
+                    gauge->value());
+            }
+            continue;
+        }
+
+        result += fmt::format("# HELP {} {}\n# TYPE {} histogram\n", name, family.help_, name);
+        for (auto const& [labels, histogram] : family.histograms_) {
+            // Buckets are rendered cumulatively. The count is derived from
+            // the same snapshot, so the series is always self-consistent.
+            auto counts = histogram->bucketCounts();
+            uint64_t cumulative = 0;
+            for (size_t i = 0; i < Histogram::bucketBoundsUs.size(); ++i) {
+                cumulative += counts[i];
+                result += fmt::format(
+                    "{}_bucket{} {}\n",
+                    name,
+                    withLabel(labels, fmt::format("le=\"{}\"", static_cast<double>(Histogram::bucketBoundsUs[i]) / 1e6)),
+                    cumulative);
+            }
+            cumulative += counts.back();
+            result += fmt::format("{}_bucket{} {}\n", name, withLabel(labels, "le=\"+Inf\""), cumulative);
+            auto plainLabels = labels.empty() ? std::string() : fmt::format("{{{}}}", labels);
+            result += fmt::format("{}_sum{} {}\n", name, plainLabels, static_cast<double>(histogram->sumUs()) / 1e6);
+            result += fmt::format("{}_count{} {}\n", name, plainLabels, cumulative);
+        }
+    }
+
+    return result;
+}
+
+}  // namespace mapget
@@ -8,7 +8,7 @@ std::optional<std::string> NullCache::getTileLayerBlob(MapTileKey const& k)
     return std::nullopt;
 }
 
-void NullCache::putTileLayerBlob(MapTileKey const& k, std::string const& v)
+void NullCache::putTileLayerBlob(MapTileKey const& k, std::string_view const& v)
 {
     // Do nothing - no caching
 }
@@ -18,7 +18,7 @@ std::optional<std::string> NullCache::getStringPoolBlob(std::string_view const&
     return std::nullopt;
 }
 
-void NullCache::putStringPoolBlob(std::string_view const& sourceNodeId, std::string const& v)
+void NullCache::putStringPoolBlob(std::string_view const& sourceNodeId, std::string_view const& v)
 {
     // Do nothing - no caching
 }
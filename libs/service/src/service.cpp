@@ -3,12 +3,14 @@
 #include "fmt/format.h"
 #include "locate.h"
 #include "config.h"
+#include "metrics.h"
 #include "mapget/log.h"
 #include "mapget/model/sourcedatalayer.h"
 #include "mapget/model/featurelayer.h"
 #include "mapget/model/info.h"
 #include "mapget/model/layer.h"
 
+#include <algorithm>
 #include <memory>
 #include <optional>
 #include <set>
@@ -16,8 +18,11 @@
 #include <condition_variable>
 #include <thread>
 #include <list>
+#include <map>
+#include <vector>
 
 #include "simfil/types.h"
+#include "picosha2.h"
 
 namespace mapget
 {
@@ -54,7 +59,15 @@ void LayerTilesRequest::notifyResult(TileLayer::Ptr r) {
     }
 
     ++resultCount_;
-    if (resultCount_ == tiles_.size()) {
+    if (resultCount_ + skippedTileCount_ == tiles_.size()) {
+        setStatus(RequestStatus::Success);
+    }
+}
+
+void LayerTilesRequest::notifySkipped()
+{
+    ++skippedTileCount_;
+    if (resultCount_ + skippedTileCount_ == tiles_.size()) {
         setStatus(RequestStatus::Success);
     }
 }
@@ -87,16 +100,25 @@ void LayerTilesRequest::wait()
     }
 }
 
+bool LayerTilesRequest::wait(std::chrono::steady_clock::duration timeout)
+{
+    std::unique_lock doneLock(statusMutex_);
+    return statusConditionVariable_.wait_for(doneLock, timeout, [this]{ return isDone(); });
+}
+
 nlohmann::json LayerTilesRequest::toJson()
 {
     auto tileIds = nlohmann::json::array();
     for (auto const& tid : tiles_)
         tileIds.emplace_back(tid.value_);
-    return nlohmann::json::object({
+    auto result = nlohmann::json::object({
         {"mapId", mapId_},
         {"layerId", layerId_},
         {"tileIds", tileIds}
     });
+    if (!filter_.empty())
+        result["filter"] = filter_;
+    return result;
 }
 
 RequestStatus LayerTilesRequest::getStatus()
@@ -104,6 +126,11 @@ RequestStatus LayerTilesRequest::getStatus()
     return this->status_;
 }
 
+size_t LayerTilesRequest::getSkippedTileCount() const
+{
+    return skippedTileCount_;
+}
+
 bool LayerTilesRequest::isDone()
 {
     return status_ != RequestStatus::Open;
@@ -112,86 +139,268 @@ bool LayerTilesRequest::isDone()
 struct Service::Controller
 {
     using Job = std::pair<MapTileKey, LayerTilesRequest::Ptr>;
+    using CacheHit = std::pair<LayerTilesRequest::Ptr, TileLayer::Ptr>;
 
     std::set<MapTileKey> jobsInProgress_;    // Set of jobs currently in progress
     Cache::Ptr cache_;                       // The cache for the service
-    std::list<LayerTilesRequest::Ptr> requests_;       // List of requests currently being processed
     std::condition_variable jobsAvailable_;  // Condition variable to signal job availability
     std::mutex jobsMutex_;  // Mutex used with the jobsAvailable_ condition variable
 
+    // Weighted fair queueing between clients: The virtual time of a client
+    // advances by 1/weight for each tile which is scheduled for it. Workers
+    // visit the clients by their virtual time, and the requests of each client
+    // in round-robin order. A client is kept while it has requests which are
+    // being processed, and its entry in clientOrder_ is moved whenever its
+    // virtual time changes. Guarded by jobsMutex_.
+    struct ClientRequests
+    {
+        double virtualTime_ = 0.;
+        std::list<LayerTilesRequest::Ptr> requests_;
+    };
+    using ClientMap = std::map<std::string, ClientRequests>;
+    ClientMap clients_;
+    std::set<std::pair<double, std::string>> clientOrder_;
+    std::map<std::string, double> clientWeights_;
+
+    // Layer infos of all data sources of each map layer, by map id and layer
+    // id, so tiles which no data source can fill are answered without a worker.
+    // Rebuilt when data sources are added or removed. Guarded by jobsMutex_.
+    using LayerInfos = std::vector<std::shared_ptr<LayerInfo>>;
+    std::map<std::string, std::map<std::string, LayerInfos, std::less<>>, std::less<>> coverage_;
+
+    // Metrics which are recorded while jobs are scheduled.
+    Metrics::Histogram& queueWaitTime_ = Metrics::get().histogram(
+        "mapget_tile_queue_wait_seconds",
+        "Time from adding a request until a worker picks up its tile.");
+    Metrics::Counter& coalescedTiles_ = Metrics::get().counter(
+        "mapget_tiles_coalesced_total",
+        "Tiles which waited for an identical job in progress instead of being filled again.");
+    Metrics::Counter& abortedTiles_ = Metrics::get().counter(
+        "mapget_tiles_aborted_total",
+        "Tiles which were not delivered because their request was aborted.");
+    Metrics::Counter& skippedTiles_ = Metrics::get().counter(
+        "mapget_tiles_skipped_total",
+        "Tiles which were not filled because they are outside the zoom levels or coverage of their layer.");
+
     explicit Controller(Cache::Ptr cache) : cache_(std::move(cache))
     {
         if (!cache_)
             raise("Cache must not be null!");
     }
 
-    std::optional<Job> nextJob(DataSourceInfo const& i)
+    void recordQueueWait(LayerTilesRequest const& request, MapTileKey const& tileKey)
+    {
+        auto now = std::chrono::steady_clock::now();
+        queueWaitTime_.observe(now - request.queuedAt_);
+        if (request.trace_)
+            request.trace_->addSpan("queue", request.queuedAt_, now, tileKey.toString());
+    }
+
+    ClientMap::iterator addClient(std::string const& clientId)
+    {
+        // A new client starts at the lowest virtual time of the present
+        // clients, so it neither has to catch up nor starves the others.
+        auto [clientIt, isNew] = clients_.try_emplace(clientId);
+        if (isNew) {
+            clientIt->second.virtualTime_ = clientOrder_.empty() ? 0. : clientOrder_.begin()->first;
+            clientOrder_.emplace(clientIt->second.virtualTime_, clientId);
+        }
+        return clientIt;
+    }
+
+    void removeClientIfIdle(ClientMap::iterator clientIt)
+    {
+        if (!clientIt->second.requests_.empty())
+            return;
+        clientOrder_.erase({clientIt->second.virtualTime_, clientIt->first});
+        clients_.erase(clientIt);
+    }
+
+    bool covers(std::string const& mapId, std::string const& layerId, TileId const& tile) const
+    {
+        // Layers without an entry, e.g. of a removed
+        // data source, are left to the workers.
+        auto mapIt = coverage_.find(mapId);
+        if (mapIt == coverage_.end())
+            return true;
+        auto layerIt = mapIt->second.find(layerId);
+        if (layerIt == mapIt->second.end())
+            return true;
+        return std::any_of(
+            layerIt->second.begin(),
+            layerIt->second.end(),
+            [&tile](auto const& layer) { return layer->covers(tile); });
+    }
+
+    /**
+     * Get the result of a request for a filled or cached tile layer. If the
+     * request has a filter, only the matching features of a feature layer are
+     * passed on. The filtered variant is cached next to the tile layer, with
+     * one entry per tile and filter, and is only reused for the tile version
+     * it was derived from. If the filter cannot be evaluated, an empty layer
+     * with the evaluation error is passed on instead.
+     */
+    TileLayer::Ptr resultForRequest(LayerTilesRequest const& request, TileLayer::Ptr const& layer)
+    {
+        auto featureLayer = std::dynamic_pointer_cast<TileFeatureLayer>(layer);
+        if (request.filter_.empty() || !featureLayer)
+            return layer;
+
+        auto key = MapTileKey(*featureLayer).derived(
+            "filter-" + picosha2::hash256_hex_string(request.filter_).substr(0, 16));
+        auto cached = cache_->getTileLayer(
+            key,
+            [&featureLayer](auto&&, auto&&) { return featureLayer->layerInfo(); });
+        if (cached && cached->timestamp() == featureLayer->timestamp())
+            return cached;
+
+        try {
+            auto filtered = featureLayer->filter(request.filter_);
+            cache_->putTileLayer(key, filtered);
+            return filtered;
+        }
+        catch (std::exception const& e) {
+            log().warn("Could not filter tile {}: {}", key.toString(), e.what());
+            auto failed = std::make_shared<TileFeatureLayer>(
+                featureLayer->tileId(),
+                featureLayer->nodeId(),
+                featureLayer->mapId(),
+                featureLayer->layerInfo(),
+                featureLayer->strings());
+            failed->setTimestamp(featureLayer->timestamp());
+            failed->setError(fmt::format("Could not apply filter: {}", e.what()));
+            return failed;
+        }
+    }
+
+    void chargeClient(ClientRequests& client, std::string const& clientId)
+    {
+        auto weightIt = clientWeights_.find(clientId);
+        client.virtualTime_ += 1. / (weightIt != clientWeights_.end() ? weightIt->second : 1.);
+    }
+
+    std::optional<Job> nextJob(DataSourceInfo const& i, std::vector<CacheHit>& cacheHits)
     {
         // Workers call the nextJob function when they are free.
+        // Cached tiles are collected in cacheHits, to be filtered
+        // by the worker once it released the lock.
         // Note: For thread safety, jobsMutex_ must be held
         //  when calling this function.
 
         std::optional<Job> result;
 
         // Return next job, if available.
-        bool cachedTilesServed = false;
+        bool tilesServed = false;
         do {
-            cachedTilesServed = false;
-            for (auto reqIt = requests_.begin(); reqIt != requests_.end(); ++reqIt) {
-                auto& request = *reqIt;
-                auto layerIt = i.layers_.find(request->layerId_);
-
-                // Are there tiles left to be processed in the request?
-                if (request->mapId_ == i.mapId_ && layerIt != i.layers_.end()) {
-                    if (request->nextTileIndex_ >= request->tiles_.size()) {
-                        continue;
-                    }
-
-                    // Create result wrapper object.
-                    auto tileId = request->tiles_[request->nextTileIndex_++];
-                    result = {MapTileKey(), request};
-                    result->first.layer_ = layerIt->second->type_;
-                    result->first.mapId_ = request->mapId_;
-                    result->first.layerId_ = request->layerId_;
-                    result->first.tileId_ = tileId;
-
-                    // Cache lookup.
-                    auto cachedResult = cache_->getTileLayer(result->first, i);
-                    if (cachedResult) {
-                        // TODO: Consider TTL.
-                        log().debug("Serving cached tile: {}", result->first.toString());
-                        request->notifyResult(cachedResult);
-                        result.reset();
-                        cachedTilesServed = true;
-                        continue;
-                    }
+            tilesServed = false;
+
+            // Visit the clients by their virtual time, lowest first. A client
+            // which was charged is moved, and may be visited again.
+            for (auto orderIt = clientOrder_.begin(); orderIt != clientOrder_.end() && !result;) {
+                auto clientIt = clients_.find(orderIt->second);
+                auto& client = clientIt->second;
+                auto const virtualTime = client.virtualTime_;
+                result = nextJobOfClient(client, i, cacheHits, tilesServed);
+
+                // Clean up done requests, and the client once it has none left.
+                client.requests_.remove_if([](auto&& r) {return r->nextTileIndex_ == r->tiles_.size(); });
+                auto nextOrderIt = std::next(orderIt);
+                if (client.requests_.empty() || client.virtualTime_ != virtualTime) {
+                    clientOrder_.erase(orderIt);
+                    if (client.requests_.empty())
+                        clients_.erase(clientIt);
+                    else
+                        clientOrder_.emplace(client.virtualTime_, clientIt->first);
+                }
+                orderIt = nextOrderIt;
+            }
+        }
+        while (tilesServed && !result);
 
-                    if (jobsInProgress_.find(result->first) != jobsInProgress_.end()) {
-                        // Don't work on something that is already being worked on.
-                        // Wait for the work to finish, then send the (hopefully cached) result.
-                        log().debug("Delaying tile with job in progress: {}",
-                                    result->first.toString());
-                        --request->nextTileIndex_;
-                        result.reset();
-                        continue;
-                    }
+        return result;
+    }
 
-                    // Enter into the jobs-in-progress set.
-                    jobsInProgress_.insert(result->first);
+    /**
+     * Find the next job in the requests of one client, in round-robin order.
+     * Skipped tiles are answered right away, cached tiles are added to
+     * cacheHits. In both cases, tilesServed is set. Note: jobsMutex_ must be held.
+     */
+    std::optional<Job> nextJobOfClient(
+        ClientRequests& client,
+        DataSourceInfo const& i,
+        std::vector<CacheHit>& cacheHits,
+        bool& tilesServed)
+    {
+        std::optional<Job> result;
+        for (auto reqIt = client.requests_.begin(); reqIt != client.requests_.end(); ++reqIt) {
+            auto& request = *reqIt;
+            auto layerIt = i.layers_.find(request->layerId_);
+
+            // Are there tiles left to be processed in the request?
+            if (request->mapId_ != i.mapId_ || layerIt == i.layers_.end())
+                continue;
+            if (request->nextTileIndex_ >= request->tiles_.size() || request->paused_)
+                continue;
+
+            // Tiles which no data source can fill are skipped, before
+            // they take up a worker or an empty cache entry.
+            auto tileId = request->tiles_[request->nextTileIndex_++];
+            if (!covers(request->mapId_, request->layerId_, tileId)) {
+                log().debug("Skipping tile outside the coverage of {}/{}: {}",
+                            request->mapId_, request->layerId_, tileId.value_);
+                skippedTiles_.add();
+                request->notifySkipped();
+                tilesServed = true;
+                continue;
+            }
 
-                    // Move this request to the end of the list, so others gain priority.
-                    requests_.splice(requests_.end(), requests_, reqIt);
+            // Create result wrapper object.
+            result = {MapTileKey(), request};
+            result->first.layer_ = layerIt->second->type_;
+            result->first.mapId_ = request->mapId_;
+            result->first.layerId_ = request->layerId_;
+            result->first.tileId_ = tileId;
+
+            // Cache lookup.
+            Trace::Scope traceScope(request->trace_);
+            auto cachedResult = cache_->getTileLayer(result->first, i);
+            if (cachedResult) {
+                // TODO: Consider TTL.
+                log().debug("Serving cached tile: {}", result->first.toString());
+                recordQueueWait(*request, result->first);
+                chargeClient(client, request->clientId_);
+                cacheHits.emplace_back(request, std::move(cachedResult));
+                result.reset();
+                tilesServed = true;
+                continue;
+            }
 
-                    log().debug("Working on tile: {}", result->first.toString());
-                    break;
+            if (jobsInProgress_.find(result->first) != jobsInProgress_.end()) {
+                // Don't work on something that is already being worked on.
+                // Wait for the work to finish, then send the (hopefully cached) result.
+                log().debug("Delaying tile with job in progress: {}",
+                            result->first.toString());
+                --request->nextTileIndex_;
+                if (request->coalescedTileIndex_ != request->nextTileIndex_) {
+                    request->coalescedTileIndex_ = request->nextTileIndex_;
+                    coalescedTiles_.add();
                 }
+                result.reset();
+                continue;
             }
-        }
-        while (cachedTilesServed && !result);
 
-        // Clean up done requests.
-        requests_.remove_if([](auto&& r) {return r->nextTileIndex_ == r->tiles_.size(); });
+            recordQueueWait(*request, result->first);
+            chargeClient(client, request->clientId_);
+
+            // Enter into the jobs-in-progress set.
+            jobsInProgress_.insert(result->first);
 
+            // Move this request to the end of the list, so others gain priority.
+            client.requests_.splice(client.requests_.end(), client.requests_, reqIt);
+
+            log().debug("Working on tile: {}", result->first.toString());
+            break;
+        }
         return result;
     }
 
@@ -206,6 +415,7 @@ struct Service::Worker
     DataSourceInfo info_;          // Information about the data source
     std::atomic_bool shouldTerminate_ = false; // Flag indicating whether the worker thread should terminate
     Controller& controller_;       // Reference to Service::Impl which owns this worker
+    Metrics::Histogram& fillTime_; // Fill time of the data source's tiles
     std::thread thread_;           // The worker thread
 
     Worker(
@@ -214,7 +424,11 @@ struct Service::Worker
         Controller& controller)
         : dataSource_(std::move(dataSource)),
           info_(std::move(info)),
-          controller_(controller)
+          controller_(controller),
+          fillTime_(Metrics::get().histogram(
+              "mapget_tile_fill_seconds",
+              "Time which a data source takes to fill a tile layer.",
+              {{"map", info_.mapId_}, {"node", info_.nodeId_}}))
     {
         thread_ = std::thread([this]{while (work()) {}});
     }
@@ -222,6 +436,7 @@ struct Service::Worker
     bool work()
     {
         std::optional<Controller::Job> nextJob;
+        std::vector<Controller::CacheHit> cacheHits;
 
         {
             std::unique_lock<std::mutex> lock(controller_.jobsMutex_);
@@ -236,33 +451,65 @@ struct Service::Worker
                         // is removed. All worker instances are expected to terminate.
                         return true;
                     }
-                    nextJob = controller_.nextJob(info_);
-                    return nextJob.has_value();
+                    nextJob = controller_.nextJob(info_, cacheHits);
+                    return nextJob.has_value() || !cacheHits.empty();
                 });
         }
 
+        // Filter the cached tiles without holding the lock, then pass them on.
+        // Results are still only notified under the lock, so that the callbacks
+        // of a request never run concurrently.
+        if (!cacheHits.empty()) {
+            std::vector<TileLayer::Ptr> results;
+            results.reserve(cacheHits.size());
+            for (auto const& [request, layer] : cacheHits) {
+                Trace::Scope traceScope(request->trace_);
+                results.emplace_back(controller_.resultForRequest(*request, layer));
+            }
+
+            std::unique_lock<std::mutex> lock(controller_.jobsMutex_);
+            for (size_t hitIndex = 0; hitIndex < cacheHits.size(); ++hitIndex) {
+                auto const& request = cacheHits[hitIndex].first;
+                // The request may have been aborted in the meantime.
+                if (!request->isDone())
+                    request->notifyResult(results[hitIndex]);
+            }
+        }
+
         if (shouldTerminate_)
             return false;
+        if (!nextJob)
+            return true;
 
         auto& [mapTileKey, request] = *nextJob;
+        Trace::Scope traceScope(request->trace_);
+        auto workSpan = Trace::currentSpan("Service::Worker::work", [&]{ return mapTileKey.toString(); });
 
         try
         {
+            auto fillStart = std::chrono::steady_clock::now();
+            auto fillSpan = Trace::currentSpan("DataSource::get");
             auto layer = dataSource_->get(mapTileKey, controller_.cache_, info_);
             if (!layer)
                 raise("DataSource::get() returned null.");
+            fillSpan.end();
+            fillTime_.observe(std::chrono::steady_clock::now() - fillStart);
 
             // Special FeatureLayer handling
             if (layer->layerInfo()->type_ == LayerType::Features) {
+                auto addOnSpan = Trace::currentSpan("Service::loadAddOnTiles");
                 controller_.loadAddOnTiles(std::static_pointer_cast<TileFeatureLayer>(layer), *dataSource_);
             }
 
             controller_.cache_->putTileLayer(layer);
 
+            // Filter the layer before the jobs are locked.
+            auto result = controller_.resultForRequest(*request, layer);
+
             {
                 std::unique_lock<std::mutex> lock(controller_.jobsMutex_);
                 controller_.jobsInProgress_.erase(mapTileKey);
-                request->notifyResult(layer);
+                request->notifyResult(result);
                 // As we entered a tile into the cache, notify other workers
                 // that this tile can be served.
                 controller_.jobsAvailable_.notify_all();
@@ -356,6 +603,7 @@ struct Service::Impl : public Service::Controller
 
         DataSourceInfo info = dataSource->info();
         dataSourceInfo_[dataSource] = info;
+        rebuildCoverage();
 
         // If the datasource is an add-on source, then it
         // does not have separate workers.
@@ -378,6 +626,7 @@ struct Service::Impl : public Service::Controller
     {
         dataSourceInfo_.erase(dataSource);
         addOnDataSources_.remove(dataSource);
+        rebuildCoverage();
 
         auto workers = dataSourceWorkers_.find(dataSource);
         if (workers != dataSourceWorkers_.end())
@@ -400,6 +649,26 @@ struct Service::Impl : public Service::Controller
         }
     }
 
+    void rebuildCoverage()
+    {
+        // Add-on data sources only extend the tiles of the others,
+        // so their coverage does not matter. Layer infos which were
+        // not parsed from JSON are indexed here, see LayerInfo::covers().
+        std::map<std::string, std::map<std::string, LayerInfos, std::less<>>, std::less<>> coverage;
+        for (auto const& [_, info] : dataSourceInfo_) {
+            if (info.isAddOn_)
+                continue;
+            for (auto const& [layerId, layer] : info.layers_) {
+                if (!layer->coverageIndex_)
+                    layer->indexCoverage();
+                coverage[info.mapId_][layerId].push_back(layer);
+            }
+        }
+
+        std::unique_lock lock(jobsMutex_);
+        coverage_ = std::move(coverage);
+    }
+
     // All requests must be validated with canProcess before adding them!
     void addRequest(LayerTilesRequest::Ptr r)
     {
@@ -413,7 +682,8 @@ struct Service::Impl : public Service::Controller
 
         {
             std::unique_lock lock(jobsMutex_);
-            requests_.push_back(std::move(r));
+            r->queuedAt_ = std::chrono::steady_clock::now();
+            addClient(r->clientId_)->second.requests_.push_back(std::move(r));
         }
         jobsAvailable_.notify_all();
     }
@@ -421,10 +691,15 @@ struct Service::Impl : public Service::Controller
     void abortRequest(LayerTilesRequest::Ptr const& r)
     {
         std::unique_lock lock(jobsMutex_);
-        // Remove the request from the list of requests.
-        auto numRemoved = requests_.remove_if([r](auto&& request) { return r == request; });
+        // Remove the request from the list of requests of its client.
+        auto clientIt = clients_.find(r->clientId_);
+        if (clientIt == clients_.end())
+            return;
+        auto numRemoved = clientIt->second.requests_.remove_if([r](auto&& request) { return r == request; });
         // Clear its jobs to mark it as done.
         if (numRemoved) {
+            abortedTiles_.add(r->tiles_.size() - r->resultCount_ - r->skippedTileCount_);
+            removeClientIfIdle(clientIt);
             r->setStatus(RequestStatus::Aborted);
         }
     }
@@ -606,6 +881,30 @@ void Service::abort(const LayerTilesRequest::Ptr& r)
     impl_->abortRequest(r);
 }
 
+void Service::pause(LayerTilesRequest::Ptr const& r)
+{
+    r->paused_ = true;
+}
+
+void Service::resume(LayerTilesRequest::Ptr const& r)
+{
+    {
+        // Lock, so that no worker misses the change between
+        // checking for a job and waiting for the next one.
+        std::unique_lock lock(impl_->jobsMutex_);
+        r->paused_ = false;
+    }
+    impl_->jobsAvailable_.notify_all();
+}
+
+void Service::setClientWeight(std::string const& clientId, double weight)
+{
+    if (weight <= 0.)
+        raiseFmt("Client weight must be positive, got {}.", weight);
+    std::unique_lock lock(impl_->jobsMutex_);
+    impl_->clientWeights_[clientId] = weight;
+}
+
 std::vector<DataSourceInfo> Service::info(std::optional<AuthHeaders> const& clientHeaders)
 {
     return impl_->getDataSourceInfos(clientHeaders);
@@ -646,9 +945,16 @@ nlohmann::json Service::getStatistics() const
         });
     }
 
+    size_t activeRequests = 0;
+    {
+        std::unique_lock lock(impl_->jobsMutex_);
+        for (auto const& [_, client] : impl_->clients_)
+            activeRequests += client.requests_.size();
+    }
+
     return {
         {"datasources", datasources},
-        {"active-requests", impl_->requests_.size()}
+        {"active-requests", activeRequests}
     };
 }
 
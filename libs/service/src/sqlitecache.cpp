@@ -1,6 +1,7 @@
 #include <sqlite3.h>
 #include <filesystem>
 #include <iostream>
+#include <algorithm>
 #include <chrono>
 #include <mutex>
 
@@ -49,42 +50,31 @@ SQLiteCache::SQLiteCache(uint32_t cacheMaxTiles, std::string cachePath, bool cle
     initDatabase();
     prepareStatements();
 
-    // Count existing tiles
-    sqlite3_stmt* stmt;
-    rc = sqlite3_prepare_v2(db_, "SELECT COUNT(*) FROM tiles", -1, &stmt, nullptr);
-    if (rc == SQLITE_OK) {
-        if (sqlite3_step(stmt) == SQLITE_ROW) {
-            int count = sqlite3_column_int(stmt, 0);
-            log().debug(fmt::format("Initialized SQLite cache with {} existing tile entries.", count));
-            
-            // Handle special case: if the cache has more tiles than the limit
-            if (!clearCache && maxTileCount_ > 0 && count > maxTileCount_) {
-                int deleteCount = count - maxTileCount_;
-                std::string sql = fmt::format(
-                    "DELETE FROM tiles WHERE key IN (SELECT key FROM tiles ORDER BY timestamp ASC LIMIT {})",
-                    deleteCount);
-                executeSQL(sql);
-            }
-        }
-        sqlite3_finalize(stmt);
-    }
+    // The tile count is maintained by triggers, so this does not scan the table.
+    // String pools are not loaded here: Cache::getStringPool() deserializes
+    // them lazily when a node's pool is first needed.
+    auto count = storedTileCount();
+    log().debug(fmt::format("Initialized SQLite cache with {} existing tile entries.", count));
 
-    // Update stringPoolOffsets_ for each existing string pool
-    rc = sqlite3_prepare_v2(db_, "SELECT node_id FROM string_pools", -1, &stmt, nullptr);
-    if (rc == SQLITE_OK) {
-        while (sqlite3_step(stmt) == SQLITE_ROW) {
-            const char* nodeId = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0));
-            if (nodeId) {
-                // Trigger cache lookup to update offsets
-                Cache::getStringPool(nodeId);
-            }
-        }
-        sqlite3_finalize(stmt);
+    // If the cache holds more tiles than the limit (e.g. because it was
+    // reopened with a smaller limit), the surplus is removed in the background.
+    if (maxTileCount_ > 0) {
+        evictionPending_ = count > maxTileCount_;
+        evictionThread_ = std::thread([this] { evictionWorker(); });
     }
 }
 
 SQLiteCache::~SQLiteCache()
 {
+    // Stop the eviction worker before tearing down the database.
+    {
+        std::lock_guard<std::mutex> lock(dbMutex_);
+        shouldStop_ = true;
+    }
+    evictionCondition_.notify_all();
+    if (evictionThread_.joinable())
+        evictionThread_.join();
+
     // Clean up prepared statements
     if (stmts_.getTile) sqlite3_finalize(stmts_.getTile);
     if (stmts_.putTile) sqlite3_finalize(stmts_.putTile);
@@ -92,7 +82,7 @@ SQLiteCache::~SQLiteCache()
     if (stmts_.deleteTile) sqlite3_finalize(stmts_.deleteTile);
     if (stmts_.getStringPool) sqlite3_finalize(stmts_.getStringPool);
     if (stmts_.putStringPool) sqlite3_finalize(stmts_.putStringPool);
-    if (stmts_.getOldestTile) sqlite3_finalize(stmts_.getOldestTile);
+    if (stmts_.evictOldestTiles) sqlite3_finalize(stmts_.evictOldestTiles);
     if (stmts_.getTileCount) sqlite3_finalize(stmts_.getTileCount);
 
     if (db_) {
@@ -121,6 +111,54 @@ void SQLiteCache::initDatabase()
             data BLOB NOT NULL
         )
     )");
+
+    // Create cache info table, which persists the tile count so that
+    // it does not need to be recomputed with COUNT(*) on startup.
+    executeSQL(R"(
+        CREATE TABLE IF NOT EXISTS cache_info (
+            key TEXT PRIMARY KEY,
+            value INTEGER NOT NULL
+        )
+    )");
+
+    executeSQL("BEGIN IMMEDIATE");
+    try {
+        // Keep the tile count up-to-date. Note: Tiles are upserted using
+        // ON CONFLICT DO UPDATE, so overwriting a tile fires neither trigger.
+        executeSQL(R"(
+            CREATE TRIGGER IF NOT EXISTS tiles_count_insert AFTER INSERT ON tiles
+            BEGIN
+                UPDATE cache_info SET value = value + 1 WHERE key = 'tile-count';
+            END
+        )");
+        executeSQL(R"(
+            CREATE TRIGGER IF NOT EXISTS tiles_count_delete AFTER DELETE ON tiles
+            BEGIN
+                UPDATE cache_info SET value = value - 1 WHERE key = 'tile-count';
+            END
+        )");
+
+        // Caches which were created before the tile count was persisted
+        // are counted once here.
+        sqlite3_stmt* stmt;
+        int rc = sqlite3_prepare_v2(db_,
+            "SELECT value FROM cache_info WHERE key = 'tile-count'",
+            -1, &stmt, nullptr);
+        if (rc != SQLITE_OK) {
+            raise(fmt::format("Failed to query persisted tile count: {}", sqlite3_errmsg(db_)));
+        }
+        auto hasTileCount = sqlite3_step(stmt) == SQLITE_ROW;
+        sqlite3_finalize(stmt);
+        if (!hasTileCount) {
+            log().debug("Counting tiles of existing SQLite cache.");
+            executeSQL("INSERT INTO cache_info (key, value) SELECT 'tile-count', COUNT(*) FROM tiles");
+        }
+        executeSQL("COMMIT");
+    }
+    catch (...) {
+        sqlite3_exec(db_, "ROLLBACK", nullptr, nullptr, nullptr);
+        throw;
+    }
 }
 
 void SQLiteCache::executeSQL(const std::string& sql)
@@ -146,9 +184,12 @@ void SQLiteCache::prepareStatements()
         raise(fmt::format("Failed to prepare getTile statement: {}", sqlite3_errmsg(db_)));
     }
 
-    // Prepare statement for inserting/updating tiles
+    // Prepare statement for inserting/updating tiles. An upsert is used
+    // instead of INSERT OR REPLACE, since REPLACE does not fire the
+    // delete trigger which maintains the tile count.
     rc = sqlite3_prepare_v2(db_,
-        "INSERT OR REPLACE INTO tiles (key, data, timestamp) VALUES (?, ?, ?)",
+        "INSERT INTO tiles (key, data, timestamp) VALUES (?, ?, ?) "
+        "ON CONFLICT(key) DO UPDATE SET data = excluded.data, timestamp = excluded.timestamp",
         -1, &stmts_.putTile, nullptr);
     if (rc != SQLITE_OK) {
         raise(fmt::format("Failed to prepare putTile statement: {}", sqlite3_errmsg(db_)));
@@ -186,17 +227,17 @@ void SQLiteCache::prepareStatements()
         raise(fmt::format("Failed to prepare putStringPool statement: {}", sqlite3_errmsg(db_)));
     }
 
-    // Prepare statement for getting oldest tile
+    // Prepare statement for evicting a batch of oldest tiles
     rc = sqlite3_prepare_v2(db_,
-        "SELECT key FROM tiles ORDER BY timestamp ASC LIMIT 1",
-        -1, &stmts_.getOldestTile, nullptr);
+        "DELETE FROM tiles WHERE key IN (SELECT key FROM tiles ORDER BY timestamp ASC LIMIT ?)",
+        -1, &stmts_.evictOldestTiles, nullptr);
     if (rc != SQLITE_OK) {
-        raise(fmt::format("Failed to prepare getOldestTile statement: {}", sqlite3_errmsg(db_)));
+        raise(fmt::format("Failed to prepare evictOldestTiles statement: {}", sqlite3_errmsg(db_)));
     }
 
-    // Prepare statement for counting tiles
+    // Prepare statement for reading the persisted tile count
     rc = sqlite3_prepare_v2(db_,
-        "SELECT COUNT(*) FROM tiles",
+        "SELECT value FROM cache_info WHERE key = 'tile-count'",
         -1, &stmts_.getTileCount, nullptr);
     if (rc != SQLITE_OK) {
         raise(fmt::format("Failed to prepare getTileCount statement: {}", sqlite3_errmsg(db_)));
@@ -229,7 +270,7 @@ std::optional<std::string> SQLiteCache::getTileLayerBlob(MapTileKey const& k)
     }
 }
 
-void SQLiteCache::putTileLayerBlob(MapTileKey const& k, std::string const& v)
+void SQLiteCache::putTileLayerBlob(MapTileKey const& k, std::string_view const& v)
 {
     std::lock_guard<std::mutex> lock(dbMutex_);
     
@@ -237,7 +278,8 @@ void SQLiteCache::putTileLayerBlob(MapTileKey const& k, std::string const& v)
 
     sqlite3_reset(stmts_.putTile);
     sqlite3_bind_text(stmts_.putTile, 1, k.toString().c_str(), -1, SQLITE_TRANSIENT);
-    sqlite3_bind_blob(stmts_.putTile, 2, v.data(), v.size(), SQLITE_TRANSIENT);
+    // The blob is only accessed while the statement is stepped, so it need not be copied.
+    sqlite3_bind_blob(stmts_.putTile, 2, v.data(), (int)v.size(), SQLITE_STATIC);
     sqlite3_bind_int64(stmts_.putTile, 3, timestamp);
 
     int rc = sqlite3_step(stmts_.putTile);
@@ -248,35 +290,74 @@ void SQLiteCache::putTileLayerBlob(MapTileKey const& k, std::string const& v)
     log().debug("Cache hits: {}, cache misses: {}", cacheHits_, cacheMisses_);
 
     // Check if we need to evict old tiles
-    if (maxTileCount_ > 0) {
-        sqlite3_reset(stmts_.getTileCount);
-        if (sqlite3_step(stmts_.getTileCount) == SQLITE_ROW) {
-            int count = sqlite3_column_int(stmts_.getTileCount, 0);
-            if (count > maxTileCount_) {
-                cleanupOldestTiles();
-            }
-        }
+    if (maxTileCount_ > 0 && !evictionPending_ && storedTileCount() > maxTileCount_) {
+        evictionPending_ = true;
+        evictionCondition_.notify_all();
     }
 }
 
-void SQLiteCache::cleanupOldestTiles()
+int64_t SQLiteCache::storedTileCount() const
+{
+    // Must be called with dbMutex_ held.
+    int64_t result = 0;
+    sqlite3_reset(stmts_.getTileCount);
+    if (sqlite3_step(stmts_.getTileCount) == SQLITE_ROW)
+        result = sqlite3_column_int64(stmts_.getTileCount, 0);
+    sqlite3_reset(stmts_.getTileCount);
+    return result;
+}
+
+void SQLiteCache::evictionWorker()
 {
-    // Delete the oldest tile
-    sqlite3_reset(stmts_.getOldestTile);
-    if (sqlite3_step(stmts_.getOldestTile) == SQLITE_ROW) {
-        const char* oldestKey = reinterpret_cast<const char*>(sqlite3_column_text(stmts_.getOldestTile, 0));
-        if (oldestKey) {
-            sqlite3_reset(stmts_.deleteTile);
-            sqlite3_bind_text(stmts_.deleteTile, 1, oldestKey, -1, SQLITE_TRANSIENT);
-            
-            int rc = sqlite3_step(stmts_.deleteTile);
-            if (rc != SQLITE_DONE) {
-                raise(fmt::format("Could not delete oldest cache entry: {}", sqlite3_errmsg(db_)));
+    std::unique_lock<std::mutex> lock(dbMutex_);
+    while (true) {
+        evictionCondition_.wait(lock, [this] { return shouldStop_ || evictionPending_; });
+        if (shouldStop_)
+            break;
+
+        evictionRunning_ = true;
+        evictionPending_ = false;
+        try {
+            int64_t surplus = 0;
+            while (!shouldStop_ && (surplus = storedTileCount() - maxTileCount_) > 0) {
+                sqlite3_reset(stmts_.evictOldestTiles);
+                sqlite3_bind_int64(stmts_.evictOldestTiles, 1, std::min(surplus, evictionBatchSize_));
+                int rc = sqlite3_step(stmts_.evictOldestTiles);
+                sqlite3_reset(stmts_.evictOldestTiles);
+                if (rc != SQLITE_DONE) {
+                    raise(fmt::format("Could not delete oldest cache entries: {}", sqlite3_errmsg(db_)));
+                }
+
+                // Give pending cache reads/writes a chance to run between batches.
+                lock.unlock();
+                std::this_thread::yield();
+                lock.lock();
             }
         }
+        catch (std::exception const& e) {
+            log().error("SQLite cache eviction failed: {}", e.what());
+        }
+        evictionRunning_ = false;
+        evictionCondition_.notify_all();
     }
 }
 
+void SQLiteCache::waitForPendingEviction()
+{
+    std::unique_lock<std::mutex> lock(dbMutex_);
+    if (!evictionThread_.joinable())
+        return;
+    evictionCondition_.wait(lock, [this] { return shouldStop_ || (!evictionPending_ && !evictionRunning_); });
+}
+
+nlohmann::json SQLiteCache::getStatistics() const
+{
+    auto result = Cache::getStatistics();
+    std::lock_guard<std::mutex> lock(dbMutex_);
+    result["sqlite-tile-count"] = storedTileCount();
+    return result;
+}
+
 std::optional<std::string> SQLiteCache::getStringPoolBlob(std::string_view const& sourceNodeId)
 {
     std::lock_guard<std::mutex> lock(dbMutex_);
@@ -301,13 +382,13 @@ std::optional<std::string> SQLiteCache::getStringPoolBlob(std::string_view const
     }
 }
 
-void SQLiteCache::putStringPoolBlob(std::string_view const& sourceNodeId, std::string const& v)
+void SQLiteCache::putStringPoolBlob(std::string_view const& sourceNodeId, std::string_view const& v)
 {
     std::lock_guard<std::mutex> lock(dbMutex_);
     
     sqlite3_reset(stmts_.putStringPool);
     sqlite3_bind_text(stmts_.putStringPool, 1, sourceNodeId.data(), sourceNodeId.size(), SQLITE_TRANSIENT);
-    sqlite3_bind_blob(stmts_.putStringPool, 2, v.data(), v.size(), SQLITE_TRANSIENT);
+    sqlite3_bind_blob(stmts_.putStringPool, 2, v.data(), (int)v.size(), SQLITE_STATIC);
 
     int rc = sqlite3_step(stmts_.putStringPool);
     if (rc != SQLITE_DONE) {
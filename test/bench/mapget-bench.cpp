@@ -0,0 +1,355 @@
+#include "mapget/log.h"
+#include "mapget/model/featurelayer.h"
+#include "mapget/model/stream.h"
+#include "mapget/service/memcache.h"
+#include "mapget/service/nullcache.h"
+#include "mapget/service/service.h"
+#include "mapget/service/sqlitecache.h"
+
+#include <CLI/CLI.hpp>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <limits>
+
+using namespace mapget;
+
+namespace
+{
+
+/** Parameters of the generated tiles and the benchmark run. */
+struct BenchConfig
+{
+    uint32_t tiles_ = 64;
+    uint32_t features_ = 1000;
+    uint32_t attributes_ = 4;
+    uint32_t vertices_ = 16;
+    uint32_t repetitions_ = 3;
+    uint32_t serviceThreads_ = 4;
+    std::string filter_;
+    std::string output_;
+
+    [[nodiscard]] nlohmann::json toJson() const
+    {
+        return {
+            {"tiles", tiles_},
+            {"features-per-tile", features_},
+            {"attributes-per-feature", attributes_},
+            {"vertices-per-feature", vertices_},
+            {"repetitions", repetitions_},
+            {"service-threads", serviceThreads_}};
+    }
+};
+
+/**
+ * Generates feature tiles which resemble a road layer. Each feature has
+ * a line geometry with the configured number of vertices, and the configured
+ * number of alternating integer and string attributes. The content is
+ * deterministic, so results are comparable between runs.
+ */
+class TileGenerator
+{
+public:
+    explicit TileGenerator(BenchConfig const& config) : config_(config)
+    {
+        info_ = DataSourceInfo::fromJson(nlohmann::json{
+            {"nodeId", "BenchNode"},
+            {"mapId", "BenchMap"},
+            {"maxParallelJobs", config.serviceThreads_},
+            {"layers", {{"WayLayer", {
+                {"featureTypes", {{
+                    {"name", "Way"},
+                    {"uniqueIdCompositions", {{
+                        {{"partId", "areaId"}, {"datatype", "STR"}},
+                        {{"partId", "wayId"}, {"datatype", "U32"}}
+                    }}}
+                }}}
+            }}}}});
+        layerInfo_ = info_.getLayer("WayLayer");
+        strings_ = std::make_shared<StringPool>(info_.nodeId_);
+        for (auto i = 0u; i < config.attributes_; ++i)
+            attributeNames_.emplace_back(fmt::format("attr{}", i));
+
+        // Lay out the tiles as a square block at zoom level 13.
+        auto const origin = TileId::fromWgs84(11., 48., 13);
+        auto const cols = static_cast<uint32_t>(std::ceil(std::sqrt(config.tiles_)));
+        for (auto i = 0u; i < config.tiles_; ++i)
+            tileIds_.emplace_back(
+                static_cast<uint16_t>(origin.x() + i % cols),
+                static_cast<uint16_t>(origin.y() + i / cols),
+                origin.z());
+    }
+
+    [[nodiscard]] DataSourceInfo const& info() const { return info_; }
+    [[nodiscard]] std::shared_ptr<LayerInfo> const& layerInfo() const { return layerInfo_; }
+    [[nodiscard]] std::vector<TileId> const& tileIds() const { return tileIds_; }
+
+    /** Create and fill a tile which uses the shared string pool of the generator. */
+    [[nodiscard]] TileFeatureLayer::Ptr makeTile(TileId tileId) const
+    {
+        auto tile = std::make_shared<TileFeatureLayer>(
+            tileId, info_.nodeId_, info_.mapId_, layerInfo_, strings_);
+        fill(tile);
+        return tile;
+    }
+
+    void fill(TileFeatureLayer::Ptr const& tile) const
+    {
+        tile->setIdPrefix({{"areaId", "BenchArea"}});
+        auto const sw = tile->tileId().sw();
+        auto const size = tile->tileId().size();
+        std::vector<Point> points;
+        points.reserve(config_.vertices_);
+
+        for (auto i = 0u; i < config_.features_; ++i) {
+            auto feature = tile->newFeature("Way", {{"wayId", static_cast<int64_t>(i)}});
+
+            points.clear();
+            auto const y = sw.y + size.y * (i + .5) / config_.features_;
+            for (auto j = 0u; j < config_.vertices_; ++j)
+                points.emplace_back(sw.x + size.x * (j + .5) / config_.vertices_, y, j % 8);
+            feature->addLine(points);
+
+            auto attrs = feature->attributes();
+            for (auto a = 0u; a < config_.attributes_; ++a) {
+                if (a % 2 == 0)
+                    attrs->addField(attributeNames_[a], static_cast<int64_t>((i + a) % 130));
+                else
+                    attrs->addField(attributeNames_[a], fmt::format("Value {}", (i + a) % 100));
+            }
+        }
+    }
+
+private:
+    BenchConfig const& config_;
+    DataSourceInfo info_;
+    std::shared_ptr<LayerInfo> layerInfo_;
+    std::shared_ptr<StringPool> strings_;
+    std::vector<std::string> attributeNames_;
+    std::vector<TileId> tileIds_;
+};
+
+/** Data source which fills requested tiles using a TileGenerator. */
+class GeneratorDataSource : public DataSource
+{
+public:
+    explicit GeneratorDataSource(TileGenerator const& generator) : generator_(generator) {}
+
+    DataSourceInfo info() override { return generator_.info(); }
+
+    void fill(TileFeatureLayer::Ptr const& featureTile) override { generator_.fill(featureTile); }
+
+    void fill(TileSourceDataLayer::Ptr const&) override
+    {
+        raise("GeneratorDataSource does not provide source data.");
+    }
+
+private:
+    TileGenerator const& generator_;
+};
+
+/**
+ * Runs benchmark functions and collects their results. Each function is
+ * run for the configured number of repetitions, and reports the number of
+ * processed items (e.g. tiles) and bytes of its last repetition.
+ */
+class BenchRunner
+{
+public:
+    struct Counts
+    {
+        uint64_t items_ = 0;
+        uint64_t bytes_ = 0;
+    };
+
+    explicit BenchRunner(BenchConfig const& config) : config_(config) {}
+
+    template <class Fun>
+    void run(std::string const& name, Fun&& fun)
+    {
+        if (!config_.filter_.empty() && name.find(config_.filter_) == std::string::npos)
+            return;
+
+        Counts counts;
+        auto best = std::numeric_limits<double>::max();
+        auto total = 0.;
+        for (auto i = 0u; i < config_.repetitions_; ++i) {
+            auto start = std::chrono::steady_clock::now();
+            counts = fun();
+            auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            best = std::min(best, elapsed);
+            total += elapsed;
+        }
+
+        nlohmann::json result{
+            {"name", name},
+            {"items", counts.items_},
+            {"best-seconds", best},
+            {"mean-seconds", total / config_.repetitions_},
+            {"items-per-second", counts.items_ / best}};
+        if (counts.bytes_) {
+            result["bytes"] = counts.bytes_;
+            result["megabytes-per-second"] = counts.bytes_ / 1e6 / best;
+        }
+        log().info(
+            "{:<24} {:>10.1f} items/s {:>10.1f} MB/s",
+            name,
+            counts.items_ / best,
+            counts.bytes_ / 1e6 / best);
+        results_.push_back(std::move(result));
+    }
+
+    [[nodiscard]] nlohmann::json const& results() const { return results_; }
+
+private:
+    BenchConfig const& config_;
+    nlohmann::json results_ = nlohmann::json::array();
+};
+
+void benchCache(
+    BenchRunner& runner,
+    std::string const& backend,
+    Cache::Ptr const& cache,
+    TileGenerator const& generator,
+    std::vector<TileFeatureLayer::Ptr> const& tiles)
+{
+    runner.run(fmt::format("cache-put/{}", backend), [&]() {
+        for (auto const& tile : tiles)
+            cache->putTileLayer(tile);
+        return BenchRunner::Counts{tiles.size()};
+    });
+
+    runner.run(fmt::format("cache-get/{}", backend), [&]() {
+        uint64_t hits = 0;
+        for (auto const& tile : tiles)
+            if (cache->getTileLayer(MapTileKey(*tile), generator.info()))
+                ++hits;
+        return BenchRunner::Counts{hits};
+    });
+}
+
+}  // namespace
+
+int main(int argc, char** argv)
+{
+    BenchConfig config;
+
+    CLI::App app{"Benchmarks the mapget tile model, stream, caches and service."};
+    app.add_option("--tiles", config.tiles_, "Number of generated tiles.")
+        ->default_val(config.tiles_)
+        ->check(CLI::Range(1u, 65536u));
+    app.add_option("--features", config.features_, "Features per tile.")
+        ->default_val(config.features_);
+    app.add_option("--attributes", config.attributes_, "Attributes per feature.")
+        ->default_val(config.attributes_);
+    app.add_option("--vertices", config.vertices_, "Line vertices per feature.")
+        ->default_val(config.vertices_)
+        ->check(CLI::Range(2u, 1u << 20));
+    app.add_option("--repetitions", config.repetitions_, "Repetitions of each benchmark. The best run is reported.")
+        ->default_val(config.repetitions_)
+        ->check(CLI::Range(1u, 1000u));
+    app.add_option("--service-threads", config.serviceThreads_, "Worker threads of the service benchmark.")
+        ->default_val(config.serviceThreads_)
+        ->check(CLI::Range(1u, 1024u));
+    app.add_option("--filter", config.filter_, "Only run benchmarks whose name contains this string.");
+    app.add_option("-o,--output", config.output_, "Write the JSON results to this file instead of stdout.");
+    CLI11_PARSE(app, argc, argv);
+
+    mapget::setLogLevel("info", log());
+    TileGenerator generator(config);
+    BenchRunner runner(config);
+
+    std::vector<TileFeatureLayer::Ptr> tiles;
+    runner.run("build", [&]() {
+        tiles.clear();
+        for (auto const& tileId : generator.tileIds())
+            tiles.emplace_back(generator.makeTile(tileId));
+        return BenchRunner::Counts{tiles.size()};
+    });
+    if (tiles.empty()) {
+        for (auto const& tileId : generator.tileIds())
+            tiles.emplace_back(generator.makeTile(tileId));
+    }
+
+    std::string stream;
+    auto writeStream = [&]() {
+        stream.clear();
+        TileLayerStream::StringPoolOffsetMap offsets;
+        TileLayerStream::Writer writer{stream, offsets};
+        for (auto const& tile : tiles)
+            writer.write(tile);
+        writer.sendEndOfStream();
+    };
+    runner.run("stream-write", [&]() {
+        writeStream();
+        return BenchRunner::Counts{tiles.size(), stream.size()};
+    });
+    if (stream.empty())
+        writeStream();
+
+    runner.run("stream-read", [&]() {
+        uint64_t parsed = 0;
+        TileLayerStream::Reader reader{
+            [&](auto&&, auto&&) { return generator.layerInfo(); },
+            [&](auto&&) { ++parsed; }};
+        reader.read(stream);
+        return BenchRunner::Counts{parsed, stream.size()};
+    });
+
+    runner.run("to-json", [&]() {
+        uint64_t bytes = 0;
+        for (auto const& tile : tiles)
+            bytes += tile->toJson().dump().size();
+        return BenchRunner::Counts{tiles.size(), bytes};
+    });
+
+    runner.run("write-json", [&]() {
+        uint64_t bytes = 0;
+        std::string json;
+        for (auto const& tile : tiles) {
+            json.clear();
+            tile->writeJson(json);
+            bytes += json.size();
+        }
+        return BenchRunner::Counts{tiles.size(), bytes};
+    });
+
+    benchCache(runner, "none", std::make_shared<NullCache>(), generator, tiles);
+    benchCache(runner, "memory", std::make_shared<MemCache>(config.tiles_), generator, tiles);
+    {
+        auto dbPath = std::filesystem::temp_directory_path() / "mapget-bench-cache.db";
+        benchCache(runner, "sqlite", std::make_shared<SQLiteCache>(config.tiles_, dbPath.string(), true), generator, tiles);
+        std::filesystem::remove(dbPath);
+    }
+
+    runner.run("service", [&]() {
+        Service service(std::make_shared<NullCache>());
+        service.add(std::make_shared<GeneratorDataSource>(generator));
+        std::atomic<uint64_t> received = 0;
+        auto request = std::make_shared<LayerTilesRequest>(
+            generator.info().mapId_, "WayLayer", generator.tileIds());
+        request->onFeatureLayer([&](auto&&) { ++received; });
+        service.request({request});
+        request->wait();
+        return BenchRunner::Counts{received};
+    });
+
+    nlohmann::json report{
+        {"config", config.toJson()},
+        {"protocol-version", TileLayerStream::CurrentProtocolVersion.toJson()},
+        {"results", runner.results()}};
+
+    if (config.output_.empty()) {
+        std::cout << report.dump(2) << std::endl;
+    }
+    else {
+        std::ofstream out(config.output_);
+        if (!out)
+            raiseFmt("Could not open {} for writing.", config.output_);
+        out << report.dump(2) << std::endl;
+    }
+    return 0;
+}
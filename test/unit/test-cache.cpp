@@ -5,6 +5,7 @@
 #include <catch2/catch_test_macros.hpp>
 #include <chrono>
 #include <memory>
+#include <span>
 #include <thread>
 #include <vector>
 #include <atomic>
@@ -95,7 +96,9 @@ namespace {
             TileLayerStream::CurrentProtocolVersion};
     }
 
-    std::string createSerializedStringPoolMessage(const std::string& testStringPoolNodeId) {
+    std::string createSerializedStringPoolMessage(
+        const std::string& testStringPoolNodeId,
+        Version const& protocolVersion = TileLayerStream::CurrentProtocolVersion) {
         auto testStringPool = StringPool(testStringPoolNodeId);
         
         std::stringstream serializedStrings;
@@ -103,7 +106,7 @@ namespace {
 
         std::stringstream serializedMessage;
         bitsery::Serializer<bitsery::OutputStreamAdapter> s(serializedMessage);
-        s.object(TileLayerStream::CurrentProtocolVersion);
+        s.object(protocolVersion);
         s.value1b(TileLayerStream::MessageType::StringPool);
         s.value4b((uint32_t)serializedStrings.str().size());
         serializedMessage << serializedStrings.str();
@@ -249,17 +252,26 @@ void testCacheImplementation() {
         // Open existing cache.
         auto cache = std::make_shared<CacheType>(
             1, Traits::defaultCacheName, false);
+
+        // String pools are only loaded on demand.
         auto stringPoolCount = cache->getStatistics()["loaded-string-pools"].template get<int>();
-        REQUIRE(stringPoolCount == 1);
+        REQUIRE(stringPoolCount == 0);
 
         // Add a tile to trigger cache cleaning.
         cache->putTileLayer(otherTile);
+        cache->waitForPendingEviction();
+        REQUIRE(cache->getStatistics()["sqlite-tile-count"] == 1);
 
         auto returnedTile = getFeatureLayer(cache, otherTile->id(), otherInfo);
         REQUIRE(returnedTile->nodeId() == otherTile->nodeId());
 
         // String pools are updated with getTileLayer.
         stringPoolCount = cache->getStatistics()["loaded-string-pools"].template get<int>();
+        REQUIRE(stringPoolCount == 1);
+
+        // Other persisted string pools are loaded on first access.
+        cache->getStringPool(nodeId);
+        stringPoolCount = cache->getStatistics()["loaded-string-pools"].template get<int>();
         REQUIRE(stringPoolCount == 2);
 
         // Query the first inserted layer - it should not be retrievable.
@@ -284,7 +296,9 @@ void testCacheImplementation() {
     SECTION("Reopen cache with maxTileCount=1, check older tile was deleted") {
         auto cache = std::make_shared<CacheType>(
             1, Traits::defaultCacheName, false);
+        cache->waitForPendingEviction();
         REQUIRE(cache->getStatistics()["cache-misses"] == 0);
+        REQUIRE(cache->getStatistics()["sqlite-tile-count"] == 1);
 
         // Query the first inserted layer - it should not be retrievable.
         auto missingTile = cache->getTileLayer(otherTile->id(), otherInfo);
@@ -294,6 +308,9 @@ void testCacheImplementation() {
     SECTION("Reopen cache, check loading of string pools") {
         // Open existing cache.
         auto cache = std::make_shared<CacheType>();
+        REQUIRE(cache->getStatistics()["loaded-string-pools"] == 0);
+        cache->getStringPool(nodeId);
+        cache->getStringPool(otherNodeId);
         REQUIRE(cache->getStatistics()["loaded-string-pools"] == 2);
 
         cache->putStringPoolBlob(testStringPoolNodeId, serializedMessage);
@@ -311,13 +328,40 @@ void testCacheImplementation() {
     SECTION("Reopen cache again, check loading of string pools again") {
         // Open existing cache.
         auto cache = std::make_shared<CacheType>();
-        REQUIRE(cache->getStatistics()["loaded-string-pools"] == 3);
+        REQUIRE(cache->getStatistics()["loaded-string-pools"] == 0);
+        cache->getStringPool(testStringPoolNodeId);
+        REQUIRE(cache->getStatistics()["loaded-string-pools"] == 1);
 
         // Check that the same value can still be retrieved from string pooln.
         auto returnedEntry = cache->getStringPoolBlob(testStringPoolNodeId);
         REQUIRE(returnedEntry.value() == serializedMessage);
     }
 
+    SECTION("Reopen cache with a string pool of an incompatible protocol version") {
+        {
+            auto cache = std::make_shared<CacheType>();
+            cache->putStringPoolBlob(nodeId, createSerializedStringPoolMessage(nodeId, Version{0, 0, 1}));
+        }
+
+        // The outdated string pool is treated like a missing one.
+        auto cache = std::make_shared<CacheType>();
+        auto cachedStrings = cache->getStringPool(nodeId);
+        REQUIRE(!!cachedStrings);
+
+        // Writing a tile layer overwrites the outdated string pool.
+        cache->putTileLayer(tile);
+        auto returnedEntry = cache->getStringPoolBlob(nodeId);
+        REQUIRE(returnedEntry.has_value());
+        TileLayerStream::MessageType messageType;
+        uint32_t messageSize;
+        REQUIRE(TileLayerStream::Reader::readMessageHeader(
+            std::as_bytes(std::span(returnedEntry->data(), returnedEntry->size())),
+            messageType,
+            messageSize));
+        REQUIRE(messageType == TileLayerStream::MessageType::StringPool);
+        getFeatureLayer(cache, tile->id(), info);
+    }
+
     SECTION("Create cache under a custom path") {
         auto test_cache = createTempCachePath(Traits::testDirPrefix, Traits::needsDbExtension);
         log().info(fmt::format("Test creating cache: {}", test_cache.string()));
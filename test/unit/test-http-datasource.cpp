@@ -1,13 +1,21 @@
 #include <catch2/catch_test_macros.hpp>
+#include <algorithm>
+#include <atomic>
 #include <filesystem>
 #include <thread>
 #include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <sstream>
 #ifndef _WIN32
 #include <unistd.h>
 #include <fcntl.h>
 #endif
 #include "httplib.h"
 #include "mapget/log.h"
+#include <zstd.h>
 
 #include "utility.h"
 #include "mapget/http-datasource/datasource-client.h"
@@ -16,6 +24,7 @@
 #include "mapget/http-service/http-service.h"
 #include "mapget/model/stream.h"
 #include "mapget/service/config.h"
+#include "mapget/service/nullcache.h"
 #include "mapget/http-service/cli.h"
 
 using namespace mapget;
@@ -224,6 +233,228 @@ TEST_CASE("HttpDataSource", "[HttpDataSource]")
             REQUIRE(dataSourceFeatureRequestCount == 3);
         }
 
+        SECTION("Query through mapget HTTP service with compressed messages")
+        {
+            HttpClient client("localhost", service.port(), {}, true);
+
+            auto [request, receivedTileCount] = countReceivedTiles(
+                client,
+                "Tropico",
+                "WayLayer",
+                std::vector<TileId>{{1234, 5678, 9112, 1234}});
+
+            REQUIRE(receivedTileCount == 4);
+            REQUIRE(request->getStatus() == RequestStatus::Success);
+        }
+
+        SECTION("Query several requests through one mapget HTTP service call")
+        {
+            HttpClient client("localhost", service.port());
+
+            std::atomic_uint32_t firstCount = 0;
+            std::atomic_uint32_t secondCount = 0;
+            auto first = std::make_shared<LayerTilesRequest>("Tropico", "WayLayer", std::vector<TileId>{{1234, 5678}});
+            auto second = std::make_shared<LayerTilesRequest>("Tropico", "WayLayer", std::vector<TileId>{{9112}});
+            first->onFeatureLayer([&](auto&& tile) { firstCount++; });
+            second->onFeatureLayer([&](auto&& tile) { secondCount++; });
+
+            client.request({first, second});
+            first->wait();
+            second->wait();
+            REQUIRE(firstCount == 2);
+            REQUIRE(secondCount == 1);
+            REQUIRE(first->getStatus() == RequestStatus::Success);
+            REQUIRE(second->getStatus() == RequestStatus::Success);
+
+            // Requests on parallel connections, reusing the kept-alive ones.
+            std::vector<LayerTilesRequest::Ptr> parallelRequests;
+            for (auto i = 0; i < 4; ++i)
+                parallelRequests.push_back(client.request(
+                    std::make_shared<LayerTilesRequest>("Tropico", "WayLayer", std::vector<TileId>{{1234}})));
+            for (auto const& request : parallelRequests) {
+                request->wait();
+                REQUIRE(request->getStatus() == RequestStatus::Success);
+            }
+        }
+
+        SECTION("Query through mapget HTTP service with parallel decoding")
+        {
+            HttpClient client("localhost", service.port(), {}, true, 2);
+
+            auto [request, receivedTileCount] = countReceivedTiles(
+                client,
+                "Tropico",
+                "WayLayer",
+                std::vector<TileId>{{1234, 5678, 9112, 1234}});
+
+            REQUIRE(receivedTileCount == 4);
+            REQUIRE(request->getStatus() == RequestStatus::Success);
+        }
+
+        SECTION("Query through mapget HTTP service with filter")
+        {
+            HttpClient client("localhost", service.port());
+
+            auto countFilteredFeatures = [&](std::string filter) {
+                auto featureCount = 0;
+                auto tileCount = 0;
+                auto request = std::make_shared<LayerTilesRequest>(
+                    "Tropico", "WayLayer", std::vector<TileId>{{1234, 5678}});
+                request->filter_ = std::move(filter);
+                request->onFeatureLayer([&](auto&& tile) {
+                    featureCount += tile->size();
+                    tileCount++;
+                });
+                client.request(request)->wait();
+                REQUIRE(tileCount == 2);
+                return featureCount;
+            };
+
+            REQUIRE(countFilteredFeatures("wayId == 0") == 2);
+            REQUIRE(countFilteredFeatures("wayId == 1") == 0);
+            // The second request is answered from the cached filtered variants.
+            REQUIRE(countFilteredFeatures("wayId == 1") == 0);
+            REQUIRE(countFilteredFeatures("") == 2);
+
+            // Requests to the service itself are filtered as well.
+            auto featureCount = 0;
+            auto request = std::make_shared<LayerTilesRequest>(
+                "Tropico", "WayLayer", std::vector<TileId>{{1234}});
+            request->filter_ = "wayId == 1";
+            request->onFeatureLayer([&](auto&& tile) { featureCount += tile->size(); });
+            REQUIRE(service.request({request}));
+            request->wait();
+            REQUIRE(request->getStatus() == RequestStatus::Success);
+            REQUIRE(featureCount == 0);
+
+            // A malformed filter is rejected before any tile is requested.
+            httplib::Client rawClient("localhost", service.port());
+            auto response = rawClient.Post(
+                "/tiles",
+                R"({"requests": [{"mapId": "Tropico", "layerId": "WayLayer", "tileIds": [1234], "filter": "wayId == ("}]})",
+                "application/json");
+            REQUIRE(response != nullptr);
+            REQUIRE(response->status == 400);
+            REQUIRE(response->body.find("Invalid filter") != std::string::npos);
+        }
+
+        SECTION("Search through mapget HTTP service")
+        {
+            httplib::Client client("localhost", service.port());
+
+            auto search = [&](std::string const& body) {
+                auto response = client.Post("/search", body, "application/json");
+                REQUIRE(response != nullptr);
+                std::vector<nlohmann::json> matches;
+                if (response->status != 200)
+                    return std::make_tuple(response->status, matches);
+                std::istringstream lines(response->body);
+                std::string line;
+                while (std::getline(lines, line))
+                    matches.push_back(nlohmann::json::parse(line));
+                return std::make_tuple(response->status, matches);
+            };
+
+            // The bbox covers four tiles at zoom level 10, each of which has one way.
+            auto [status, matches] = search(
+                R"({"mapId": "Tropico", "bbox": [41.9, 10.9, 42.1, 11.1], "zoom": 10, "query": "wayId == 0"})");
+            REQUIRE(status == 200);
+            REQUIRE(matches.size() == 4);
+            REQUIRE(matches[0]["layerId"] == "WayLayer");
+            REQUIRE(matches[0]["feature"]["layerId"] == "WayLayer");
+
+            // The limit terminates the search early.
+            auto [limitedStatus, limitedMatches] = search(
+                R"({"mapId": "Tropico", "layerIds": ["WayLayer"], "bbox": [41.9, 10.9, 42.1, 11.1], "zoom": 10,
+                    "query": "wayId == 0", "limit": 1, "idsOnly": true})");
+            REQUIRE(limitedStatus == 200);
+            REQUIRE(limitedMatches.size() == 1);
+            REQUIRE(!limitedMatches[0].contains("feature"));
+
+            auto [noMatchStatus, noMatches] = search(
+                R"({"mapId": "Tropico", "bbox": [41.9, 10.9, 42.1, 11.1], "zoom": 10, "query": "wayId == 1"})");
+            REQUIRE(noMatchStatus == 200);
+            REQUIRE(noMatches.empty());
+
+            auto [tooLargeStatus, _] = search(
+                R"({"mapId": "Tropico", "bbox": [-180, -90, 180, 90], "zoom": 13, "query": "true"})");
+            REQUIRE(tooLargeStatus == 400);
+
+            // Zoom levels above 15 are rejected instead of being clamped.
+            auto [tooDeepStatus, tooDeepMatches] = search(
+                R"({"mapId": "Tropico", "bbox": [41.99, 10.99, 42, 11], "zoom": 16, "query": "true"})");
+            REQUIRE(tooDeepStatus == 400);
+
+            auto [malformedStatus, malformedMatches] = search(
+                R"({"mapId": "Tropico", "bbox": [41.9, 10.9, 42.1, 11.1], "zoom": 10, "query": "wayId == ("})");
+            REQUIRE(malformedStatus == 400);
+        }
+
+        SECTION("Viewport subscription")
+        {
+            std::mutex receivedMutex;
+            std::condition_variable receivedEvent;
+            std::vector<uint64_t> receivedTileIds;
+            TileLayerStream::Reader reader(
+                [&](auto&& mapId, auto&& layerId) { return info.getLayer(std::string(layerId)); },
+                [&](auto&& layer)
+                {
+                    std::unique_lock lock(receivedMutex);
+                    receivedTileIds.push_back(layer->tileId().value_);
+                    receivedEvent.notify_all();
+                });
+            auto waitForTiles = [&](size_t count) {
+                std::unique_lock lock(receivedMutex);
+                return receivedEvent.wait_for(lock, std::chrono::seconds(10), [&] { return receivedTileIds.size() >= count; });
+            };
+
+            // Keep the subscription stream open on a separate connection.
+            std::thread streamThread([&]
+            {
+                httplib::Client streamClient("localhost", service.port());
+                httplib::Request subscribeRequest;
+                subscribeRequest.method = "POST";
+                subscribeRequest.path = "/subscribe";
+                subscribeRequest.set_header("Content-Type", "application/json");
+                subscribeRequest.body =
+                    R"({"clientId": "viewer", "requests": [{"mapId": "Tropico", "layerId": "WayLayer", "tileIds": [1, 2]}]})";
+                subscribeRequest.content_receiver = [&](const char* data, size_t size, uint64_t, uint64_t) {
+                    reader.read(std::string_view(data, size));
+                    return true;
+                };
+                httplib::Response subscribeResponse;
+                httplib::Error error;
+                streamClient.send(subscribeRequest, subscribeResponse, error);
+            });
+
+            REQUIRE(waitForTiles(2));
+
+            // Only the tile which entered the viewport is requested.
+            httplib::Client client("localhost", service.port());
+            auto update = client.Post(
+                "/subscribe/update",
+                R"({"clientId": "viewer", "requests": [{"mapId": "Tropico", "layerId": "WayLayer", "tileIds": [2, 3]}]})",
+                "application/json");
+            REQUIRE(update != nullptr);
+            REQUIRE(update->status == 200);
+            REQUIRE(nlohmann::json::parse(update->body)["requestedTiles"] == 1);
+            REQUIRE(waitForTiles(3));
+
+            // Closing the subscription ends the stream.
+            REQUIRE(client.Post("/abort", R"({"clientId": "viewer"})", "application/json")->status == 200);
+            streamThread.join();
+            REQUIRE(reader.eos());
+            std::sort(receivedTileIds.begin(), receivedTileIds.end());
+            REQUIRE(receivedTileIds == std::vector<uint64_t>{1, 2, 3});
+            REQUIRE(dataSourceFeatureRequestCount == 3);
+
+            auto staleUpdate = client.Post(
+                "/subscribe/update",
+                R"({"clientId": "viewer", "requests": []})",
+                "application/json");
+            REQUIRE(staleUpdate->status == 404);
+        }
+
         SECTION("Trigger 400 responses")
         {
             HttpClient client("localhost", service.port());
@@ -249,6 +480,533 @@ TEST_CASE("HttpDataSource", "[HttpDataSource]")
             }
         }
 
+        SECTION("Query through mapget HTTP service with zstd response encoding")
+        {
+            httplib::Client client("localhost", service.port());
+            client.set_decompress(false);
+
+            auto response = client.Post(
+                "/tiles",
+                {{"Accept", "application/jsonl"}, {"Accept-Encoding", "gzip;q=0.5, zstd"}},
+                R"({"requests": [{"mapId": "Tropico", "layerId": "WayLayer", "tileIds": [1234, 5678]}]})",
+                "application/json");
+            REQUIRE(response != nullptr);
+            REQUIRE(response->status == 200);
+            REQUIRE(response->get_header_value("Content-Encoding") == "zstd");
+
+            // The body consists of flushed zstd blocks, so decode it as a stream.
+            std::string body;
+            auto dctx = ZSTD_createDStream();
+            ZSTD_inBuffer input{response->body.data(), response->body.size(), 0};
+            std::vector<char> chunk(ZSTD_DStreamOutSize());
+            size_t remaining = 1;
+            while (input.pos < input.size) {
+                ZSTD_outBuffer output{chunk.data(), chunk.size(), 0};
+                remaining = ZSTD_decompressStream(dctx, &output, &input);
+                REQUIRE(!ZSTD_isError(remaining));
+                body.append(chunk.data(), output.pos);
+            }
+            ZSTD_freeDStream(dctx);
+            REQUIRE(remaining == 0);
+
+            // One JSON line per tile.
+            std::istringstream lines(body);
+            std::string line;
+            auto lineCount = 0;
+            while (std::getline(lines, line)) {
+                REQUIRE(nlohmann::json::parse(line)["type"] == "FeatureCollection");
+                ++lineCount;
+            }
+            REQUIRE(lineCount == 2);
+
+            // An explicit refusal takes precedence over the wildcard.
+            auto refused = client.Post(
+                "/tiles",
+                {{"Accept", "application/jsonl"}, {"Accept-Encoding", "*, zstd;q=0"}},
+                R"({"requests": [{"mapId": "Tropico", "layerId": "WayLayer", "tileIds": [1234]}]})",
+                "application/json");
+            REQUIRE(refused != nullptr);
+            REQUIRE(refused->status == 200);
+            REQUIRE(refused->get_header_value("Content-Encoding") != "zstd");
+        }
+
+        SECTION("Fetch /metrics")
+        {
+            HttpClient client("localhost", service.port());
+            auto [request, receivedTileCount] = countReceivedTiles(
+                client,
+                "Tropico",
+                "WayLayer",
+                std::vector<TileId>{{1234, 5678}});
+            REQUIRE(receivedTileCount == 2);
+
+            httplib::Client cli("localhost", service.port());
+            auto response = cli.Get("/metrics");
+            REQUIRE(response != nullptr);
+            REQUIRE(response->status == 200);
+            REQUIRE(response->get_header_value("Content-Type").starts_with("text/plain"));
+
+            auto const& body = response->body;
+            REQUIRE(body.find("# TYPE mapget_tile_fill_seconds histogram") != std::string::npos);
+            REQUIRE(body.find("mapget_tile_fill_seconds_count{map=\"Tropico\"") != std::string::npos);
+            REQUIRE(body.find("mapget_tile_queue_wait_seconds_bucket{le=\"+Inf\"}") != std::string::npos);
+            REQUIRE(body.find("mapget_cache_get_seconds_sum{backend=\"memory\"}") != std::string::npos);
+            REQUIRE(body.find("mapget_cache_put_seconds_count{backend=\"memory\"}") != std::string::npos);
+            REQUIRE(body.find("mapget_tile_serialization_seconds_count{format=\"application/binary\"}") != std::string::npos);
+            REQUIRE(body.find("# TYPE mapget_http_response_bytes_total counter") != std::string::npos);
+            REQUIRE(body.find("# TYPE mapget_tiles_aborted_total counter") != std::string::npos);
+        }
+
+        SECTION("Reject requests beyond the client limits")
+        {
+            // A data source which holds tiles back until it is released,
+            // so the first request stays open.
+            DataSourceServer slowDs(info);
+            std::mutex slowMutex;
+            std::condition_variable slowEvent;
+            bool tileRequested = false;
+            bool released = false;
+            slowDs.onTileFeatureRequest(
+                [&](const auto& tile)
+                {
+                    std::unique_lock lock(slowMutex);
+                    tileRequested = true;
+                    slowEvent.notify_all();
+                    slowEvent.wait(lock, [&] { return released; });
+                });
+            slowDs.go();
+
+            HttpService limitedService;
+            limitedService.add(std::make_shared<RemoteDataSource>("localhost", slowDs.port()));
+            limitedService.setClientLimits(1, 2);
+            limitedService.setClientAddressHeader("X-Forwarded-For");
+            limitedService.go();
+
+            auto tilesRequest = [&](std::string const& tileIds) {
+                httplib::Client client("localhost", limitedService.port());
+                return client.Post(
+                    "/tiles",
+                    {{"Accept", "application/jsonl"}},
+                    fmt::format(R"({{"requests": [{{"mapId": "Tropico", "layerId": "WayLayer", "tileIds": [{}]}}]}})", tileIds),
+                    "application/json");
+            };
+
+            // A single request may not exceed the tile limit.
+            auto tooLarge = tilesRequest("1, 2, 3");
+            REQUIRE(tooLarge != nullptr);
+            REQUIRE(tooLarge->status == 400);
+
+            int openRequestStatus = 0;
+            std::thread openRequest([&] { openRequestStatus = tilesRequest("1")->status; });
+            {
+                std::unique_lock lock(slowMutex);
+                REQUIRE(slowEvent.wait_for(lock, std::chrono::seconds(10), [&] { return tileRequested; }));
+            }
+
+            // The client already has an open request.
+            auto rejected = tilesRequest("2");
+            REQUIRE(rejected != nullptr);
+            REQUIRE(rejected->status == 429);
+            REQUIRE(rejected->get_header_value("Retry-After") == "1");
+
+            // The limits apply to the client, not to its clientIds,
+            // and to searches, single tiles and subscriptions as well.
+            httplib::Client otherClient("localhost", limitedService.port());
+            auto otherClientId = otherClient.Post(
+                "/tiles",
+                {{"Accept", "application/jsonl"}},
+                R"({"requests": [{"mapId": "Tropico", "layerId": "WayLayer", "tileIds": [2]}], "clientId": "other"})",
+                "application/json");
+            REQUIRE(otherClientId != nullptr);
+            REQUIRE(otherClientId->status == 429);
+            auto search = otherClient.Post(
+                "/search",
+                R"({"mapId": "Tropico", "layerIds": ["WayLayer"], "bbox": [0, 0, 0.001, 0.001], "zoom": 2, "query": "true"})",
+                "application/json");
+            REQUIRE(search != nullptr);
+            REQUIRE(search->status == 429);
+            auto tile = otherClient.Get("/tile/Tropico/WayLayer/2");
+            REQUIRE(tile != nullptr);
+            REQUIRE(tile->status == 429);
+            auto subscribe = otherClient.Post(
+                "/subscribe",
+                R"({"clientId": "viewport", "requests": [{"mapId": "Tropico", "layerId": "WayLayer", "tileIds": [2]}]})",
+                "application/json");
+            REQUIRE(subscribe != nullptr);
+            REQUIRE(subscribe->status == 429);
+
+            // Behind a proxy, clients are told apart by the last forwarded address.
+            auto forwardedRequest = [&](std::string const& forwardedFor) {
+                httplib::Client client("localhost", limitedService.port());
+                return client.Post(
+                    "/tiles",
+                    {{"Accept", "application/jsonl"}, {"X-Forwarded-For", forwardedFor}},
+                    R"({"requests": [{"mapId": "Tropico", "layerId": "WayLayer", "tileIds": [3]}]})",
+                    "application/json");
+            };
+            // Of two requests with the same last address, one is admitted while the
+            // client above holds its slot, and the other one is rejected right away.
+            std::atomic_int forwardedStatuses[2] = {0, 0};
+            std::thread forwardedRequests[2] = {
+                std::thread([&] { forwardedStatuses[0] = forwardedRequest("10.0.0.1, 10.0.0.2")->status; }),
+                std::thread([&] { forwardedStatuses[1] = forwardedRequest("10.0.0.3, 10.0.0.2")->status; })};
+            for (auto retries = 0; !forwardedStatuses[0] && !forwardedStatuses[1] && retries < 500; ++retries)
+                std::this_thread::sleep_for(std::chrono::milliseconds(20));
+            REQUIRE(forwardedStatuses[0] + forwardedStatuses[1] == 429);
+
+            {
+                std::unique_lock lock(slowMutex);
+                released = true;
+                slowEvent.notify_all();
+            }
+            openRequest.join();
+            REQUIRE(openRequestStatus == 200);
+            for (auto& forwardedThread : forwardedRequests)
+                forwardedThread.join();
+            REQUIRE(forwardedStatuses[0] + forwardedStatuses[1] == 200 + 429);
+
+            // Once the first request is done, the client is admitted again. The
+            // admission is released right after the response, so allow a few retries.
+            auto admitted = tilesRequest("2");
+            for (auto retries = 0; admitted && admitted->status == 429 && retries < 50; ++retries) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(20));
+                admitted = tilesRequest("2");
+            }
+            REQUIRE(admitted != nullptr);
+            REQUIRE(admitted->status == 200);
+
+            limitedService.stop();
+            slowDs.stop();
+        }
+
+        SECTION("Serve /sources while a streaming response occupies all threads")
+        {
+            DataSourceServer slowDs(info);
+            std::mutex slowMutex;
+            std::condition_variable slowEvent;
+            bool tileRequested = false;
+            bool released = false;
+            slowDs.onTileFeatureRequest(
+                [&](const auto& tile)
+                {
+                    std::unique_lock lock(slowMutex);
+                    tileRequested = true;
+                    slowEvent.notify_all();
+                    slowEvent.wait(lock, [&] { return released; });
+                });
+            slowDs.go();
+
+            // A single thread for connections, which the /tiles response occupies.
+            HttpService pooledService;
+            pooledService.add(std::make_shared<RemoteDataSource>("localhost", slowDs.port()));
+            pooledService.setThreadPool(1, 1, 0);
+            pooledService.go();
+
+            int tilesStatus = 0;
+            std::thread tilesRequest(
+                [&]
+                {
+                    httplib::Client client("localhost", pooledService.port());
+                    auto res = client.Post(
+                        "/tiles",
+                        {{"Accept", "application/jsonl"}},
+                        R"({"requests": [{"mapId": "Tropico", "layerId": "WayLayer", "tileIds": [1]}]})",
+                        "application/json");
+                    tilesStatus = res ? res->status : -1;
+                });
+            {
+                std::unique_lock lock(slowMutex);
+                REQUIRE(slowEvent.wait_for(lock, std::chrono::seconds(10), [&] { return tileRequested; }));
+            }
+
+            // The spare streaming thread serves other requests.
+            httplib::Client client("localhost", pooledService.port());
+            client.set_read_timeout(std::chrono::seconds(5));
+            auto sources = client.Get("/sources");
+            REQUIRE(sources != nullptr);
+            REQUIRE(sources->status == 200);
+
+            auto metrics = client.Get("/metrics");
+            REQUIRE(metrics != nullptr);
+            REQUIRE(metrics->body.find("# TYPE mapget_http_server_streaming_threads gauge") != std::string::npos);
+
+            {
+                std::unique_lock lock(slowMutex);
+                released = true;
+                slowEvent.notify_all();
+            }
+            tilesRequest.join();
+            REQUIRE(tilesStatus == 200);
+
+            pooledService.stop();
+            slowDs.stop();
+        }
+
+        SECTION("Fetch a cacheable tile via GET /tile")
+        {
+            httplib::Client client("localhost", service.port());
+            auto response = client.Get("/tile/Tropico/WayLayer/1234", {{"Accept", "application/json"}});
+            REQUIRE(response != nullptr);
+            REQUIRE(response->status == 200);
+            auto etag = response->get_header_value("ETag");
+            // The ETag only covers the features, so it is weak.
+            REQUIRE(etag.size() > 4);
+            REQUIRE(etag.starts_with("W/\""));
+            REQUIRE(response->get_header_value("Cache-Control").starts_with("public"));
+            REQUIRE(nlohmann::json::parse(response->body)["type"] == "FeatureCollection");
+
+            // A refetch with the ETag is answered without the tile.
+            auto notModified = client.Get(
+                "/tile/Tropico/WayLayer/1234",
+                {{"Accept", "application/json"}, {"If-None-Match", etag}});
+            REQUIRE(notModified != nullptr);
+            REQUIRE(notModified->status == 304);
+            REQUIRE(notModified->body.empty());
+            REQUIRE(notModified->get_header_value("ETag") == etag);
+
+            // The binary tile is self-contained, and has an ETag of its own.
+            auto binary = client.Get("/tile/Tropico/WayLayer/1234", {{"If-None-Match", etag}});
+            REQUIRE(binary != nullptr);
+            REQUIRE(binary->status == 200);
+            REQUIRE(binary->get_header_value("ETag") != etag);
+            auto tileCount = 0;
+            TileLayerStream::Reader reader(
+                [&](auto&& mapId, auto&& layerId) { return info.getLayer(std::string(layerId)); },
+                [&](auto&& tile) { ++tileCount; });
+            reader.read(binary->body);
+            REQUIRE(tileCount == 1);
+
+            auto unknownLayer = client.Get("/tile/Tropico/UnknownLayer/1234");
+            REQUIRE(unknownLayer != nullptr);
+            REQUIRE(unknownLayer->status == 404);
+
+            auto invalidTileId = client.Get("/tile/Tropico/WayLayer/123456789012345678901234567890");
+            REQUIRE(invalidTileId != nullptr);
+            REQUIRE(invalidTileId->status == 400);
+        }
+
+        SECTION("Query the tiles of a viewport")
+        {
+            httplib::Client client("localhost", service.port());
+            auto countLines = [&](std::string const& request)
+            {
+                auto response = client.Post(
+                    "/tiles",
+                    {{"Accept", "application/jsonl"}},
+                    R"({"requests": [)" + request + "]}",
+                    "application/json");
+                REQUIRE(response != nullptr);
+                if (response->status != 200)
+                    return -response->status;
+                std::istringstream lines(response->body);
+                std::string line;
+                auto lineCount = 0;
+                while (std::getline(lines, line))
+                    ++lineCount;
+                return lineCount;
+            };
+
+            // At zoom level 2, tiles are 45 degrees wide and high.
+            REQUIRE(countLines(R"({"mapId": "Tropico", "layerId": "WayLayer", "bbox": [-30, -30, 30, 30], "zoom": 2})") == 4);
+            REQUIRE(countLines(R"({"mapId": "Tropico", "layerId": "WayLayer", "polygon": [[1, 1], [3, 1], [2, 3]], "zoom": 2})") == 1);
+            REQUIRE(countLines(R"({"mapId": "Tropico", "layerId": "WayLayer", "zoom": 2})") == -400);
+        }
+
+        SECTION("Skip tiles outside the zoom levels and coverage of a layer")
+        {
+            // A second map, whose way layer only provides level 2, and
+            // there only the first of the 2x2 tiles starting at (4, 1).
+            auto islandInfoJson = info.toJson();
+            islandInfoJson["mapId"] = "Island";
+            islandInfoJson.erase("nodeId");
+            islandInfoJson["layers"]["WayLayer"]["zoomLevels"] = nlohmann::json::array({2});
+            islandInfoJson["layers"]["WayLayer"]["coverage"] = nlohmann::json::array({{
+                {"min", TileId(4, 1, 2).value_},
+                {"max", TileId(5, 2, 2).value_},
+                {"filled", {true, false, false, false}}}});
+
+            DataSourceServer islandDs(DataSourceInfo::fromJson(islandInfoJson));
+            std::atomic_uint32_t islandRequestCount = 0;
+            islandDs.onTileFeatureRequest([&](auto const& tile) { ++islandRequestCount; });
+            islandDs.go();
+            service.add(std::make_shared<RemoteDataSource>("localhost", islandDs.port()));
+
+            HttpClient client("localhost", service.port());
+            auto [request, receivedTileCount] = countReceivedTiles(
+                client,
+                "Island",
+                "WayLayer",
+                std::vector<TileId>{TileId(4, 1, 2), TileId(5, 1, 2), TileId(8, 2, 3), TileId(2, 0, 1)});
+            REQUIRE(request->getStatus() == RequestStatus::Success);
+            REQUIRE(receivedTileCount == 1);
+            REQUIRE(islandRequestCount == 1);
+
+            httplib::Client cli("localhost", service.port());
+            auto outside = cli.Get("/tile/Island/WayLayer/" + std::to_string(TileId(5, 1, 2).value_));
+            REQUIRE(outside != nullptr);
+            REQUIRE(outside->status == 404);
+            REQUIRE(islandRequestCount == 1);
+
+            islandDs.stop();
+        }
+
+        SECTION("Refresh a tile with a feature-level delta")
+        {
+            // Each fill yields a new version of the tile: The feature with
+            // wayId 0 is kept, the one of the previous fill is replaced.
+            auto deltaInfoJson = info.toJson();
+            deltaInfoJson["mapId"] = "Deltaland";
+            deltaInfoJson.erase("nodeId");
+            DataSourceServer deltaDs(DataSourceInfo::fromJson(deltaInfoJson));
+            std::atomic_int64_t revision = 0;
+            deltaDs.onTileFeatureRequest(
+                [&](auto const& tile)
+                {
+                    tile->newFeature("Way", {{"areaId", "Area42"}, {"wayId", 0}})->addPoint({42., 11.});
+                    int64_t wayId = ++revision;
+                    tile->newFeature("Way", {{"areaId", "Area42"}, {"wayId", wayId}})->addPoint({42., 12.});
+                });
+            deltaDs.go();
+
+            // Without a cache, each request fills the tile again.
+            HttpService deltaService(std::make_shared<NullCache>());
+            deltaService.add(std::make_shared<RemoteDataSource>("localhost", deltaDs.port()));
+            deltaService.go();
+
+            httplib::Client cli("localhost", deltaService.port());
+            auto post = [&](nlohmann::json const& knownTileHashes)
+            {
+                auto request = nlohmann::json::object(
+                    {{"mapId", "Deltaland"}, {"layerId", "WayLayer"}, {"tileIds", nlohmann::json::array({1234})}});
+                if (!knownTileHashes.is_null())
+                    request["knownTileHashes"] = knownTileHashes;
+                return cli.Post(
+                    "/tiles",
+                    {{"Accept", "application/binary"}},
+                    nlohmann::json::object({{"requests", nlohmann::json::array({request})}}).dump(),
+                    "application/json");
+            };
+            auto fetchWith = [&](nlohmann::json const& knownTileHashes)
+            {
+                auto response = post(knownTileHashes);
+                REQUIRE(response != nullptr);
+                REQUIRE(response->status == 200);
+                TileFeatureLayer::Ptr tile;
+                TileLayerStream::Reader reader(
+                    [&](auto&& mapId, auto&& layerId) { return info.getLayer(std::string(layerId)); },
+                    [&](auto&& layer) { tile = std::dynamic_pointer_cast<TileFeatureLayer>(layer); });
+                reader.read(response->body);
+                REQUIRE(tile);
+                return tile;
+            };
+            auto fetch = [&](std::optional<uint64_t> knownHash)
+            {
+                if (!knownHash)
+                    return fetchWith(nullptr);
+                return fetchWith(nlohmann::json::object({{"1234", std::to_string(*knownHash)}}));
+            };
+
+            // The service has not sent the first version to a client
+            // which asked for deltas, so the second one is sent in full.
+            auto first = fetch({});
+            auto second = fetch(first->contentHash());
+            REQUIRE(!second->deltaInfo());
+            REQUIRE(second->size() == 2);
+
+            auto delta = fetch(second->contentHash());
+            REQUIRE(delta->deltaInfo());
+            REQUIRE(delta->deltaInfo()->baseContentHash_ == second->contentHash());
+            REQUIRE(delta->size() == 1);
+            REQUIRE(delta->deltaInfo()->removedFeatureIdHashes_.size() == 1);
+
+            // The patched tile is the third version.
+            auto third = delta->applyDelta(second);
+            REQUIRE(third->size() == 2);
+            REQUIRE(third->find("Way", KeyValuePairs{{"areaId", "Area42"}, {"wayId", 0}}));
+            REQUIRE(third->find("Way", KeyValuePairs{{"areaId", "Area42"}, {"wayId", 3}}));
+            REQUIRE(!third->find("Way", KeyValuePairs{{"areaId", "Area42"}, {"wayId", 2}}));
+
+            // A client which opted in for the map layer, but does not hold the
+            // tile yet, receives it in full, and its next refresh is a delta.
+            auto fourth = fetchWith(nlohmann::json::object());
+            REQUIRE(!fourth->deltaInfo());
+            auto fifthDelta = fetch(fourth->contentHash());
+            REQUIRE(fifthDelta->deltaInfo());
+            REQUIRE(fifthDelta->deltaInfo()->baseContentHash_ == fourth->contentHash());
+
+            // Malformed tile ids and hashes are rejected.
+            for (auto const& malformed : {
+                     nlohmann::json::object({{"tile", "1"}}),
+                     nlohmann::json::object({{"1234", "-1"}}),
+                     nlohmann::json::object({{"1234", "12abc"}}),
+                     nlohmann::json::object({{"1234", nlohmann::json::array()}})}) {
+                auto response = post(malformed);
+                REQUIRE(response != nullptr);
+                REQUIRE(response->status == 400);
+            }
+
+            deltaService.stop();
+            deltaDs.stop();
+        }
+
+        SECTION("Query through mapget HTTP service with a full response buffer")
+        {
+            // Each tile fills the buffer, so the request is paused
+            // until the tile was streamed, and then resumed.
+            service.setMaxResponseBuffer(1);
+            HttpClient client("localhost", service.port());
+
+            auto [request, receivedTileCount] = countReceivedTiles(
+                client,
+                "Tropico",
+                "WayLayer",
+                std::vector<TileId>{{1, 2, 3, 4, 5, 6, 7, 8}});
+            REQUIRE(receivedTileCount == 8);
+            REQUIRE(request->getStatus() == RequestStatus::Success);
+
+            httplib::Client cli("localhost", service.port());
+            auto metrics = cli.Get("/metrics");
+            REQUIRE(metrics != nullptr);
+            std::istringstream lines(metrics->body);
+            std::string line;
+            uint64_t pauses = 0;
+            while (std::getline(lines, line)) {
+                if (line.starts_with("mapget_http_response_pauses_total "))
+                    pauses = std::stoull(line.substr(line.find(' ') + 1));
+            }
+            REQUIRE(pauses > 0);
+        }
+
+        SECTION("Trace a request and fetch /traces")
+        {
+            httplib::Client client("localhost", service.port());
+            auto response = client.Post(
+                "/tiles",
+                {{"Accept", "application/binary"}},
+                R"({"requests": [{"mapId": "Tropico", "layerId": "WayLayer", "tileIds": [1234, 5678]}], "trace": true})",
+                "application/json");
+            REQUIRE(response != nullptr);
+            REQUIRE(response->status == 200);
+
+            auto tracesResponse = client.Get("/traces");
+            REQUIRE(tracesResponse != nullptr);
+            REQUIRE(tracesResponse->status == 200);
+            auto traceJson = nlohmann::json::parse(tracesResponse->body);
+
+            std::set<std::string> spanNames;
+            for (auto const& event : traceJson["traceEvents"]) {
+                if (event["ph"] == "X")
+                    spanNames.insert(event["name"].get<std::string>());
+            }
+            REQUIRE(spanNames.count("queue"));
+            REQUIRE(spanNames.count("Service::Worker::work"));
+            REQUIRE(spanNames.count("DataSource::get"));
+            REQUIRE(spanNames.count("Cache::putTileLayer"));
+            REQUIRE(spanNames.count("TileLayerStream::Writer::write"));
+            REQUIRE(spanNames.count("HttpTilesRequestState::addResult"));
+            REQUIRE(spanNames.count("HttpService::stream"));
+        }
+
         SECTION("Run /locate through service")
         {
             httplib::Client client("localhost", service.port());
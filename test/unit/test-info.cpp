@@ -58,3 +58,38 @@ TEST_CASE("InfoFromJson", "[DataSourceInfo]")
     // Attempting to deserialize should throw an exception because "mapId" is missing.
     REQUIRE_THROWS_AS(DataSourceInfo::fromJson(j), std::runtime_error);
 }
+
+TEST_CASE("LayerCoverage", "[DataSourceInfo]")
+{
+    // Only the north-western tile of the 2x2 block at level 3 is filled.
+    auto layer = LayerInfo::fromJson(R"({
+        "type": "SourceData",
+        "coverage": [{"min": 17180000259, "max": 21475033091, "filled": [true, false, false, false]}]
+    })"_json);
+    REQUIRE(layer->coverage_[0].min_ == TileId(4, 2, 3));
+    REQUIRE(layer->coverage_[0].max_ == TileId(5, 3, 3));
+
+    REQUIRE(layer->covers(TileId(4, 2, 3)));
+    REQUIRE_FALSE(layer->covers(TileId(5, 2, 3)));
+    REQUIRE_FALSE(layer->covers(TileId(4, 3, 3)));
+
+    // Tiles on other levels are checked against their ancestors or descendants.
+    REQUIRE(layer->covers(TileId(9, 5, 4)));
+    REQUIRE_FALSE(layer->covers(TileId(10, 5, 4)));
+    REQUIRE(layer->covers(TileId(2, 1, 2)));
+    REQUIRE_FALSE(layer->covers(TileId(3, 1, 2)));
+
+    // The coverage index agrees with the coverages themselves.
+    REQUIRE(layer->coverageIndex_);
+    for (auto const& tile : {TileId(4, 2, 3), TileId(5, 2, 3), TileId(9, 5, 4), TileId(10, 5, 4), TileId(2, 1, 2), TileId(3, 1, 2), TileId(0, 0, 0)})
+        REQUIRE(layer->coverageIndex_->intersects(tile) == layer->coverage_[0].intersects(tile));
+
+    // A layer without coverages covers everything.
+    REQUIRE(LayerInfo::fromJson(R"({"type": "SourceData"})"_json)->covers(TileId(10, 5, 4)));
+
+    // Tiles on levels which the layer does not list are not covered.
+    layer->zoomLevels_ = {3};
+    REQUIRE(layer->covers(TileId(4, 2, 3)));
+    REQUIRE_FALSE(layer->covers(TileId(9, 5, 4)));
+    REQUIRE_FALSE(LayerInfo::fromJson(R"({"type": "SourceData", "zoomLevels": [2]})"_json)->covers(TileId(10, 5, 4)));
+}
@@ -1,6 +1,16 @@
 #include <catch2/catch_test_macros.hpp>
+#include <algorithm>
+#include <chrono>
+#include <limits>
+#include <sstream>
+#include <thread>
+#include <variant>
+
+#include <bitsery/adapter/stream.h>
 
 #include "mapget/model/featurelayer.h"
+#include "mapget/model/flat-column.h"
+#include "simfil/model/bitsery-traits.h"
 #include "mapget/model/stream.h"
 #include "nlohmann/json.hpp"
 #include "mapget/log.h"
@@ -167,6 +177,22 @@ TEST_CASE("FeatureLayer", "[test.featurelayer]")
         REQUIRE(res == exp);
     }
 
+    SECTION("writeJson")
+    {
+        // Strings which need escaping, and floats without fractional part.
+        feature1->attributes()->addField("quoted", "\"Salt\" \\ Pepper\n\t\x01");
+        feature1->attributes()->addField("weight", 2.);
+
+        std::string json;
+        tile->writeJson(json);
+        auto res = nlohmann::json::parse(json);
+
+        INFO(nlohmann::json::diff(tile->toJson(), res).dump());
+        REQUIRE(res == tile->toJson());
+        REQUIRE(res["features"][1]["properties"]["quoted"] == "\"Salt\" \\ Pepper\n\t\x01");
+        REQUIRE(res["features"][1]["properties"]["weight"].is_number_float());
+    }
+
     SECTION("Basic field access")
     {
         REQUIRE(feature1->typeId() == "Way");
@@ -182,6 +208,23 @@ TEST_CASE("FeatureLayer", "[test.featurelayer]")
             "true");
     }
 
+    SECTION("Filter")
+    {
+        auto filtered = tile->filter("properties.main_ingredient == 'Pepper'");
+        REQUIRE(filtered->size() == 1);
+        REQUIRE(filtered->at(0)->id()->toString() == "Way.TheBestArea.42");
+        REQUIRE(filtered->at(0)->evaluate("**.mozzarella.smell").value().toString() == "neutral");
+        REQUIRE(filtered->tileId() == tile->tileId());
+        REQUIRE(filtered->timestamp() == tile->timestamp());
+
+        REQUIRE(tile->filter("properties.main_ingredient == 'Tomato'")->size() == 0);
+        REQUIRE(tile->filter("typeId == 'Way'")->size() == 2);
+        REQUIRE_THROWS(tile->filter("properties.("));
+
+        REQUIRE(TileFeatureLayer::compileQuery("properties.main_ingredient == 'Pepper'"));
+        REQUIRE(!TileFeatureLayer::compileQuery("properties.("));
+    }
+
     SECTION("Range-based for loop")
     {
         for (auto feature : *tile) {
@@ -304,6 +347,359 @@ TEST_CASE("FeatureLayer", "[test.featurelayer]")
         REQUIRE(readTiles[0]->numRoots() == 2);
         REQUIRE(readTiles[1]->numRoots() == 2);
         REQUIRE(readTiles[2]->numRoots() == 3);
+
+        // Reading the whole stream at once parses all messages
+        // directly from the passed bytes.
+        std::vector<TileFeatureLayer::Ptr> readTilesAtOnce;
+        TileLayerStream::Reader readerAtOnce{
+            [&](auto&& mapId, auto&& layerId) { return layerInfo; },
+            [&](auto&& layerPtr) {
+                if (auto featureLayer = std::dynamic_pointer_cast<TileFeatureLayer>(layerPtr))
+                    readTilesAtOnce.push_back(featureLayer);
+            },
+        };
+        readerAtOnce.read(byteStreamData);
+        REQUIRE(readerAtOnce.eos());
+        REQUIRE(readTilesAtOnce.size() == 3);
+        REQUIRE(readTilesAtOnce[2]->numRoots() == 3);
+
+        // With parallel decoding, string pool updates are still applied
+        // before the dependent tiles, and tiles arrive in stream order.
+        std::vector<TileFeatureLayer::Ptr> readTilesInParallel;
+        TileLayerStream::Reader parallelReader{
+            [&](auto&& mapId, auto&& layerId) { return layerInfo; },
+            [&](auto&& layerPtr) {
+                if (auto featureLayer = std::dynamic_pointer_cast<TileFeatureLayer>(layerPtr))
+                    readTilesInParallel.push_back(featureLayer);
+            },
+        };
+        parallelReader.enableParallelDecoding(3);
+        for (auto i = 0; i < byteStreamData.size(); i += 7)
+            parallelReader.read(std::string_view(byteStreamData).substr(i, 7));
+        parallelReader.waitForPendingLayers();
+        REQUIRE(parallelReader.eos());
+        REQUIRE(readTilesInParallel.size() == 3);
+        REQUIRE(readTilesInParallel[0]->numRoots() == 2);
+        REQUIRE(readTilesInParallel[1]->numRoots() == 2);
+        REQUIRE(readTilesInParallel[2]->numRoots() == 3);
+        REQUIRE(readTilesInParallel[2]->strings() == readTilesInParallel[0]->strings());
+
+        // A Writer which appends to an output string directly must
+        // produce the same bytes as one which reports each message.
+        std::string callbackOutput;
+        TileLayerStream::StringPoolOffsetMap callbackStringOffsets;
+        TileLayerStream::Writer callbackWriter{
+            [&](auto&& msg, auto&& type) { callbackOutput += msg; },
+            callbackStringOffsets};
+        callbackWriter.write(tile);
+        callbackWriter.sendEndOfStream();
+
+        std::string directOutput;
+        TileLayerStream::StringPoolOffsetMap directStringOffsets;
+        TileLayerStream::Writer directWriter{directOutput, directStringOffsets};
+        directWriter.write(tile);
+        directWriter.sendEndOfStream();
+
+        REQUIRE(!directOutput.empty());
+        REQUIRE(directOutput == callbackOutput);
+
+        // Compressed messages are flagged in the header and
+        // transparently decompressed by the Reader.
+        std::string compressedOutput;
+        TileLayerStream::StringPoolOffsetMap compressedStringOffsets;
+        TileLayerStream::Writer compressedWriter{compressedOutput, compressedStringOffsets};
+        compressedWriter.enableCompression();
+        compressedWriter.write(tile);
+
+        auto compressedBytes = std::as_bytes(std::span(compressedOutput.data(), compressedOutput.size()));
+        auto numCompressedMessages = 0;
+        TileLayerStream::MessageType headerType;
+        uint32_t headerSize;
+        while (TileLayerStream::Reader::readMessageHeader(compressedBytes, headerType, headerSize)) {
+            if (static_cast<uint8_t>(headerType) & TileLayerStream::CompressedMessageFlag)
+                ++numCompressedMessages;
+            compressedBytes = compressedBytes.subspan(TileLayerStream::MessageHeaderSize + headerSize);
+        }
+        REQUIRE(numCompressedMessages > 0);
+
+        std::vector<TileFeatureLayer::Ptr> decompressedTiles;
+        TileLayerStream::Reader compressedReader{
+            [&](auto&& mapId, auto&& layerId) { return layerInfo; },
+            [&](auto&& layerPtr) {
+                if (auto featureLayer = std::dynamic_pointer_cast<TileFeatureLayer>(layerPtr))
+                    decompressedTiles.push_back(featureLayer);
+            },
+        };
+        compressedReader.read(compressedOutput);
+        REQUIRE(compressedReader.eos());
+        REQUIRE(decompressedTiles.size() == 1);
+        REQUIRE(decompressedTiles[0]->numRoots() == tile->numRoots());
+
+        // A compressed message whose zstd frame declares an excessive
+        // content size is rejected before anything is allocated.
+        compressedBytes = std::as_bytes(std::span(compressedOutput.data(), compressedOutput.size()));
+        while (TileLayerStream::Reader::readMessageHeader(compressedBytes, headerType, headerSize) &&
+               !(static_cast<uint8_t>(headerType) & TileLayerStream::CompressedMessageFlag))
+            compressedBytes = compressedBytes.subspan(TileLayerStream::MessageHeaderSize + headerSize);
+        std::string hostileMessage(reinterpret_cast<char const*>(compressedBytes.data()), 7);
+        // Frame header: Magic number, single segment with an 8-byte content size.
+        std::string hostileFrame{'\x28', '\xB5', '\x2F', '\xFD', '\xE0'};
+        uint64_t declaredSize = uint64_t(1) << 40;
+        for (auto i = 0; i < 8; ++i)
+            hostileFrame.push_back(static_cast<char>((declaredSize >> (8 * i)) & 0xFF));
+        for (auto i = 0; i < 4; ++i)
+            hostileMessage.push_back(static_cast<char>((hostileFrame.size() >> (8 * i)) & 0xFF));
+        hostileMessage += hostileFrame;
+
+        TileLayerStream::Reader hostileReader{
+            [&](auto&& mapId, auto&& layerId) { return layerInfo; },
+            [&](auto&& layerPtr) {}};
+        REQUIRE_THROWS(hostileReader.read(hostileMessage));
+    }
+
+    SECTION("Delta")
+    {
+        auto baseDigest = tile->featureDigest();
+        auto baseHash = tile->contentHash();
+        REQUIRE(baseDigest.size() == 2);
+        REQUIRE(TileFeatureLayer::contentHash(baseDigest) == baseHash);
+
+        // An unchanged tile yields an empty delta.
+        auto unchangedDelta = tile->deltaFrom(baseDigest);
+        REQUIRE(unchangedDelta->size() == 0);
+        REQUIRE(unchangedDelta->deltaInfo()->baseContentHash_ == baseHash);
+        REQUIRE(unchangedDelta->deltaInfo()->removedFeatureIdHashes_.empty());
+
+        // Create a newer version of the tile, where feature0 is removed,
+        // feature1 is modified, and another feature is added.
+        auto newTile = std::make_shared<TileFeatureLayer>(
+            tile->tileId(), tile->nodeId(), tile->mapId(), layerInfo, strings);
+        newTile->setIdPrefix({{"areaId", "TheBestArea"}});
+        std::unordered_map<uint32_t, simfil::ModelNode::Ptr> clonedNodes;
+        newTile->clone(clonedNodes, tile, *feature1, "Way", feature1->id()->keyValuePairs());
+        newTile->at(0)->attributes()->addField("revision", (int64_t)2);
+        newTile->newFeature("Way", {{"wayId", 99}})->addPoint({42., 11.});
+        REQUIRE(newTile->contentHash() != baseHash);
+
+        auto delta = newTile->deltaFrom(baseDigest);
+        REQUIRE(delta->size() == 2);
+        REQUIRE(delta->deltaInfo()->removedFeatureIdHashes_.size() == 1);
+
+        // Deltas are sent as a separate message type.
+        std::string deltaBytes;
+        TileLayerStream::StringPoolOffsetMap deltaStringOffsets;
+        TileLayerStream::Writer deltaWriter{deltaBytes, deltaStringOffsets};
+        deltaWriter.write(delta);
+
+        auto remainingBytes = std::as_bytes(std::span(deltaBytes.data(), deltaBytes.size()));
+        auto numDeltaMessages = 0;
+        TileLayerStream::MessageType headerType;
+        uint32_t headerSize;
+        while (TileLayerStream::Reader::readMessageHeader(remainingBytes, headerType, headerSize)) {
+            if (headerType == TileLayerStream::MessageType::TileFeatureLayerDelta)
+                ++numDeltaMessages;
+            remainingBytes = remainingBytes.subspan(TileLayerStream::MessageHeaderSize + headerSize);
+        }
+        REQUIRE(numDeltaMessages == 1);
+
+        TileFeatureLayer::Ptr receivedDelta;
+        TileLayerStream::Reader deltaReader{
+            [&](auto&& mapId, auto&& layerId) { return layerInfo; },
+            [&](auto&& layerPtr) { receivedDelta = std::dynamic_pointer_cast<TileFeatureLayer>(layerPtr); },
+        };
+        deltaReader.read(deltaBytes);
+        REQUIRE(receivedDelta);
+        REQUIRE(receivedDelta->deltaInfo());
+        REQUIRE(receivedDelta->deltaInfo()->baseContentHash_ == baseHash);
+
+        // Applying the delta to the base version restores the new version.
+        auto patchedTile = receivedDelta->applyDelta(tile);
+        REQUIRE(!patchedTile->deltaInfo());
+        REQUIRE(patchedTile->size() == 2);
+        REQUIRE(patchedTile->contentHash() == newTile->contentHash());
+        REQUIRE_THROWS(receivedDelta->applyDelta(newTile));
+    }
+
+    SECTION("Quantized vertices")
+    {
+        // Add a geometry with elevation, so both the
+        // 2D and the 3D vertex encoding are covered.
+        auto feature2 = tile->newFeature("Way", {{"wayId", 77}});
+        feature2->addLine({{41.1, 10.1, 512.25}, {41.2, 10.15, 513.5}, {41.25, 10.2, 511.}});
+
+        auto collectPoints = [](TileFeatureLayer& layer) {
+            std::vector<Point> points;
+            for (auto feature : layer) {
+                if (auto geom = feature->geomOrNull()) {
+                    geom->forEachGeometry([&points](auto&& geometry) {
+                        for (auto i = 0; i < geometry->numPoints(); ++i)
+                            points.push_back(geometry->pointAt(i));
+                        return true;
+                    });
+                }
+            }
+            return points;
+        };
+
+        tile->setVertexPrecision(1e-7, 1e-3);
+        std::string quantizedBytes;
+        StringOutputStream quantizedStream(quantizedBytes);
+        tile->write(quantizedStream);
+
+        ByteSpanInputStream readStream(std::as_bytes(std::span(quantizedBytes.data(), quantizedBytes.size())));
+        auto readTile = std::make_shared<TileFeatureLayer>(
+            readStream,
+            [&](auto&& mapId, auto&& layerId) { return layerInfo; },
+            [&](auto&& nodeId) { return strings; },
+            true);
+        REQUIRE(readTile->vertexPrecision() == tile->vertexPrecision());
+
+        // Only quantized layers are flagged in the stream, so
+        // others remain readable for older 0.1.x readers.
+        auto streamedMessageType = [&]()
+        {
+            std::string streamBytes;
+            TileLayerStream::StringPoolOffsetMap offsets;
+            TileLayerStream::Writer writer{streamBytes, offsets};
+            writer.write(tile);
+            auto bytes = std::as_bytes(std::span(streamBytes.data(), streamBytes.size()));
+            TileLayerStream::MessageType type = TileLayerStream::MessageType::None;
+            uint32_t size = 0;
+            while (TileLayerStream::Reader::readMessageHeader(bytes, type, size) &&
+                   type == TileLayerStream::MessageType::StringPool)
+                bytes = bytes.subspan(TileLayerStream::MessageHeaderSize + size);
+            return static_cast<uint8_t>(type);
+        };
+        REQUIRE(streamedMessageType() ==
+            (static_cast<uint8_t>(TileLayerStream::MessageType::TileFeatureLayer) | TileLayerStream::QuantizedMessageFlag));
+        TileLayer::Ptr streamedTile;
+        TileLayerStream::Reader reader{
+            [&](auto&& mapId, auto&& layerId) { return layerInfo; },
+            [&](auto&& layer) { streamedTile = layer; }};
+        {
+            std::string streamBytes;
+            TileLayerStream::StringPoolOffsetMap offsets;
+            TileLayerStream::Writer writer{streamBytes, offsets};
+            writer.write(tile);
+            reader.read(streamBytes);
+        }
+        REQUIRE(!!streamedTile);
+        REQUIRE(std::static_pointer_cast<TileFeatureLayer>(streamedTile)->vertexPrecision() == tile->vertexPrecision());
+
+        auto originalPoints = collectPoints(*tile);
+        auto readPoints = collectPoints(*readTile);
+        REQUIRE(!originalPoints.empty());
+        REQUIRE(readPoints.size() == originalPoints.size());
+        for (auto i = 0; i < originalPoints.size(); ++i) {
+            REQUIRE(std::abs(readPoints[i].x - originalPoints[i].x) < 1e-6);
+            REQUIRE(std::abs(readPoints[i].y - originalPoints[i].y) < 1e-6);
+            REQUIRE(std::abs(readPoints[i].z - originalPoints[i].z) < 1e-3);
+        }
+
+        tile->setVertexPrecision(0.);
+        REQUIRE(streamedMessageType() == static_cast<uint8_t>(TileLayerStream::MessageType::TileFeatureLayer));
+
+        // A precision in the layer info applies to new layers.
+        auto quantizedLayerInfo = std::make_shared<LayerInfo>(*layerInfo);
+        quantizedLayerInfo->vertexPrecision_ = 1e-7;
+        auto newTile = std::make_shared<TileFeatureLayer>(
+            tile->tileId(), tile->nodeId(), tile->mapId(), quantizedLayerInfo, strings);
+        REQUIRE(newTile->vertexPrecision().first == 1e-7);
+
+        REQUIRE_THROWS(tile->setVertexPrecision(1e-7, 0.));
+    }
+
+    SECTION("MVT")
+    {
+        // Minimal protobuf reader: Returns (field, varint or bytes) pairs.
+        using ProtoField = std::pair<uint32_t, std::variant<uint64_t, std::string_view>>;
+        auto parseProto = [](std::string_view bytes)
+        {
+            std::vector<ProtoField> fields;
+            size_t pos = 0;
+            auto varint = [&]()
+            {
+                uint64_t result = 0;
+                for (auto shift = 0; shift < 64; shift += 7) {
+                    auto byte = static_cast<uint8_t>(bytes.at(pos++));
+                    result |= uint64_t(byte & 0x7f) << shift;
+                    if (!(byte & 0x80))
+                        break;
+                }
+                return result;
+            };
+            while (pos < bytes.size()) {
+                auto tag = varint();
+                auto field = static_cast<uint32_t>(tag >> 3);
+                if ((tag & 7) == 0)
+                    fields.emplace_back(field, varint());
+                else if ((tag & 7) == 2) {
+                    auto size = varint();
+                    fields.emplace_back(field, bytes.substr(pos, size));
+                    pos += size;
+                }
+                else
+                    FAIL("Unexpected wire type");
+            }
+            return fields;
+        };
+
+        // A line which crosses the tile diagonally from SW to NE.
+        auto sw = tile->tileId().sw();
+        auto ne = tile->tileId().ne();
+        auto diagonal = tile->newFeature("Way", {{"wayId", 99}});
+        diagonal->addLine({sw, ne});
+        diagonal->attributes()->addField("lanes", (int64_t)2);
+        // A point at the center of the tile, which becomes a separate MVT feature.
+        diagonal->addPoint({(sw.x + ne.x) / 2., (sw.y + ne.y) / 2.});
+
+        auto mvt = tile->toMvt();
+        auto tileFields = parseProto(mvt);
+        REQUIRE(tileFields.size() == 1);
+        REQUIRE(tileFields[0].first == 3);
+
+        std::vector<std::string_view> keys;
+        std::vector<std::string_view> features;
+        for (auto const& [field, value] : parseProto(std::get<std::string_view>(tileFields[0].second))) {
+            if (field == 1)
+                REQUIRE(std::get<std::string_view>(value) == "WayLayer");
+            if (field == 2)
+                features.push_back(std::get<std::string_view>(value));
+            if (field == 3)
+                keys.push_back(std::get<std::string_view>(value));
+            if (field == 5)
+                REQUIRE(std::get<uint64_t>(value) == 4096);
+            if (field == 15)
+                REQUIRE(std::get<uint64_t>(value) == 2);
+        }
+        REQUIRE(std::find(keys.begin(), keys.end(), "lanes") != keys.end());
+        REQUIRE(std::find(keys.begin(), keys.end(), "wayId") != keys.end());
+        REQUIRE(std::find(keys.begin(), keys.end(), "areaId") != keys.end());
+
+        // The other features are far outside of the tile and clipped away.
+        // The point and the line of the diagonal feature are written as
+        // MVT features with distinct ids.
+        REQUIRE(features.size() == 2);
+        auto const featureIndex = tile->size() - 1;
+        for (auto const& [field, value] : parseProto(features[0])) {
+            if (field == 1)
+                REQUIRE(std::get<uint64_t>(value) == featureIndex * 3);
+            if (field == 3)
+                REQUIRE(std::get<uint64_t>(value) == 1);  // Point
+        }
+        for (auto const& [field, value] : parseProto(features[1])) {
+            if (field == 1)
+                REQUIRE(std::get<uint64_t>(value) == featureIndex * 3 + 1);
+            if (field == 3)
+                REQUIRE(std::get<uint64_t>(value) == 2);  // LineString
+            if (field == 4) {
+                // MoveTo(0, 4096), LineTo(+4096, -4096), zigzag-encoded.
+                std::vector<uint64_t> commands;
+                for (auto const& [_, command] : parseProto(std::get<std::string_view>(value)))
+                    commands.push_back(std::get<uint64_t>(command));
+                REQUIRE(commands == std::vector<uint64_t>{9, 0, 8192, 10, 8192, 8191});
+            }
+        }
     }
 
     SECTION("Find")
@@ -337,6 +733,59 @@ void REQUIRE_EQUAL(const Point& p1, const Point& p2, double eps = 1e-6) {
     REQUIRE(std::abs(p1.y - p2.y) < eps);
 }
 
+namespace
+{
+
+// A column row without padding, like Feature::Data.
+struct FlatRow
+{
+    uint32_t a_ = 0;
+    int32_t b_ = 0;
+    uint32_t c_ = 0;
+
+    template <typename S>
+    void serialize(S& s)
+    {
+        s.value4b(a_);
+        s.value4b(b_);
+        s.value4b(c_);
+    }
+};
+
+}
+
+TEST_CASE("FlatColumnExt", "[FlatColumnExt]")
+{
+    // Use a small page size, so that the column has a partial last page.
+    sfl::segmented_vector<FlatRow, 4> column;
+    for (uint32_t i = 0; i < 10; ++i)
+        column.push_back({i, -static_cast<int32_t>(i), 0xABCD0000u + i});
+
+    auto write = [](auto&& serializeColumn) {
+        std::stringstream stream;
+        bitsery::Serializer<bitsery::OutputStreamAdapter> s(stream);
+        serializeColumn(s);
+        s.adapter().flush();
+        return stream.str();
+    };
+    auto flatBytes = write([&](auto& s) { s.ext(column, bitsery::ext::FlatColumnExt{}); });
+    auto containerBytes = write([&](auto& s) { s.container(column, std::numeric_limits<uint32_t>::max()); });
+    REQUIRE(flatBytes == containerBytes);
+
+    // Bytes written by s.container() are read back by the extension.
+    std::stringstream input(containerBytes);
+    bitsery::Deserializer<bitsery::InputStreamAdapter> d(input);
+    sfl::segmented_vector<FlatRow, 4> readColumn;
+    d.ext(readColumn, bitsery::ext::FlatColumnExt{});
+    REQUIRE(d.adapter().error() == bitsery::ReaderError::NoError);
+    REQUIRE(readColumn.size() == column.size());
+    for (size_t i = 0; i < column.size(); ++i) {
+        REQUIRE(readColumn[i].a_ == column[i].a_);
+        REQUIRE(readColumn[i].b_ == column[i].b_);
+        REQUIRE(readColumn[i].c_ == column[i].c_);
+    }
+}
+
 TEST_CASE("TileId", "[TileId]") {
     using namespace mapget;
 
@@ -400,4 +849,174 @@ TEST_CASE("TileId", "[TileId]") {
         REQUIRE_THROWS(tile2.neighbor(2, 0));
         REQUIRE_THROWS(tile2.neighbor(-2, 0));
     }
+
+    SECTION("Tiles in bounding box") {
+        auto world = TileId::tilesInBbox({-180, -90}, {180, 90}, 1, 100);
+        REQUIRE(world.size() == 8);
+        REQUIRE(world.front() == TileId(0, 0, 1));
+        REQUIRE(world.back() == TileId(3, 1, 1));
+
+        // Boxes across the antimeridian wrap around.
+        auto wrapped = TileId::tilesInBbox({170, 10}, {-170, 20}, 2, 100);
+        REQUIRE(wrapped.size() == 2);
+        REQUIRE(wrapped[0] == TileId(7, 1, 2));
+        REQUIRE(wrapped[1] == TileId(0, 1, 2));
+
+        auto small = TileId::tilesInBbox({42., 11.}, {42., 11.}, 13, 100);
+        REQUIRE(small.size() == 1);
+        REQUIRE(small[0] == TileId::fromWgs84(42., 11., 13));
+
+        REQUIRE_THROWS(TileId::tilesInBbox({-180, -90}, {180, 90}, 10, 100));
+        REQUIRE_THROWS(TileId::tilesInBbox({42., 11.}, {42., 11.}, 16, 100));
+    }
+
+    SECTION("Sort tiles by distance") {
+        auto tiles = TileId::tilesInBbox({-180, -90}, {180, 90}, 1, 100);
+        TileId::sortByDistance(tiles, {100., 40.});
+        REQUIRE(tiles.size() == 8);
+        REQUIRE(tiles.front() == TileId(3, 0, 1));
+        REQUIRE(tiles.back() == TileId(1, 1, 1));
+
+        // Distances wrap at the antimeridian.
+        auto wrapped = TileId::tilesInBbox({170, 10}, {-170, 20}, 2, 100);
+        TileId::sortByDistance(wrapped, {-175., 15.});
+        REQUIRE(wrapped[0] == TileId(0, 1, 2));
+        REQUIRE(wrapped[1] == TileId(7, 1, 2));
+    }
+}
+
+namespace
+{
+
+// Layer of the throughput benchmarks, with a tile which resembles a dense road tile.
+std::pair<std::shared_ptr<LayerInfo>, TileFeatureLayer::Ptr> makeThroughputTile()
+{
+    auto layerInfo = LayerInfo::fromJson(R"({
+        "layerId": "WayLayer",
+        "type": "Features",
+        "featureTypes": [
+            {
+                "name": "Way",
+                "uniqueIdCompositions": [[
+                    {"partId": "areaId", "datatype": "STR"},
+                    {"partId": "wayId", "datatype": "U32"}
+                ]]
+            }
+        ]
+    })"_json);
+
+    auto strings = std::make_shared<StringPool>("ThroughputNode");
+    auto tile = std::make_shared<TileFeatureLayer>(
+        TileId::fromWgs84(11., 48., 13), "ThroughputNode", "Tropico", layerInfo, strings);
+    tile->setIdPrefix({{"areaId", "ThroughputArea"}});
+    for (auto i = 0; i < 5000; ++i) {
+        auto feature = tile->newFeature("Way", {{"wayId", i}});
+        std::vector<Point> points;
+        for (auto j = 0; j < 32; ++j)
+            points.emplace_back(11. + i * 1e-5 + j * 1e-6, 48. + j * 1e-6, j);
+        feature->addLine(points);
+        feature->attributes()->addField("speedLimit", (int64_t)(i % 130));
+        feature->attributes()->addField("name", fmt::format("Road {}", i % 100));
+    }
+    return {layerInfo, tile};
+}
+
+// Stream of numTiles copies of the tile, as a client would receive it.
+std::string throughputStream(TileFeatureLayer::Ptr const& tile, int numTiles)
+{
+    std::string byteStreamData;
+    TileLayerStream::StringPoolOffsetMap stringOffsets;
+    TileLayerStream::Writer layerWriter{[&](auto&& msg, auto&&) { byteStreamData += msg; }, stringOffsets};
+    for (auto i = 0; i < numTiles; ++i)
+        layerWriter.write(tile);
+    return byteStreamData;
+}
+
+}
+
+TEST_CASE("TileLayerStream Throughput", "[.][benchmark]")
+{
+    // Hidden by default, run with: test.mapget "TileLayerStream Throughput"
+    // Only uses the Reader API which predates the contiguous message buffer,
+    // so it can be run on older trees as well to compare the results.
+    mapget::setLogLevel("info", log());
+
+    auto throughputTile = makeThroughputTile();
+    auto layerInfo = throughputTile.first;
+    auto tile = throughputTile.second;
+    constexpr auto numTiles = 20;
+    auto byteStreamData = throughputStream(tile, numTiles);
+
+    // Report the best of a few runs, which is the least affected by noise.
+    constexpr auto numRuns = 5;
+    for (auto chunkSize : {size_t(4) << 10, size_t(64) << 10, byteStreamData.size()}) {
+        auto bestElapsed = std::numeric_limits<double>::max();
+        for (auto run = 0; run < numRuns; ++run) {
+            auto parsedTiles = 0;
+            TileLayerStream::Reader reader{
+                [&](auto&&, auto&&) { return layerInfo; },
+                [&](auto&&) { ++parsedTiles; }};
+
+            auto start = std::chrono::steady_clock::now();
+            for (size_t offset = 0; offset < byteStreamData.size(); offset += chunkSize)
+                reader.read(std::string_view(byteStreamData).substr(offset, chunkSize));
+            auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            bestElapsed = std::min(bestElapsed, elapsed);
+
+            REQUIRE(reader.eos());
+            REQUIRE(parsedTiles == numTiles);
+        }
+        log().info(
+            "Parsed {} MB in chunks of {} kB: {:.1f} MB/s (best of {} runs)",
+            byteStreamData.size() / 1000000.,
+            chunkSize / 1024,
+            byteStreamData.size() / 1000000. / bestElapsed,
+            numRuns);
+    }
+}
+
+TEST_CASE("TileLayerStream Quantization and Parallel Decoding", "[.][benchmark]")
+{
+    // Hidden by default, run with: test.mapget "[benchmark]"
+    mapget::setLogLevel("info", log());
+
+    auto throughputTile = makeThroughputTile();
+    auto layerInfo = throughputTile.first;
+    auto tile = throughputTile.second;
+    constexpr auto numTiles = 20;
+    auto byteStreamData = throughputStream(tile, numTiles);
+
+    // Compare the size of the tile with quantized vertices.
+    std::string floatTileBytes;
+    StringOutputStream floatTileStream(floatTileBytes);
+    tile->write(floatTileStream);
+    tile->setVertexPrecision(1e-7);
+    std::string quantizedTileBytes;
+    StringOutputStream quantizedTileStream(quantizedTileBytes);
+    tile->write(quantizedTileStream);
+    tile->setVertexPrecision(0.);
+    REQUIRE(quantizedTileBytes.size() < floatTileBytes.size());
+    log().info(
+        "Tile size with float vertices: {} kB, with quantized vertices: {} kB",
+        floatTileBytes.size() / 1000,
+        quantizedTileBytes.size() / 1000);
+
+    auto parsedTiles = 0;
+    TileLayerStream::Reader parallelReader{
+        [&](auto&&, auto&&) { return layerInfo; },
+        [&](auto&&) { ++parsedTiles; }};
+    auto numThreads = std::max(2u, std::thread::hardware_concurrency());
+    parallelReader.enableParallelDecoding(numThreads);
+
+    auto start = std::chrono::steady_clock::now();
+    parallelReader.read(byteStreamData);
+    parallelReader.waitForPendingLayers();
+    auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    REQUIRE(parsedTiles == numTiles);
+    log().info(
+        "Parsed {} MB on {} threads: {:.1f} MB/s",
+        byteStreamData.size() / 1000000.,
+        numThreads,
+        byteStreamData.size() / 1000000. / elapsed);
 }